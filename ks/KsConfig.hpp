@@ -31,8 +31,46 @@
     #endif
 #endif
 
+// ks::Function
+// * callables up to this size (in bytes) are stored inline
+//   instead of being allocated on the heap
+#ifndef KS_FUNCTION_INLINE_SIZE
+    #define KS_FUNCTION_INLINE_SIZE 64
+#endif
+
+// ks::Log
+// * KS_LOG statements below this level are compiled out
+//   (0: TRACE, 1: DEBUG, 2: INFO, 3: WARN, 4: ERROR, 5: FATAL)
+#ifndef KS_LOG_MIN_LEVEL
+    #define KS_LOG_MIN_LEVEL 0
+#endif
+
+// exceptions
+// * set when ks is built with exceptions disabled (ie with
+//   -fno-exceptions). Errors that would be thrown abort the
+//   process instead; use the non-throwing Try* variants of
+//   EventLoop and Signal methods to handle them
+#if !defined(KS_NO_EXCEPTIONS) && \
+    !defined(__cpp_exceptions) && !defined(__EXCEPTIONS)
+    #define KS_NO_EXCEPTIONS 1
+#endif
+
+// * set when ks::Exception can capture stack traces, which
+//   needs the GCC/Clang unwinder and dladdr. Elsewhere
+//   exceptions are created without a trace
+#if !defined(KS_EXCEPTION_STACK_TRACE) && \
+    (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(KS_ENV_ANDROID) || defined(KS_ENV_LINUX) || \
+     defined(KS_ENV_APPLE_IOS) || defined(KS_ENV_APPLE_OSX))
+    #define KS_EXCEPTION_STACK_TRACE 1
+#endif
+
 // thirdparty
 // builds without boost deps using c++11 instead
 #define ASIO_STANDALONE 1
 
+#if defined(KS_NO_EXCEPTIONS) && !defined(ASIO_NO_EXCEPTIONS)
+    #define ASIO_NO_EXCEPTIONS 1
+#endif
+
 #endif // KS_CONFIG_HPP
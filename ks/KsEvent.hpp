@@ -20,15 +20,24 @@
 #include <functional>
 #include <condition_variable>
 #include <future>
+#include <atomic>
 
 #include <ks/KsGlobal.hpp>
+#include <ks/KsFunction.hpp>
+#include <ks/KsEventPool.hpp>
 #include <ks/KsLog.hpp>
 
 namespace ks
 {
+    class EventQueue;
+    class EventStats;
+
     // Event
     class Event
     {
+        friend class EventQueue;
+        friend class EventStats;
+
     public:
         enum class Type : u8
         {
@@ -48,10 +57,38 @@ namespace ks
             return m_type;
         }
 
+        // * Events are allocated from an EventPool if one is
+        //   given (see EventLoop::MakeEvent) and from the global
+        //   heap otherwise. Either way, deleting an Event returns
+        //   its memory to where it came from
+        static void* operator new(std::size_t size)
+        {
+            return EventPool::Allocate(size,nullptr);
+        }
+
+        static void* operator new(std::size_t size,EventPool * pool)
+        {
+            return EventPool::Allocate(size,pool);
+        }
+
+        static void operator delete(void * ptr)
+        {
+            EventPool::Free(ptr);
+        }
+
+        static void operator delete(void * ptr,EventPool *)
+        {
+            EventPool::Free(ptr);
+        }
+
     protected:
 
         Event(Type type) :
-            m_type(type)
+            m_type(type),
+            m_handler_type(0),
+            m_pending_counted(false),
+            m_next(nullptr),
+            m_post_ns(0)
         {
             // empty
         }
@@ -63,6 +100,22 @@ namespace ks
 
     private:
         Type m_type;
+
+        // the EventLoop::HandlerType the event is invoked
+        // as, set by the EventLoop it's posted to. Zero is
+        // HandlerType::Slot (see EventStats)
+        u8 m_handler_type;
+
+        // whether the event was counted as pending by
+        // the EventLoop it's posted to (see EventStats)
+        bool m_pending_counted;
+
+        // intrusive link for EventQueue
+        std::atomic<Event*> m_next;
+
+        // when the event was posted, if its
+        // EventLoop collects stats (see EventStats)
+        u64 m_post_ns;
     };
 
     // NullEvent
@@ -132,12 +185,17 @@ namespace ks
         bool const m_repeating;
     };
 
+    // * Stop events are handled as they're posted, so
+    //   @timer only has to outlive the call to PostEvent
+    //   (ie it can be stopped from its destructor)
     class StopTimerEvent : public Event
     {
     public:
-        StopTimerEvent(Id timer_id) :
+        StopTimerEvent(Id timer_id,
+                       Timer * timer) :
             Event(Event::Type::StopTimer),
-            m_timer_id(timer_id)
+            m_timer_id(timer_id),
+            m_timer(timer)
         {
 
         }
@@ -152,15 +210,21 @@ namespace ks
             return m_timer_id;
         }
 
+        Timer * GetTimer() const
+        {
+            return m_timer;
+        }
+
     private:
         Id m_timer_id;
+        Timer * m_timer;
     };
 
     // SlotEvent
     class SlotEvent : public Event
     {
     public:
-        SlotEvent(std::function<void()> &&slot) :
+        SlotEvent(Function<void()> slot) :
             Event(Event::Type::Slot),
             m_slot(std::move(slot))
         {
@@ -178,13 +242,13 @@ namespace ks
         }
 
     private:
-        std::function<void()> m_slot;
+        Function<void()> m_slot;
     };
 
     class BlockingSlotEvent : public Event
     {
     public:
-        BlockingSlotEvent(std::function<void()> &&slot,
+        BlockingSlotEvent(Function<void()> slot,
                           bool * invoked,
                           std::mutex * invoked_mutex,
                           std::condition_variable * invoked_cv) :
@@ -214,7 +278,7 @@ namespace ks
         }
 
     private:
-        std::function<void()> m_slot;
+        Function<void()> m_slot;
 
         bool * m_invoked;
         std::mutex * m_invoked_mutex;
@@ -16,8 +16,12 @@
 
 // stl
 #include <map>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 // asio
+#include <ks/KsConfig.hpp> // sets ASIO_NO_EXCEPTIONS
 #include <ks/thirdparty/asio/asio.hpp>
 
 // ks
@@ -28,6 +32,23 @@
 #include <ks/KsEventLoop.hpp>
 #include <ks/KsException.hpp>
 
+#ifdef KS_NO_EXCEPTIONS
+namespace asio
+{
+    namespace detail
+    {
+        // asio calls this instead of throwing when
+        // ASIO_NO_EXCEPTIONS is defined
+        template <typename Exception>
+        void throw_exception(Exception const &e)
+        {
+            KS_THROW(ks::Exception(ks::Exception::ErrorLevel::FATAL,
+                                   std::string("asio: ")+e.what()));
+        }
+    }
+}
+#endif
+
 namespace ks
 {
     // ============================================================= //
@@ -42,6 +63,19 @@ namespace ks
 
     // ============================================================= //
 
+    namespace
+    {
+        // The event loop being Run by the current thread, if any.
+        // Used to identify worker threads of multi-worker loops
+        thread_local EventLoop * tls_active_loop = nullptr;
+
+        // The EventQueue being drained by the current thread,
+        // if any. Used to check if a thread is running a Strand
+        thread_local void const * tls_draining_queue = nullptr;
+    }
+
+    // ============================================================= //
+
     std::mutex EventLoop::s_id_mutex;
 
     // Start at one so that an Id of 0
@@ -58,19 +92,500 @@ namespace ks
 
     // ============================================================= //
 
+    // EventStats
+    // * The counters behind EventLoop::GetStats. An EventLoop
+    //   only has one if Config::collect_stats is set
+    // * Events are stamped with the time they're posted. Events
+    //   without a stamp (ie the stop event) aren't counted
+    // * The processed count is the number of queue_time samples
+    //   so that invoking an event only costs four increments
+    class EventStats final
+    {
+    public:
+        using HandlerType = EventLoop::HandlerType;
+
+        EventStats() :
+            m_posted(0)
+        {
+            // empty
+        }
+
+        static u64 Now()
+        {
+            return std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().
+                        time_since_epoch()).count();
+        }
+
+        static u64 GetPostTime(Event const * event)
+        {
+            return event->m_post_ns;
+        }
+
+        // * The handler type is kept by the Event since the
+        //   lock-free queue only passes Events along
+        static HandlerType GetHandlerType(Event const * event)
+        {
+            return static_cast<HandlerType>(event->m_handler_type);
+        }
+
+        static void SetHandlerType(Event * event,HandlerType type)
+        {
+            event->m_handler_type = static_cast<u8>(type);
+        }
+
+        // * Whether the event was counted by its loop's
+        //   PendingCounter, which isn't Event's friend
+        static bool IsPendingCounted(Event const * event)
+        {
+            return event->m_pending_counted;
+        }
+
+        static void SetPendingCounted(Event * event)
+        {
+            event->m_pending_counted = true;
+        }
+
+        void OnPost(Event * event)
+        {
+            event->m_post_ns = Now();
+            m_posted.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        // * Returns the time the task was posted
+        u64 OnPostTask()
+        {
+            m_posted.fetch_add(1,std::memory_order_relaxed);
+            return Now();
+        }
+
+        // * Timeouts aren't posted, so @post_ns is
+        //   ignored for HandlerType::Timeout
+        void OnInvoked(HandlerType type,
+                       u64 post_ns,
+                       u64 start_ns,
+                       u64 end_ns)
+        {
+            if(type != HandlerType::Timeout) {
+                m_queue_time.Add(start_ns-post_ns);
+            }
+            m_list_handler_time[static_cast<u8>(type)].Add(end_ns-start_ns);
+        }
+
+        EventLoop::Stats GetStats() const
+        {
+            EventLoop::Stats stats;
+
+            // Read the processed count before the posted count
+            // so that pending doesn't come out negative
+            m_queue_time.Read(stats.queue_time);
+            stats.processed = stats.queue_time.count;
+            stats.posted = m_posted.load(std::memory_order_relaxed);
+            stats.pending = (stats.posted > stats.processed) ?
+                        (stats.posted-stats.processed) : 0;
+
+            for(uint i=0; i < stats.handler_time.size(); i++) {
+                m_list_handler_time[i].Read(stats.handler_time[i]);
+            }
+
+            return stats;
+        }
+
+        // * Events and tasks that have been posted
+        //   but not invoked yet
+        u64 GetPending() const
+        {
+            EventLoop::Histogram queue_time;
+            m_queue_time.Read(queue_time);
+            u64 const posted = m_posted.load(std::memory_order_relaxed);
+            return (posted > queue_time.count) ?
+                        (posted-queue_time.count) : 0;
+        }
+
+    private:
+        class AtomicHistogram final
+        {
+        public:
+            AtomicHistogram() :
+                m_total_ns(0)
+            {
+                for(auto &bucket : m_buckets) {
+                    bucket.store(0,std::memory_order_relaxed);
+                }
+            }
+
+            void Add(u64 ns)
+            {
+                uint bucket = (ns == 0) ? 0 : (63-__builtin_clzll(ns));
+                bucket = std::min(bucket,s_last_bucket);
+
+                m_buckets[bucket].fetch_add(1,std::memory_order_relaxed);
+                m_total_ns.fetch_add(ns,std::memory_order_relaxed);
+            }
+
+            void Read(EventLoop::Histogram &histogram) const
+            {
+                histogram.count = 0;
+                for(uint i=0; i < EventLoop::Histogram::bucket_count; i++) {
+                    histogram.buckets[i] =
+                            m_buckets[i].load(std::memory_order_relaxed);
+                    histogram.count += histogram.buckets[i];
+                }
+                histogram.total_ns = m_total_ns.load(std::memory_order_relaxed);
+            }
+
+        private:
+            static uint const s_last_bucket =
+                    EventLoop::Histogram::bucket_count-1;
+
+            std::atomic<u64> m_total_ns;
+            std::array<
+                std::atomic<u64>,
+                EventLoop::Histogram::bucket_count
+            > m_buckets;
+        };
+
+        std::atomic<u64> m_posted;
+        AtomicHistogram m_queue_time;
+        std::array<AtomicHistogram,4> m_list_handler_time;
+    };
+
+    uint const EventStats::AtomicHistogram::s_last_bucket;
+
+    // ============================================================= //
+
+    // HandlerTracker
+    // * Publishes the start time of the handler that each of an
+    //   EventLoop's threads is running so that a Watchdog can
+    //   report handlers that run past their budget
+    // * Each thread running the loop has a Slot: Run workers
+    //   always, callers of ProcessEvents only while the loop is
+    //   being watched. The mutex is only locked to add or remove
+    //   Slots and when a Watchdog checks the loop
+    class HandlerTracker final
+    {
+    public:
+        using HandlerType = EventLoop::HandlerType;
+
+        struct Slot
+        {
+            Slot(HandlerTracker * tracker) :
+                tracker(tracker),
+                handler(0),
+                reported(0),
+                in_use(true)
+            {
+                // empty
+            }
+
+            HandlerTracker * const tracker;
+
+            // (start time in ns << 2) | HandlerType of the
+            // running handler, or 0 if there isn't one. A
+            // single word so that starting and ending a handler
+            // is a single store each
+            std::atomic<u64> handler;
+
+            // @handler when it was last reported
+            std::atomic<u64> reported;
+
+            bool in_use; // guarded by m_mutex
+        };
+
+        HandlerTracker() :
+            m_watch_count(0)
+        {
+            // empty
+        }
+
+        bool IsWatched() const
+        {
+            return (m_watch_count.load(std::memory_order_relaxed) > 0);
+        }
+
+        void Watch()
+        {
+            m_watch_count.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        void Unwatch()
+        {
+            m_watch_count.fetch_sub(1,std::memory_order_relaxed);
+        }
+
+        Slot * AddSlot()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // Reuse Slots so that ProcessEvents doesn't
+            // allocate each time it's called
+            for(auto& slot : m_list_slots) {
+                if(!slot->in_use) {
+                    slot->in_use = true;
+                    return slot.get();
+                }
+            }
+
+            m_list_slots.push_back(make_unique<Slot>(this));
+            return m_list_slots.back().get();
+        }
+
+        void RemoveSlot(Slot * slot)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot->handler.store(0,std::memory_order_relaxed);
+            slot->in_use = false;
+        }
+
+        // * Adds handlers that have been running for at least
+        //   @budget_ns to @list_stalls, once per invocation
+        void Check(u64 budget_ns,
+                   std::vector<std::pair<HandlerType,u64>> &list_stalls)
+        {
+            u64 const now_ns = EventStats::Now();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(auto& slot : m_list_slots) {
+                u64 const handler =
+                        slot->handler.load(std::memory_order_relaxed);
+
+                if(handler == 0) {
+                    continue;
+                }
+
+                u64 const start_ns = handler >> 2;
+                if((now_ns < start_ns) || (now_ns-start_ns < budget_ns)) {
+                    continue;
+                }
+
+                if(slot->reported.exchange(
+                       handler,std::memory_order_relaxed) == handler) {
+                    continue;
+                }
+
+                list_stalls.emplace_back(
+                            static_cast<HandlerType>(handler & 3),
+                            now_ns-start_ns);
+            }
+        }
+
+    private:
+        std::atomic<uint> m_watch_count;
+        std::mutex m_mutex;
+        std::vector<unique_ptr<Slot>> m_list_slots;
+    };
+
+    namespace
+    {
+        // * Counts the events and tasks posted to an EventLoop
+        //   and the ones it has run, so that the bounded
+        //   ProcessEvents calls can return how many are pending
+        //   without Config::collect_stats
+        // * Only enabled while the loop is run with the bounded
+        //   ProcessEvents calls so that other loops don't pay
+        //   for it. Each event remembers whether it was counted,
+        //   so the counts stay consistent when it's toggled
+        // * The posted and invoked counts are kept on separate
+        //   cache lines since they're written by different threads
+        class PendingCounter final
+        {
+        public:
+            PendingCounter()
+            {
+                m_posted.enabled.store(true,std::memory_order_relaxed);
+                m_posted.count.store(0,std::memory_order_relaxed);
+                m_invoked.count.store(0,std::memory_order_relaxed);
+            }
+
+            // * Called by the thread running the loop
+            void SetEnabled(bool enabled)
+            {
+                if(m_posted.enabled.load(std::memory_order_relaxed) != enabled) {
+                    m_posted.enabled.store(enabled,std::memory_order_relaxed);
+                }
+            }
+
+            // * Must be called before the event is posted
+            // * Returns true if the event was counted, in which
+            //   case OnInvoked must be called once it's run
+            bool OnPost()
+            {
+                if(!m_posted.enabled.load(std::memory_order_relaxed)) {
+                    return false;
+                }
+                m_posted.count.fetch_add(1,std::memory_order_relaxed);
+                return true;
+            }
+
+            void OnInvoked()
+            {
+                m_invoked.count.fetch_add(1,std::memory_order_relaxed);
+            }
+
+            u64 Get() const
+            {
+                // Read the invoked count first so that
+                // the result doesn't come out negative
+                u64 const invoked = m_invoked.count.load(std::memory_order_relaxed);
+                u64 const posted = m_posted.count.load(std::memory_order_relaxed);
+                return (posted > invoked) ? (posted-invoked) : 0;
+            }
+
+        private:
+            struct PostedCount
+            {
+                std::atomic<bool> enabled;
+                std::atomic<u64> count;
+                char padding[64-sizeof(std::atomic<u64>)];
+            };
+
+            struct InvokedCount
+            {
+                std::atomic<u64> count;
+                char padding[64-sizeof(std::atomic<u64>)];
+            };
+
+            PostedCount m_posted;
+            InvokedCount m_invoked;
+        };
+
+        // * Counts and bounds the events run by ProcessEvents
+        struct ProcessLimit
+        {
+            ProcessLimit(u64 max_events,u64 deadline_ns) :
+                max_events(max_events),
+                deadline_ns(deadline_ns),
+                count(0)
+            {
+                // empty
+            }
+
+            // * At least one event is run before the deadline
+            //   is checked so that the caller always makes
+            //   progress, even with a zero budget
+            bool Reached() const
+            {
+                return ((count >= max_events) ||
+                        ((count > 0) && (deadline_ns != 0) &&
+                         (EventStats::Now() >= deadline_ns)));
+            }
+
+            u64 const max_events;
+            u64 const deadline_ns; // 0 if there's no deadline
+            u64 count;
+        };
+
+        // * The state of the event loop being run by the
+        //   current thread, from Run or ProcessEvents
+        struct LoopThreadState
+        {
+            // Published to Watchdogs; null if the thread
+            // doesn't publish its handlers
+            HandlerTracker::Slot * slot;
+
+            // Null unless the thread is running
+            // ProcessEvents
+            ProcessLimit * limit;
+
+            // The loop's count of pending events; only
+            // used for handlers that were counted
+            PendingCounter * pending;
+        };
+
+        thread_local LoopThreadState * tls_loop_state = nullptr;
+
+        // * Publishes a handler to its Slot for as long as
+        //   it's running
+        class HandlerScope final
+        {
+        public:
+            HandlerScope(HandlerTracker::Slot * slot,
+                         EventLoop::HandlerType type,
+                         u64 start_ns) :
+                m_slot(slot),
+                m_prev(0)
+            {
+                if(m_slot) {
+                    // Handlers can be nested, ie if one calls
+                    // ProcessEvents for a different loop
+                    m_prev = m_slot->handler.load(std::memory_order_relaxed);
+                    m_slot->handler.store(
+                                (start_ns << 2) | static_cast<u8>(type),
+                                std::memory_order_relaxed);
+                }
+            }
+
+            ~HandlerScope()
+            {
+                if(m_slot) {
+                    m_slot->handler.store(m_prev,std::memory_order_relaxed);
+                }
+            }
+
+        private:
+            HandlerTracker::Slot * const m_slot;
+            u64 m_prev;
+        };
+
+        // * Invokes @fn, publishing it to any Watchdog that
+        //   is watching the loop and recording it in @stats
+        //   if @stats isn't null
+        // * @counted is true if the handler was counted by
+        //   the loop's PendingCounter when it was posted
+        template<typename Fn>
+        void invokeHandler(Fn && fn,
+                           EventLoop::HandlerType type,
+                           EventStats * stats,
+                           u64 post_ns,
+                           bool counted)
+        {
+            HandlerTracker::Slot * slot = nullptr;
+
+            if(LoopThreadState * const state = tls_loop_state) {
+                if(state->limit) {
+                    state->limit->count++;
+                }
+                if(counted) {
+                    state->pending->OnInvoked();
+                }
+                slot = state->slot;
+            }
+
+            bool const watched = slot && slot->tracker->IsWatched();
+
+            if(!(watched || stats)) {
+                fn();
+                return;
+            }
+
+            u64 const start_ns = EventStats::Now();
+            HandlerScope scope(watched ? slot : nullptr,type,start_ns);
+            fn();
+
+            if(stats) {
+                stats->OnInvoked(type,post_ns,start_ns,EventStats::Now());
+            }
+        }
+    }
+
+    // ============================================================= //
+
     struct TimerInfo
     {
         TimerInfo(Id id,
                   weak_ptr<Timer> timer,
                   asio::io_service & service,
                   Milliseconds interval_ms,
-                  bool repeat) :
+                  bool repeat,
+                  EventStats * stats) :
             id(id),
             timer(timer),
             interval_ms(interval_ms),
             asio_timer(service,interval_ms),
             repeat(repeat),
-            canceled(false)
+            canceled(false),
+            stats(stats)
         {
             // empty
         }
@@ -81,6 +596,7 @@ namespace ks
         asio::steady_timer asio_timer;
         bool repeat;
         bool canceled;
+        EventStats * stats;
     };
 
     // ============================================================= //
@@ -122,143 +638,928 @@ namespace ks
                 return;
             }
 
-            // If this is a repeating timer, post another timeout
-            if(m_timerinfo->repeat) {
-                TimerInfo * timerinfo = m_timerinfo.get();
+            EventStats * stats = m_timerinfo->stats;
+
+            // If this is a repeating timer, post another timeout
+            if(m_timerinfo->repeat) {
+                TimerInfo * timerinfo = m_timerinfo.get();
+
+                timerinfo->asio_timer.expires_from_now(
+                            timerinfo->interval_ms);
+
+                timerinfo->asio_timer.async_wait(
+                            TimeoutHandler(m_timerinfo,true));
+            }
+            else {
+                // mark inactive
+                timer->m_active = false;
+            }
+
+            // Emit the timeout signal
+            invokeHandler([&timer]() { timer->signal_timeout.Emit(); },
+                          EventLoop::HandlerType::Timeout,
+                          stats,0,false);
+        }
+
+    private:
+        shared_ptr<TimerInfo> m_timerinfo;
+    };
+
+    // ============================================================= //
+
+    // TimerWheel
+    // * A hierarchical timing wheel that an EventLoop can use in
+    //   place of a separate asio timer per ks::Timer (see
+    //   EventLoop::TimerType::Wheel)
+    // * There are four levels of 256 slots each. Level 0 holds
+    //   timers that expire within 256 ticks, level 1 within 2^16
+    //   ticks and so on; when the current tick crosses into a new
+    //   slot of a higher level, that slot's timers are cascaded
+    //   down. Starting, stopping and expiring a timer is O(1)
+    // * Timers are kept in a single array and linked into their
+    //   slot by index. Freed entries are reused
+    // * Each ks::Timer keeps the index of its entry, so stopping
+    //   or restarting it goes straight to the entry
+    // * A single asio timer is armed for the next tick that has
+    //   work (an occupied level 0 slot or a cascade). Every tick
+    //   that has passed since the last wakeup is processed when
+    //   it fires
+    // * Wakeups are dispatched through a strand; rearming can't
+    //   cancel a wakeup that a worker has already dequeued, so
+    //   two could otherwise run at once on a multi-worker loop
+    class TimerWheel final
+    {
+    public:
+        TimerWheel(asio::io_service & service,
+                   Milliseconds tick,
+                   EventStats * stats) :
+            m_stats(stats),
+            m_asio_strand(service),
+            m_asio_timer(service),
+            m_tick_ms(std::max(tick,Milliseconds(1))),
+            m_start(std::chrono::steady_clock::now()),
+            m_tick(0),
+            m_armed(false),
+            m_wake_tick(0),
+            m_free_head(s_null),
+            m_entry_count(0)
+        {
+            for(auto& head : m_slot_heads) {
+                head = s_null;
+            }
+            for(auto& bits : m_slot_bits) {
+                bits = 0;
+            }
+        }
+
+        void Start(shared_ptr<Timer> const &timer,
+                   Milliseconds interval_ms,
+                   bool repeat)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            u64 const now_tick = nowTick();
+            if(m_entry_count == 0) {
+                // Nothing to process, so skip ahead
+                m_tick = now_tick;
+            }
+
+            // Restarting a timer replaces its entry
+            remove(timer.get());
+
+            u32 const index = allocate();
+            Entry &entry = m_list_entries[index];
+            entry.id = timer->GetId();
+            entry.timer = timer;
+            entry.interval = toTicks(interval_ms);
+            entry.repeat = repeat;
+            entry.expiry = now_tick+entry.interval+1;
+
+            timer->m_wheel_entry = index;
+            insert(index);
+
+            if(!m_armed || (entry.expiry < m_wake_tick)) {
+                arm(entry.expiry);
+            }
+        }
+
+        // * @timer may be partway through being destroyed
+        // * Returns false if @timer wasn't running
+        bool Stop(Timer * timer)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if(!remove(timer)) {
+                return false;
+            }
+
+            timer->m_active = false;
+            return true;
+        }
+
+    private:
+        struct Entry
+        {
+            u32 prev;
+            u32 next;
+            u32 interval; // ticks
+            u16 slot;     // (level*256)+index, s_free_slot if freed
+            bool repeat;
+            u64 expiry;   // tick
+            Id id;
+            weak_ptr<Timer> timer;
+        };
+
+        u64 nowTick() const
+        {
+            auto const elapsed =
+                    std::chrono::steady_clock::now()-m_start;
+
+            return static_cast<u64>(elapsed/m_tick_ms);
+        }
+
+        // * Since nowTick() rounds down, timers expire
+        //   one tick after now + their interval
+        u32 toTicks(Milliseconds interval_ms) const
+        {
+            // Round up so that timers never expire early
+            auto const ticks =
+                    (interval_ms+m_tick_ms-Milliseconds(1))/m_tick_ms;
+
+            return static_cast<u32>(std::max<decltype(ticks)>(ticks,1));
+        }
+
+        u32 allocate()
+        {
+            m_entry_count++;
+
+            if(m_free_head == s_null) {
+                m_list_entries.emplace_back();
+                return static_cast<u32>(m_list_entries.size()-1);
+            }
+
+            u32 const index = m_free_head;
+            m_free_head = m_list_entries[index].next;
+            return index;
+        }
+
+        void release(u32 index)
+        {
+            Entry &entry = m_list_entries[index];
+            entry.timer.reset();
+            entry.slot = s_free_slot;
+            entry.next = m_free_head;
+            m_free_head = index;
+            m_entry_count--;
+        }
+
+        void insert(u32 index)
+        {
+            Entry &entry = m_list_entries[index];
+            u64 const delta = entry.expiry-m_tick;
+
+            uint level=0;
+            while((level < s_levels-1) &&
+                  (delta >= (u64(1) << (s_slot_bits*(level+1))))) {
+                level++;
+            }
+
+            u16 const slot =
+                    (level*s_slots)+
+                    ((entry.expiry >> (s_slot_bits*level)) & (s_slots-1));
+
+            entry.slot = slot;
+            entry.prev = s_null;
+            entry.next = m_slot_heads[slot];
+            if(entry.next != s_null) {
+                m_list_entries[entry.next].prev = index;
+            }
+            m_slot_heads[slot] = index;
+            m_slot_bits[slot/64] |= (u64(1) << (slot%64));
+        }
+
+        // * Unlinks @timer's entry and frees it
+        // * A one-shot timer's entry is freed without clearing
+        //   m_wheel_entry if the timer is being destroyed when it
+        //   expires, so the entry is checked before it's used
+        // * Returns false if @timer didn't have an entry
+        bool remove(Timer * timer)
+        {
+            u32 const index = timer->m_wheel_entry;
+            timer->m_wheel_entry = s_null;
+
+            if((index == s_null) ||
+               (m_list_entries[index].slot == s_free_slot) ||
+               (m_list_entries[index].id != timer->GetId())) {
+                return false;
+            }
+
+            unlink(index);
+            release(index);
+            return true;
+        }
+
+        void unlink(u32 index)
+        {
+            Entry &entry = m_list_entries[index];
+            if(entry.prev != s_null) {
+                m_list_entries[entry.prev].next = entry.next;
+            }
+            else {
+                m_slot_heads[entry.slot] = entry.next;
+                if(entry.next == s_null) {
+                    m_slot_bits[entry.slot/64] &= ~(u64(1) << (entry.slot%64));
+                }
+            }
+
+            if(entry.next != s_null) {
+                m_list_entries[entry.next].prev = entry.prev;
+            }
+        }
+
+        // * Detaches and returns the list of entries in @slot
+        u32 takeSlot(u16 slot)
+        {
+            u32 const head = m_slot_heads[slot];
+            m_slot_heads[slot] = s_null;
+            m_slot_bits[slot/64] &= ~(u64(1) << (slot%64));
+            return head;
+        }
+
+        // * Returns the next tick after m_tick that has work:
+        //   either an occupied level 0 slot, or the start of the
+        //   next level 0 rotation (where higher levels cascade)
+        u64 nextTick() const
+        {
+            u64 const tick = m_tick+1;
+            uint const first = (tick & (s_slots-1));
+            if(first == 0) {
+                return tick;
+            }
+
+            for(uint i=first/64; i < s_slots/64; i++) {
+                u64 bits = m_slot_bits[i];
+                if(i == first/64) {
+                    bits &= (~u64(0) << (first%64));
+                }
+                if(bits) {
+                    uint slot = i*64;
+                    while((bits & 1) == 0) {
+                        bits >>= 1;
+                        slot++;
+                    }
+                    return ((tick & ~u64(s_slots-1)) | slot);
+                }
+            }
+
+            return ((tick | (s_slots-1))+1);
+        }
+
+        void arm(u64 tick)
+        {
+            m_armed = true;
+            m_wake_tick = tick;
+            m_asio_timer.expires_at(m_start+(tick*m_tick_ms));
+            m_asio_timer.async_wait(
+                        m_asio_strand.wrap(
+                            std::bind(&TimerWheel::onTimeout,
+                                      this,
+                                      std::placeholders::_1)));
+        }
+
+        void onTimeout(asio::error_code const &ec)
+        {
+            if(ec == asio::error::operation_aborted) {
+                // Rearmed or canceled
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                m_armed = false;
+                advance(nowTick());
+
+                if(m_entry_count > 0) {
+                    arm(nextTick());
+                }
+            }
+
+            // Emit outside of the lock so that slots
+            // can start and stop timers
+            for(auto& timer : m_list_expired) {
+                invokeHandler([&timer]() { timer->signal_timeout.Emit(); },
+                              EventLoop::HandlerType::Timeout,
+                              m_stats,0,false);
+            }
+            m_list_expired.clear();
+        }
+
+        // * Processes every tick up to and including @now_tick
+        void advance(u64 now_tick)
+        {
+            while(m_tick < now_tick) {
+                u64 const tick = nextTick();
+                if(tick > now_tick) {
+                    m_tick = now_tick;
+                    break;
+                }
+
+                m_tick = tick;
+
+                // Cascade from the highest level that
+                // moved into a new slot
+                if((tick & (s_slots-1)) == 0) {
+                    uint level=1;
+                    while((level < s_levels-1) &&
+                          ((tick >> (s_slot_bits*level)) & (s_slots-1)) == 0) {
+                        level++;
+                    }
+
+                    for(; level > 0; level--) {
+                        cascade(level,tick);
+                    }
+                }
+
+                expire(static_cast<u16>(tick & (s_slots-1)),now_tick);
+            }
+        }
+
+        void cascade(uint level,u64 tick)
+        {
+            u16 const slot =
+                    (level*s_slots)+
+                    ((tick >> (s_slot_bits*level)) & (s_slots-1));
+
+            u32 index = takeSlot(slot);
+            while(index != s_null) {
+                u32 const next = m_list_entries[index].next;
+                insert(index);
+                index = next;
+            }
+        }
+
+        void expire(u16 slot,u64 now_tick)
+        {
+            u32 index = takeSlot(slot);
+            while(index != s_null) {
+                Entry &entry = m_list_entries[index];
+                u32 const next = entry.next;
+
+                auto timer = entry.timer.lock();
+                if(timer && entry.repeat) {
+                    entry.expiry = now_tick+entry.interval+1;
+                    insert(index);
+                }
+                else {
+                    if(timer) {
+                        timer->m_active = false;
+                        timer->m_wheel_entry = s_null;
+                    }
+                    release(index);
+                }
+
+                if(timer) {
+                    m_list_expired.push_back(std::move(timer));
+                }
+
+                index = next;
+            }
+        }
+
+        static uint const s_levels = 4;
+        static uint const s_slot_bits = 8;
+        static uint const s_slots = 1 << s_slot_bits;
+        static u32 const s_null = Timer::s_no_wheel_entry;
+        static u16 const s_free_slot = 0xFFFF;
+
+        EventStats * const m_stats;
+        std::mutex m_mutex;
+        asio::io_service::strand m_asio_strand;
+        asio::steady_timer m_asio_timer;
+        Milliseconds const m_tick_ms;
+        std::chrono::steady_clock::time_point const m_start;
+
+        u64 m_tick; // the last tick that was processed
+        bool m_armed;
+        u64 m_wake_tick;
+
+        std::vector<Entry> m_list_entries;
+        u32 m_free_head;
+        u32 m_entry_count; // entries in use
+
+        u32 m_slot_heads[s_levels*s_slots];
+        u64 m_slot_bits[(s_levels*s_slots)/64];
+
+        // Only used by onTimeout, which m_asio_strand
+        // serializes
+        std::vector<shared_ptr<Timer>> m_list_expired;
+    };
+
+    // ============================================================= //
+
+    class TaskHandler
+    {
+    public:
+        TaskHandler(shared_ptr<Task> task,
+                    asio::io_service* service,
+                    EventStats * stats,
+                    bool counted) :
+            m_task(task),
+            m_service(service),
+            m_stats(stats),
+            m_post_ns(stats ? stats->OnPostTask() : 0),
+            m_counted(counted)
+        {
+            // empty
+        }
+
+        ~TaskHandler()
+        {
+            // empty
+        }
+
+        TaskHandler(TaskHandler const &);
+
+        TaskHandler(TaskHandler&& other)
+        {
+            m_task = std::move(other.m_task);
+            m_service = other.m_service;
+            m_stats = other.m_stats;
+            m_post_ns = other.m_post_ns;
+            m_counted = other.m_counted;
+        }
+
+        void operator()()
+        {
+            Task * task = m_task.get();
+            invokeHandler([task]() { task->Invoke(); },
+                          EventLoop::HandlerType::Task,
+                          m_stats,m_post_ns,m_counted);
+        }
+
+    private:
+        shared_ptr<Task> m_task;
+        asio::io_service* m_service;
+        EventStats * m_stats;
+        u64 m_post_ns;
+        bool m_counted;
+    };
+
+    // ============================================================= //
+
+    namespace
+    {
+        void invokeEvent(Event * event)
+        {
+            auto const ev_type = event->GetType();
+
+            if(ev_type == Event::Type::Slot) {
+                SlotEvent * ev =
+                        static_cast<SlotEvent*>(event);
+                ev->Invoke();
+            }
+            else if(ev_type == Event::Type::BlockingSlot) {
+                BlockingSlotEvent * ev =
+                        static_cast<BlockingSlotEvent*>(event);
+                ev->Invoke();
+            }
+        }
+
+        void invokeEvent(Event * event,EventStats * stats)
+        {
+            // Events that weren't stamped when they were
+            // posted (ie the stop event) aren't counted
+            u64 const post_ns =
+                    stats ? EventStats::GetPostTime(event) : 0;
+
+            invokeHandler([event]() { invokeEvent(event); },
+                          EventStats::GetHandlerType(event),
+                          (post_ns == 0) ? nullptr : stats,
+                          post_ns,
+                          EventStats::IsPendingCounted(event));
+        }
+    }
+
+    // ============================================================= //
+
+    class EventHandler
+    {
+    public:
+        EventHandler(unique_ptr<Event> &event,
+                     asio::io_service * service,
+                     EventStats * stats) :
+            m_event(std::move(event)),
+            m_service(service),
+            m_stats(stats)
+        {
+            // empty
+        }
+
+        ~EventHandler()
+        {
+            // empty
+        }
+
+        // NOTE: asio requires handlers to be copy constructible,
+        // but we want to force them to be move only (as @event
+        // is not meant to be a shared resource). Apparently a
+        // workaround is to declare but not define the copy
+        // constructor:
+        // http://stackoverflow.com/questions/17211263/...
+        // how-to-trick-boostasio-to-allow-move-only-handlers
+        EventHandler(EventHandler const &other);
+
+        EventHandler(EventHandler && other)
+        {
+            m_event = std::move(other.m_event);
+            m_service = other.m_service;
+            m_stats = other.m_stats;
+        }
+
+        void operator()()
+        {
+            invokeEvent(m_event.get(),m_stats);
+        }
+
+    private:
+        unique_ptr<Event> m_event;
+        asio::io_service * m_service;
+        EventStats * m_stats;
+    };
+
+    // ============================================================= //
+
+    // EventQueue
+    // * Intrusive multi-producer, single-consumer queue of Events
+    //   based on Dmitry Vyukov's non-blocking MPSC queue
+    // * Push() is a single atomic exchange plus a check to see
+    //   if the queue needs to be woken up; the asio service is
+    //   only posted to when a drain isn't already scheduled
+    // * At most one drain is ever scheduled, so Events are
+    //   invoked serially and in order even if the asio service
+    //   is run by several worker threads
+    class EventQueue final :
+            public std::enable_shared_from_this<EventQueue>
+    {
+    public:
+        EventQueue(asio::io_service & service,
+                   uint batch_size,
+                   EventStats * stats) :
+            m_service(service),
+            m_batch_size(std::max(batch_size,1u)),
+            m_stats(stats),
+            m_head(&m_stub),
+            m_tail(&m_stub),
+            m_drain_scheduled(false)
+        {
+            // empty
+        }
+
+        ~EventQueue()
+        {
+            // There are no producers or consumers left,
+            // so any remaining events are just destroyed
+            while(Event * event = pop()) {
+                delete event;
+            }
+        }
+
+        void Push(unique_ptr<Event> event)
+        {
+            pushNode(event.release());
+
+            // Check before exchanging so that producers don't
+            // all contend on the flag while a drain is pending
+            if(!m_drain_scheduled.load() &&
+               !m_drain_scheduled.exchange(true)) {
+                scheduleDrain();
+            }
+        }
+
+    private:
+        void scheduleDrain()
+        {
+            m_service.post(
+                        std::bind(&EventQueue::drain,
+                                  shared_from_this()));
+        }
+
+        void drain()
+        {
+            DrainScope scope(this);
+
+            uint count=0;
+            bool retry=false;
+
+            while(true) {
+                Event * event = pop();
+
+                if(event) {
+                    retry = false;
+                    invoke(unique_ptr<Event>(event));
+                    count++;
+
+                    if(m_service.stopped() || (count == m_batch_size) ||
+                       limitReached()) {
+                        // Keep the drain scheduled; if the loop was
+                        // stopped or a bounded ProcessEvents ran out,
+                        // the drain resumes once its run again.
+                        // Otherwise we yield so that other handlers
+                        // (ie timers) aren't starved
+                        scheduleDrain();
+                        return;
+                    }
+                    continue;
+                }
+
+                if(retry) {
+                    // A producer is partway through a push; yield
+                    // to the asio service instead of spinning
+                    scheduleDrain();
+                    return;
+                }
+
+                // The queue appears empty. Release the drain, then
+                // check again in case an event was pushed by a
+                // producer that saw the drain as still scheduled
+                // * m_tail must be read before the drain is released;
+                //   afterwards another worker may already be running
+                //   a new drain that writes it
+                bool const drained = (m_tail == &m_stub);
+                m_drain_scheduled.store(false);
+
+                if((drained && (m_head.load() == &m_stub)) ||
+                   m_drain_scheduled.exchange(true)) {
+                    return;
+                }
+                retry = true;
+            }
+        }
+
+        struct DrainScope final
+        {
+            DrainScope(EventQueue const * queue) :
+                prev_queue(tls_draining_queue)
+            {
+                tls_draining_queue = queue;
+            }
+
+            ~DrainScope()
+            {
+                tls_draining_queue = prev_queue;
+            }
+
+            void const * const prev_queue;
+        };
+
+        static bool limitReached()
+        {
+            LoopThreadState * const state = tls_loop_state;
+            return (state && state->limit && state->limit->Reached());
+        }
+
+        void invoke(unique_ptr<Event> event)
+        {
+#ifdef KS_NO_EXCEPTIONS
+            invokeEvent(event.get(),m_stats);
+#else
+            try {
+                invokeEvent(event.get(),m_stats);
+            }
+            catch(...) {
+                // Don't leave the queue without a drain
+                scheduleDrain();
+                throw;
+            }
+#endif
+        }
+
+        void pushNode(Event * node)
+        {
+            node->m_next.store(nullptr,std::memory_order_relaxed);
+            Event * prev = m_head.exchange(node);
+            prev->m_next.store(node,std::memory_order_release);
+        }
+
+        Event * pop()
+        {
+            Event * tail = m_tail;
+            Event * next = tail->m_next.load(std::memory_order_acquire);
+
+            if(tail == &m_stub) {
+                if(next == nullptr) {
+                    return nullptr;
+                }
+                m_tail = next;
+                tail = next;
+                next = next->m_next.load(std::memory_order_acquire);
+            }
+
+            if(next) {
+                m_tail = next;
+                return tail;
+            }
+
+            if(tail != m_head.load()) {
+                // A producer is partway through a push
+                return nullptr;
+            }
 
-                timerinfo->asio_timer.expires_from_now(
-                            timerinfo->interval_ms);
+            // @tail is the last event; push the stub back
+            // so that @tail can be unlinked
+            pushNode(&m_stub);
 
-                timerinfo->asio_timer.async_wait(
-                            TimeoutHandler(m_timerinfo,true));
-            }
-            else {
-                // mark inactive
-                timer->m_active = false;
+            next = tail->m_next.load(std::memory_order_acquire);
+            if(next) {
+                m_tail = next;
+                return tail;
             }
 
-            // Emit the timeout signal
-            timer->signal_timeout.Emit();
+            return nullptr;
         }
 
-    private:
-        shared_ptr<TimerInfo> m_timerinfo;
+        asio::io_service & m_service;
+        uint const m_batch_size;
+        EventStats * const m_stats;
+
+        NullEvent m_stub;
+        std::atomic<Event*> m_head; // producers
+        Event * m_tail; // consumer
+
+        std::atomic<bool> m_drain_scheduled;
     };
 
     // ============================================================= //
 
-    class TaskHandler
+    class EventLoop::Strand final
     {
     public:
-        TaskHandler(shared_ptr<Task> task,
-                    asio::io_service* service) :
-            m_task(task),
-            m_service(service)
-        {
-            // empty
-        }
-
-        ~TaskHandler()
+        Strand(asio::io_service & service,
+               shared_ptr<EventQueue> event_queue) :
+            m_asio_strand(service),
+            m_event_queue(std::move(event_queue))
         {
             // empty
         }
 
-        TaskHandler(TaskHandler const &);
-
-        TaskHandler(TaskHandler&& other)
+        // * Returns true if the calling thread is invoking
+        //   events that were posted through this Strand
+        bool RunningInThisThread() const
         {
-            m_task = std::move(other.m_task);
-            m_service = other.m_service;
+            if(m_event_queue) {
+                return (tls_draining_queue == m_event_queue.get());
+            }
+            return m_asio_strand.running_in_this_thread();
         }
 
-        void operator()()
-        {
-            m_task->Invoke();
-        }
+        asio::io_service::strand m_asio_strand;
 
-    private:
-        shared_ptr<Task> m_task;
-        asio::io_service* m_service;
+        // Only used with QueueType::LockFree
+        shared_ptr<EventQueue> m_event_queue;
     };
 
     // ============================================================= //
 
-    class EventHandler
+    // EventLoop implementation
+    struct EventLoop::Impl
     {
-    public:
-        EventHandler(unique_ptr<Event> &event,
-                     asio::io_service * service) :
-            m_event(std::move(event)),
-            m_service(service)
+        Impl(Config const &config)
         {
-            // empty
+            if(config.collect_stats) {
+                m_stats = make_unique<EventStats>();
+            }
+            if(config.queue_type == QueueType::LockFree) {
+                m_event_queue = createEventQueue(config);
+            }
+            if(config.timer_type == TimerType::Wheel) {
+                m_timer_wheel = make_unique<TimerWheel>(
+                            m_asio_service,
+                            config.timer_wheel_tick,
+                            m_stats.get());
+            }
         }
 
-        ~EventHandler()
+        // * Must be called before @event is posted
+        void onPost(Event * event)
         {
-            // empty
+            if(m_stats) {
+                m_stats->OnPost(event);
+            }
+            else if(m_pending.OnPost()) {
+                EventStats::SetPendingCounted(event);
+            }
         }
 
-        // NOTE: asio requires handlers to be copy constructible,
-        // but we want to force them to be move only (as @event
-        // is not meant to be a shared resource). Apparently a
-        // workaround is to declare but not define the copy
-        // constructor:
-        // http://stackoverflow.com/questions/17211263/...
-        // how-to-trick-boostasio-to-allow-move-only-handlers
-        EventHandler(EventHandler const &other);
-
-        EventHandler(EventHandler && other)
+        // * With Config::collect_stats the pending events
+        //   are already counted by m_stats
+        u64 getPending() const
         {
-            m_event = std::move(other.m_event);
-            m_service = other.m_service;
+            return m_stats ? m_stats->GetPending() : m_pending.Get();
         }
 
-        void operator()()
+        shared_ptr<EventQueue> createEventQueue(Config const &config)
         {
-            auto const ev_type = m_event->GetType();
-
-            if(ev_type == Event::Type::Slot) {
-                SlotEvent * ev =
-                        static_cast<SlotEvent*>(
-                            m_event.get());
-                ev->Invoke();
-            }
-            else if(ev_type == Event::Type::BlockingSlot) {
-                BlockingSlotEvent * ev =
-                        static_cast<BlockingSlotEvent*>(
-                            m_event.get());
-                ev->Invoke();
-            }
+            return make_shared<EventQueue>(
+                        m_asio_service,
+                        config.batch_size,
+                        m_stats.get());
         }
 
-    private:
-        unique_ptr<Event> m_event;
-        asio::io_service * m_service;
-    };
+        // Only used with Config::collect_stats
+        unique_ptr<EventStats> m_stats;
 
-    // ============================================================= //
+        // Events and tasks that haven't been run yet;
+        // only used without Config::collect_stats
+        PendingCounter m_pending;
 
-    // EventLoop implementation
-    struct EventLoop::Impl
-    {
-        Impl()
-        {
-            // empty
-        }
+        // Used by Watchdogs
+        HandlerTracker m_handler_tracker;
 
         asio::io_service m_asio_service;
         unique_ptr<asio::io_service::work> m_asio_work;
+
+        // Only used with QueueType::LockFree
+        shared_ptr<EventQueue> m_event_queue;
+
+        // Only used with TimerType::Wheel
+        unique_ptr<TimerWheel> m_timer_wheel;
     };
 
     // ============================================================= //
     // ============================================================= //
 
+    EventLoop::Config::Config() :
+        queue_type(QueueType::Asio),
+        batch_size(128),
+        event_pool_capacity(16384),
+        timer_type(TimerType::Asio),
+        timer_wheel_tick(1),
+        worker_count(1),
+        collect_stats(false)
+    {
+        // empty
+    }
+
+    EventLoop::Histogram::Histogram() :
+        count(0),
+        total_ns(0)
+    {
+        buckets.fill(0);
+    }
+
+    u64 EventLoop::Histogram::GetPercentile(double p) const
+    {
+        if(count == 0) {
+            return 0;
+        }
+
+        u64 target = static_cast<u64>(std::ceil(p*count));
+        target = std::max<u64>(target,1);
+
+        u64 sum = 0;
+        for(uint i=0; i < bucket_count-1; i++) {
+            sum += buckets[i];
+            if(sum >= target) {
+                return (u64(1) << (i+1));
+            }
+        }
+
+        return std::numeric_limits<u64>::max();
+    }
+
+    uint const EventLoop::Histogram::bucket_count;
+
+    EventLoop::Stats::Stats() :
+        posted(0),
+        processed(0),
+        pending(0)
+    {
+        // empty
+    }
+
+    // ============================================================= //
+
     EventLoop::EventLoop() :
+        EventLoop(Config())
+    {
+        // empty
+    }
+
+    EventLoop::EventLoop(Config const &config) :
         m_id(genId()),
+        m_config(config),
+        m_state_seq(0),
+        m_thread_id(m_thread_id_null),
         m_started(false),
         m_running(false),
-        m_impl(new Impl())
+        m_worker_count(std::max(config.worker_count,1u)),
+        m_impl(new Impl(m_config)),
+        m_event_pool(new EventPool(
+                         std::max({sizeof(NullEvent),
+                                   sizeof(SlotEvent),
+                                   sizeof(BlockingSlotEvent)}),
+                         m_config.event_pool_capacity))
     {
         // empty
     }
@@ -266,6 +1567,11 @@ namespace ks
     EventLoop::~EventLoop()
     {
         this->Stop();
+
+        // Any events that are still queued are returned
+        // to the pool when m_impl is destroyed; the pool
+        // is freed once the last of them is returned
+        m_event_pool->Release();
     }
 
     Id EventLoop::GetId() const
@@ -273,39 +1579,110 @@ namespace ks
         return m_id;
     }
 
+    EventLoop::Config const & EventLoop::GetConfig() const
+    {
+        return m_config;
+    }
+
     std::thread::id EventLoop::GetThreadId()
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        return m_thread_id;
+        return m_thread_id.load(std::memory_order_acquire);
+    }
+
+    uint EventLoop::GetWorkerCount() const
+    {
+        return m_worker_count;
     }
 
     bool EventLoop::GetStarted()
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        return m_started;
+        return m_started.load(std::memory_order_acquire);
     }
 
     bool EventLoop::GetRunning()
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        return m_running;
+        return m_running.load(std::memory_order_acquire);
     }
 
     void EventLoop::GetState(std::thread::id& thread_id,
                              bool& started,
                              bool& running)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        thread_id = m_thread_id;
-        started = m_started;
-        running = m_running;
+        // Retry until the state wasn't changed while
+        // it was being read (see setState)
+        while(true) {
+            u32 const seq = m_state_seq.load(std::memory_order_acquire);
+            if(seq & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            thread_id = m_thread_id.load(std::memory_order_relaxed);
+            started = m_started.load(std::memory_order_relaxed);
+            running = m_running.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(m_state_seq.load(std::memory_order_relaxed) == seq) {
+                return;
+            }
+        }
+    }
+
+    bool EventLoop::IsActiveThread()
+    {
+        if(tls_active_loop == this) {
+            return true;
+        }
+
+        return (std::this_thread::get_id() == this->GetThreadId());
+    }
+
+    bool EventLoop::IsRunningInStrand(Strand * strand)
+    {
+        if(!this->IsActiveThread()) {
+            return false;
+        }
+
+        // Events are only posted through Strands by
+        // multi-worker loops (see postEvent)
+        if((strand == nullptr) || (m_worker_count < 2)) {
+            return true;
+        }
+
+        return strand->RunningInThisThread();
+    }
+
+    EventLoop::Stats EventLoop::GetStats() const
+    {
+        if(m_impl->m_stats) {
+            return m_impl->m_stats->GetStats();
+        }
+        return Stats();
+    }
+
+    EventLoop * EventLoop::GetActiveLoop()
+    {
+        return tls_active_loop;
+    }
+
+    shared_ptr<EventLoop::Strand> EventLoop::CreateStrand()
+    {
+        shared_ptr<EventQueue> event_queue;
+        if(m_impl->m_event_queue) {
+            event_queue = m_impl->createEventQueue(m_config);
+        }
+
+        return make_shared<Strand>(
+                    m_impl->m_asio_service,
+                    std::move(event_queue));
     }
 
     void EventLoop::Start()
     {
         std::lock_guard<std::mutex> lock(m_mutex);
 
-        if(m_started || m_impl->m_asio_work) {
+        if(m_started.load(std::memory_order_relaxed) ||
+           m_impl->m_asio_work) {
             return;
         }
 
@@ -315,28 +1692,59 @@ namespace ks
                     new asio::io_service::work(
                         m_impl->m_asio_service));
 
-        this->setActiveThread();
-        m_started = true;
+        this->setState(std::this_thread::get_id(),
+                       true,
+                       m_running.load(std::memory_order_relaxed));
 
         m_cv_started.notify_all();
     }
 
     void EventLoop::Run()
+    {
+        throwOnError(TryRun());
+    }
+
+    EventLoop::Status EventLoop::TryRun()
     {
         {
             std::lock_guard<std::mutex> lock(m_mutex);
 
-            ensureActiveLoop();
-            ensureActiveThread();
+            Status status = checkActiveLoop();
+            if(status == Status::Ok) {
+                status = checkActiveThread();
+            }
+            if(status != Status::Ok) {
+                return status;
+            }
 
-            m_running = true;
+            this->setState(m_thread_id.load(std::memory_order_relaxed),
+                           m_started.load(std::memory_order_relaxed),
+                           true);
             m_cv_running.notify_all();
         }
 
-        m_impl->m_asio_service.run(); // blocks!
+        // Pending events are only counted for the
+        // bounded ProcessEvents calls
+        m_impl->m_pending.SetEnabled(false);
+
+        std::vector<std::thread> list_workers;
+        list_workers.reserve(m_worker_count-1);
+        for(uint i=1; i < m_worker_count; i++) {
+            list_workers.emplace_back(&EventLoop::runWorker,this);
+        }
+
+        this->runWorker(); // blocks!
+
+        for(auto& worker : list_workers) {
+            worker.join();
+        }
 
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_running = false;
+        this->setState(m_thread_id.load(std::memory_order_relaxed),
+                       m_started.load(std::memory_order_relaxed),
+                       false);
+
+        return Status::Ok;
     }
 
     void EventLoop::Stop()
@@ -345,8 +1753,9 @@ namespace ks
 
         m_impl->m_asio_work.reset(nullptr);
         m_impl->m_asio_service.stop();
-        unsetActiveThread();
-        m_started = false;
+        this->setState(m_thread_id_null,
+                       false,
+                       m_running.load(std::memory_order_relaxed));
         m_cv_stopped.notify_all();
     }
 
@@ -358,15 +1767,102 @@ namespace ks
 
     void EventLoop::ProcessEvents()
     {
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            ensureActiveLoop();
-            ensureActiveThread();
+        throwOnError(TryProcessEvents());
+    }
+
+    EventLoop::ProcessResult EventLoop::ProcessEvents(u64 max_events)
+    {
+        m_impl->m_pending.SetEnabled(true);
+
+        ProcessResult result;
+        throwOnError(processEvents(max_events,0,result));
+        return result;
+    }
+
+    EventLoop::ProcessResult EventLoop::ProcessEventsFor(Microseconds budget)
+    {
+        u64 const budget_ns =
+                std::chrono::duration_cast<
+                    std::chrono::nanoseconds>(budget).count();
+
+        m_impl->m_pending.SetEnabled(true);
+
+        ProcessResult result;
+        throwOnError(processEvents(
+                         std::numeric_limits<u64>::max(),
+                         EventStats::Now()+budget_ns,
+                         result));
+        return result;
+    }
+
+    EventLoop::Status EventLoop::TryProcessEvents()
+    {
+        m_impl->m_pending.SetEnabled(false);
+
+        ProcessResult result;
+        return processEvents(std::numeric_limits<u64>::max(),0,result);
+    }
+
+    EventLoop::Status EventLoop::processEvents(u64 max_events,
+                                               u64 deadline_ns,
+                                               ProcessResult &result)
+    {
+        Status status = checkActiveLoop();
+        if(status == Status::Ok) {
+            status = checkActiveThread();
+        }
+        if(status != Status::Ok) {
+            return status;
+        }
+
+        EventLoop * const prev_active_loop = tls_active_loop;
+        tls_active_loop = this;
+
+        // Only publish handlers if the loop is already being
+        // watched so that unwatched loops don't lock for each
+        // call to ProcessEvents
+        HandlerTracker & tracker = m_impl->m_handler_tracker;
+        ProcessLimit limit(max_events,deadline_ns);
+        LoopThreadState state{
+            tracker.IsWatched() ? tracker.AddSlot() : nullptr,
+            &limit,
+            &(m_impl->m_pending)
+        };
+
+        LoopThreadState * const prev_state = tls_loop_state;
+        tls_loop_state = &state;
+
+        bool const bounded =
+                (max_events != std::numeric_limits<u64>::max()) ||
+                (deadline_ns != 0);
+
+        if(bounded) {
+            // Each asio handler is a single event, a timer
+            // timeout or a batch from the lock-free queue,
+            // which checks the limit between events itself
+            while(!limit.Reached() &&
+                  (m_impl->m_asio_service.poll_one() > 0)) {
+                // empty
+            }
+        }
+        else {
+            m_impl->m_asio_service.poll();
         }
-        m_impl->m_asio_service.poll();
+
+        if(state.slot) {
+            tracker.RemoveSlot(state.slot);
+        }
+        tls_loop_state = prev_state;
+        tls_active_loop = prev_active_loop;
+
+        result.processed = limit.count;
+        result.pending = m_impl->getPending();
+
+        return Status::Ok;
     }
 
-    void EventLoop::PostEvent(unique_ptr<Event> event)
+    void EventLoop::PostEvent(unique_ptr<Event> event,
+                              Strand * strand)
     {
         // Timer events are handled immediately instead of
         // posting them to the event queue to avoid delaying
@@ -382,41 +1878,117 @@ namespace ks
                                 static_cast<StopTimerEvent*>(
                                     event.release())));
         }
+        else {
+            auto const type =
+                    (event->GetType() == Event::Type::BlockingSlot) ?
+                        HandlerType::BlockingSlot :
+                        HandlerType::Slot;
+
+            m_impl->onPost(event.get());
+            this->postEvent(std::move(event),strand,type);
+        }
+    }
+
+    void EventLoop::postEvent(unique_ptr<Event> event,
+                              Strand * strand,
+                              HandlerType type)
+    {
+        EventStats::SetHandlerType(event.get(),type);
+
+        if(m_impl->m_event_queue) {
+            if(strand && (m_worker_count > 1)) {
+                strand->m_event_queue->Push(std::move(event));
+            }
+            else {
+                m_impl->m_event_queue->Push(std::move(event));
+            }
+        }
+        else if(strand && (m_worker_count > 1)) {
+            // Only multi-worker loops need to use the Strand;
+            // events are already serialized with a single worker
+            strand->m_asio_strand.post(
+                        EventHandler(
+                            event,
+                            &(m_impl->m_asio_service),
+                            m_impl->m_stats.get()));
+        }
         else {
             m_impl->m_asio_service.post(
                         EventHandler(
                             event,
-                            &(m_impl->m_asio_service)));
+                            &(m_impl->m_asio_service),
+                            m_impl->m_stats.get()));
+        }
+    }
+
+    EventLoop::Status EventLoop::TryPostEvent(unique_ptr<Event> event,
+                                              Strand * strand)
+    {
+        if(!m_started.load(std::memory_order_acquire)) {
+            return Status::Inactive;
         }
+
+        this->PostEvent(std::move(event),strand);
+        return Status::Ok;
     }
 
     void EventLoop::PostTask(shared_ptr<Task> task)
     {
-        if(std::this_thread::get_id() == this->GetThreadId()) {
+        if(this->IsActiveThread()) {
             // Invoke right away to prevent deadlock in case
             // the calling thread calls Wait() on the task
             task->Invoke();
             return;
         }
 
+        if(m_impl->m_event_queue) {
+            // Keep tasks ordered with respect to other events
+            unique_ptr<Event> event =
+                    this->MakeEvent<SlotEvent>(
+                        std::bind(&Task::Invoke,task));
+
+            m_impl->onPost(event.get());
+            this->postEvent(std::move(event),nullptr,HandlerType::Task);
+            return;
+        }
+
         m_impl->m_asio_service.post(
                     TaskHandler(
                         task,
-                        &(m_impl->m_asio_service)));
+                        &(m_impl->m_asio_service),
+                        m_impl->m_stats.get(),
+                        !m_impl->m_stats && m_impl->m_pending.OnPost()));
     }
 
-    void EventLoop::PostCallback(std::function<void()> callback)
+    void EventLoop::PostCallback(Function<void()> callback)
     {
-        unique_ptr<Event> event = make_unique<SlotEvent>(std::move(callback));
+        unique_ptr<Event> event = this->MakeEvent<SlotEvent>(std::move(callback));
+
+        m_impl->onPost(event.get());
+
+        if(m_impl->m_event_queue) {
+            m_impl->m_event_queue->Push(std::move(event));
+            return;
+        }
 
         m_impl->m_asio_service.post(
                     EventHandler(
                         event,
-                        &(m_impl->m_asio_service)));
+                        &(m_impl->m_asio_service),
+                        m_impl->m_stats.get()));
     }
 
     void EventLoop::PostStopEvent()
     {
+        if(m_impl->m_event_queue) {
+            // Keep the stop ordered with respect to other events.
+            // Like with stats, it isn't counted as pending
+            m_impl->m_event_queue->Push(
+                        this->MakeEvent<SlotEvent>(
+                            std::bind(&EventLoop::Stop,this)));
+            return;
+        }
+
         m_impl->m_asio_service.post(std::bind(&EventLoop::Stop,this));
     }
 
@@ -474,43 +2046,115 @@ namespace ks
         }
     }
 
-    void EventLoop::setActiveThread()
+    void EventLoop::setState(std::thread::id thread_id,
+                             bool started,
+                             bool running)
     {
-        auto const calling_thread_id = std::this_thread::get_id();
-        m_thread_id = calling_thread_id;
+        // Seqlock write; the sequence is odd while the state
+        // is being changed. Writers are serialized by m_mutex
+        u32 const seq = m_state_seq.load(std::memory_order_relaxed);
+        m_state_seq.store(seq+1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        m_thread_id.store(thread_id,std::memory_order_release);
+        m_started.store(started,std::memory_order_release);
+        m_running.store(running,std::memory_order_release);
+
+        m_state_seq.store(seq+2,std::memory_order_release);
     }
 
-    void EventLoop::ensureActiveThread()
+    EventLoop::Status EventLoop::checkActiveThread() const
     {
-        auto const calling_thread_id = std::this_thread::get_id();
-
         // Ensure that the thread is this event loop's
         // active thread
-        if(m_thread_id != calling_thread_id) {
-            throw EventLoopCalledFromWrongThread(
-                        "EventLoop: ProcessEvents/Run called from "
-                        "a thread that did not start the event loop");
+        if(m_thread_id.load(std::memory_order_acquire) !=
+           std::this_thread::get_id()) {
+            return Status::WrongThread;
+        }
+        return Status::Ok;
+    }
+
+    EventLoop::Status EventLoop::checkActiveLoop() const
+    {
+        // m_asio_work is only set while the loop is started
+        if(!m_started.load(std::memory_order_acquire)) {
+            return Status::Inactive;
         }
+        return Status::Ok;
     }
 
-    void EventLoop::ensureActiveLoop()
+    void EventLoop::throwOnError(Status status)
     {
-        if(!(m_started && m_impl->m_asio_work)) {
-            throw EventLoopInactive(
-                        "EventLoop: ProcessEvents/Run called but "
-                        "event loop has not been started");
+        if(status == Status::WrongThread) {
+            KS_THROW(EventLoopCalledFromWrongThread(
+                         "EventLoop: ProcessEvents/Run called from "
+                         "a thread that did not start the event loop"));
+        }
+        else if(status == Status::Inactive) {
+            KS_THROW(EventLoopInactive(
+                         "EventLoop: ProcessEvents/Run called but "
+                         "event loop has not been started"));
         }
     }
 
-    void EventLoop::unsetActiveThread()
+    void EventLoop::runWorker()
+    {
+        EventLoop * const prev_active_loop = tls_active_loop;
+        tls_active_loop = this;
+
+        // Workers always have a Slot since the loop may
+        // start being watched while they're running
+        HandlerTracker & tracker = m_impl->m_handler_tracker;
+        LoopThreadState state{
+            tracker.AddSlot(),
+            nullptr,
+            &(m_impl->m_pending)
+        };
+
+        LoopThreadState * const prev_state = tls_loop_state;
+        tls_loop_state = &state;
+
+        m_impl->m_asio_service.run(); // blocks!
+
+        tracker.RemoveSlot(state.slot);
+        tls_loop_state = prev_state;
+        tls_active_loop = prev_active_loop;
+    }
+
+    void EventLoop::startWatch()
+    {
+        m_impl->m_handler_tracker.Watch();
+    }
+
+    void EventLoop::stopWatch()
+    {
+        m_impl->m_handler_tracker.Unwatch();
+    }
+
+    void EventLoop::checkHandlers(u64 budget_ns,
+                                  std::vector<std::pair<HandlerType,u64>> &list_stalls)
     {
-        m_thread_id = m_thread_id_null;
+        m_impl->m_handler_tracker.Check(budget_ns,list_stalls);
     }
 
     void EventLoop::startTimer(unique_ptr<StartTimerEvent> ev)
     {
+        if(m_impl->m_timer_wheel) {
+            auto timer = ev->GetTimer().lock();
+            if(!timer) {
+                // The timer object was destroyed
+                return;
+            }
+
+            timer->m_active = true;
+            m_impl->m_timer_wheel->Start(timer,
+                                         ev->GetInterval(),
+                                         ev->GetRepeating());
+            return;
+        }
+
         // lock because we modify m_list_timers
-        std::unique_lock<std::mutex> lock(m_mutex);
+        std::unique_lock<std::mutex> lock(m_timers_mutex);
 
         auto timer = ev->GetTimer().lock();
         if(!timer) {
@@ -534,7 +2178,8 @@ namespace ks
                         ev->GetTimer(),
                         m_impl->m_asio_service,
                         ev->GetInterval(),
-                        ev->GetRepeating())).first;
+                        ev->GetRepeating(),
+                        m_impl->m_stats.get())).first;
 
         timer->m_active = true;
         timerinfo_it->second->asio_timer.async_wait(
@@ -543,8 +2188,13 @@ namespace ks
 
     void EventLoop::stopTimer(unique_ptr<StopTimerEvent> ev)
     {
+        if(m_impl->m_timer_wheel) {
+            m_impl->m_timer_wheel->Stop(ev->GetTimer());
+            return;
+        }
+
         // lock because we modify m_list_timers
-        std::unique_lock<std::mutex> lock(m_mutex);
+        std::unique_lock<std::mutex> lock(m_timers_mutex);
 
         // Cancel and remove the timer for the given id
         auto timerinfo_it = m_list_timers.find(ev->GetTimerId());
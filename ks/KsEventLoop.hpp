@@ -17,6 +17,7 @@
 #ifndef KS_EVENT_LOOP_HPP
 #define KS_EVENT_LOOP_HPP
 
+#include <array>
 #include <atomic>
 #include <thread>
 #include <mutex>
@@ -24,6 +25,8 @@
 #include <vector>
 #include <condition_variable>
 
+#include <ks/KsFunction.hpp>
+#include <ks/KsEvent.hpp>
 #include <ks/KsTask.hpp>
 #include <ks/KsException.hpp>
 
@@ -47,9 +50,9 @@ namespace ks
 
     // ============================================================= //
 
-    class Event;
     class StartTimerEvent;
     class StopTimerEvent;
+    class EventStats;
     struct TimerInfo;
 
     class EventLoop final
@@ -57,7 +60,153 @@ namespace ks
         struct Impl; // hides the implementation
 
     public:
+        // * Serializes events that are posted through it. An
+        //   EventLoop that is Run with several workers may invoke
+        //   events concurrently; events posted through the same
+        //   Strand are never invoked concurrently and are invoked
+        //   in the order they were posted
+        // * Each ks::Object has its own Strand
+        class Strand;
+
+        enum class QueueType : u8
+        {
+            // Events are posted directly to the asio service
+            Asio,
+
+            // Events are pushed onto a lock-free intrusive
+            // queue and invoked in batches; the asio service
+            // is only posted to when the queue needs a wakeup
+            LockFree
+        };
+
+        enum class TimerType : u8
+        {
+            // Each ks::Timer has its own asio timer
+            Asio,
+
+            // ks::Timers are kept in a hierarchical timing
+            // wheel that is driven by a single asio timer. Use
+            // this for large numbers of timers
+            Wheel
+        };
+
+        // * Returned by the Try* methods, which report errors
+        //   instead of throwing them
+        enum class Status : u8
+        {
+            Ok,
+
+            // The event loop hasn't been started or has
+            // been stopped (see EventLoopInactive)
+            Inactive,
+
+            // Called from a thread that didn't start the
+            // event loop (see EventLoopCalledFromWrongThread)
+            WrongThread
+        };
+
+        struct Config
+        {
+            Config();
+
+            QueueType queue_type;
+
+            // * The max number of events invoked for each
+            //   wakeup of a QueueType::LockFree queue before
+            //   yielding to other handlers (ie timers)
+            uint batch_size;
+
+            // * The max number of events that are allocated from
+            //   this loop's EventPool at once (see MakeEvent). Set
+            //   to zero to always use the global heap
+            uint event_pool_capacity;
+
+            TimerType timer_type;
+
+            // * The resolution of a TimerType::Wheel. Timer
+            //   intervals are rounded up to a whole number
+            //   of ticks
+            Milliseconds timer_wheel_tick;
+
+            // * The number of threads that invoke events when the
+            //   loop is Run; Run launches (worker_count-1) threads
+            //   alongside the calling thread. Since this is known
+            //   before the loop starts, every event posted to an
+            //   Object of a multi-worker loop goes through its
+            //   Strand. Values below one are treated as one
+            uint worker_count;
+
+            // * Collect the statistics returned by GetStats.
+            //   Costs two clock reads and a few relaxed atomic
+            //   increments per event
+            bool collect_stats;
+        };
+
+        // * Counts of durations in nanoseconds. Bucket i counts
+        //   durations in [2^i,2^(i+1)), except that the first
+        //   bucket also counts zero and the last bucket counts
+        //   everything longer
+        struct Histogram
+        {
+            Histogram();
+
+            static uint const bucket_count = 32;
+
+            // * Returns the upper bound of the bucket that
+            //   the @p percentile (0 to 1) falls in
+            u64 GetPercentile(double p) const;
+
+            u64 count;
+            u64 total_ns;
+            std::array<u64,bucket_count> buckets;
+        };
+
+        enum class HandlerType : u8
+        {
+            Slot,           // SlotEvents (ie PostCallback and
+                            // Queued signal connections)
+            BlockingSlot,   // Blocking signal connections
+            Timeout,        // ks::Timer timeouts
+            Task            // PostTask
+        };
+
+        // * Returned by the bounded ProcessEvents calls
+        struct ProcessResult
+        {
+            // * Events, tasks and timer timeouts that were run
+            u64 processed;
+
+            // * Events and tasks that have been posted to the
+            //   loop but not run yet, including ones that are
+            //   still ready. Timers that have expired but
+            //   haven't timed out yet aren't included
+            // * Without Config::collect_stats, only events that
+            //   were posted while the loop was being run with
+            //   the bounded ProcessEvents calls are counted
+            u64 pending;
+        };
+
+        struct Stats
+        {
+            Stats();
+
+            // * Events and tasks posted to the loop and
+            //   invoked by it. Timer timeouts aren't
+            //   posted, so they aren't counted here
+            u64 posted;
+            u64 processed;
+            u64 pending;
+
+            // * Time from being posted to being invoked
+            Histogram queue_time;
+
+            // * Time spent invoking handlers, indexed
+            //   by HandlerType
+            std::array<Histogram,4> handler_time;
+        };
+
         EventLoop();
+        EventLoop(Config const &config);
         EventLoop(EventLoop const &other) = delete;
         EventLoop(EventLoop &&other) = delete;
         virtual ~EventLoop();
@@ -66,23 +215,90 @@ namespace ks
         EventLoop & operator = (EventLoop &&) = delete;
 
         Id GetId() const;
+        Config const & GetConfig() const;
         std::thread::id GetThreadId();
+        uint GetWorkerCount() const;
         bool GetStarted();
         bool GetRunning();
         void GetState(std::thread::id& thread_id,
                       bool& started,
                       bool& running);
 
+        // * Returns true if the calling thread is the thread that
+        //   started this event loop or one of its worker threads
+        bool IsActiveThread();
+
+        // * Returns true if the calling thread can invoke events
+        //   for @strand without breaking its ordering, ie it's an
+        //   active thread of a single worker loop, or it's invoking
+        //   an event that was posted through @strand
+        bool IsRunningInStrand(Strand * strand);
+
+        // * Returns a snapshot of this loop's statistics, which
+        //   are all zero unless Config::collect_stats is set
+        // * Each counter is read separately, so a snapshot taken
+        //   while events are being processed may be slightly
+        //   inconsistent (ie processed + pending != posted)
+        Stats GetStats() const;
+
+        // * Returns the EventLoop that is processing events on
+        //   the calling thread (ie from Run or ProcessEvents),
+        //   or nullptr if there isn't one
+        static EventLoop * GetActiveLoop();
+
+        shared_ptr<Strand> CreateStrand();
+
         void Start();
+
+        // * Blocks and invokes events until the event loop is
+        //   stopped. If Config::worker_count is greater than one,
+        //   then (worker_count-1) additional threads are launched
+        //   that invoke events alongside the calling thread
         void Run();
         void Stop();
         void Wait();
         void ProcessEvents();
-        void PostEvent(unique_ptr<Event> event);
+        void PostEvent(unique_ptr<Event> event,
+                       Strand * strand=nullptr);
+
+        // * Same as ProcessEvents, but stops after running
+        //   @max_events events or once @budget has been spent,
+        //   so that it can be called from a loop with a fixed
+        //   frame time. Events that are left over are run by
+        //   the next call
+        // * The budget is checked between events, so a slow
+        //   event can run over it. ProcessEventsFor always runs
+        //   at least one ready event
+        // * A @max_events of std::numeric_limits<u64>::max()
+        //   runs every ready event like ProcessEvents(), and
+        //   still counts them in ProcessResult::processed
+        ProcessResult ProcessEvents(u64 max_events);
+        ProcessResult ProcessEventsFor(Microseconds budget);
+
+        // * Same as Run and ProcessEvents, except that errors are
+        //   returned instead of thrown, and nothing is logged
+        Status TryRun();
+        Status TryProcessEvents();
+
+        // * Same as PostEvent, except that if the event loop
+        //   isn't started @event is discarded and
+        //   Status::Inactive is returned
+        Status TryPostEvent(unique_ptr<Event> event,
+                            Strand * strand=nullptr);
         void PostTask(shared_ptr<Task> task);
-        void PostCallback(std::function<void()> callback);
+        void PostCallback(Function<void()> callback);
         void PostStopEvent();
 
+        // * Creates an event that is allocated from this
+        //   event loop's EventPool
+        template<typename T, typename... Args>
+        unique_ptr<T> MakeEvent(Args&&... args)
+        {
+            return unique_ptr<T>(
+                        new (m_event_pool) T(
+                            std::forward<Args>(args)...));
+        }
+
         static std::thread LaunchInThread(shared_ptr<EventLoop> event_loop);
 
         static void RemoveFromThread(shared_ptr<EventLoop> event_loop,
@@ -94,27 +310,55 @@ namespace ks
         void waitUntilRunning();
         void waitUntilStopped();
 
+        void postEvent(unique_ptr<Event> event,
+                       Strand * strand,
+                       HandlerType type);
         void startTimer(unique_ptr<StartTimerEvent> event);
         void stopTimer(unique_ptr<StopTimerEvent> event);
-        void setActiveThread();
-        void unsetActiveThread();
+        void setState(std::thread::id thread_id,
+                      bool started,
+                      bool running);
+        void runWorker();
+
+        // Used by Watchdog
+        friend class Watchdog;
+        void startWatch();
+        void stopWatch();
+        void checkHandlers(u64 budget_ns,
+                           std::vector<std::pair<HandlerType,u64>> &list_stalls);
 
-        void ensureActiveLoop();
-        void ensureActiveThread();
+        Status processEvents(u64 max_events,
+                             u64 deadline_ns,
+                             ProcessResult &result);
+        Status checkActiveLoop() const;
+        Status checkActiveThread() const;
+        static void throwOnError(Status status);
 
         Id const m_id;
+        Config const m_config;
         std::thread::id const m_thread_id_null; // default id for 'no thread'
-        std::thread::id m_thread_id;
 
-        bool m_started;
-        bool m_running;
+        // Lifecycle state, written by setState with m_mutex
+        // locked. Each field can be read on its own without
+        // locking; GetState reads them together with a seqlock
+        std::atomic<u32> m_state_seq;
+        std::atomic<std::thread::id> m_thread_id;
+        std::atomic<bool> m_started;
+        std::atomic<bool> m_running;
+
+        uint const m_worker_count;
         std::mutex m_mutex;
         std::condition_variable m_cv_started;
         std::condition_variable m_cv_running;
         std::condition_variable m_cv_stopped;
+
+        // Separate from m_mutex so that starting and stopping
+        // timers doesn't contend with posting events
+        std::mutex m_timers_mutex;
         std::map<Id,shared_ptr<TimerInfo>> m_list_timers;
 
         shared_ptr<Impl> m_impl;
+        EventPool * m_event_pool;
 
         static std::mutex s_id_mutex;
         static Id s_id_counter;
@@ -0,0 +1,200 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <new>
+
+#include <ks/KsEventPool.hpp>
+
+namespace ks
+{
+    namespace
+    {
+        u32 headIndex(u64 head)
+        {
+            return static_cast<u32>(head);
+        }
+
+        u64 makeHead(u64 prev_head,u32 index)
+        {
+            // bump the tag on every change to avoid ABA
+            u64 const tag = (prev_head >> 32)+1;
+            return ((tag << 32) | index);
+        }
+    }
+
+    // ============================================================= //
+
+    EventPool::EventPool(std::size_t payload_size,
+                         uint capacity) :
+        m_block_size(sizeof(Header)+((payload_size+15)/16)*16),
+        m_max_chunks((capacity+s_chunk_blocks-1)/s_chunk_blocks),
+        m_head(0),
+        m_refs(1),
+        m_exhausted(m_max_chunks == 0),
+        m_chunk_count(0),
+        m_list_chunks(new std::atomic<char*>[m_max_chunks])
+    {
+        for(uint i=0; i < m_max_chunks; i++) {
+            m_list_chunks[i] = nullptr;
+        }
+    }
+
+    EventPool::~EventPool()
+    {
+        for(uint i=0; i < m_chunk_count; i++) {
+            ::operator delete(m_list_chunks[i].load());
+        }
+    }
+
+    void EventPool::Release()
+    {
+        unref();
+    }
+
+    void* EventPool::Allocate(std::size_t size,EventPool * pool)
+    {
+        Header * header = nullptr;
+
+        if(pool && (sizeof(Header)+size <= pool->m_block_size)) {
+            header = pool->pop();
+
+            if((header == nullptr) &&
+               !pool->m_exhausted.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(pool->m_grow_mutex);
+
+                // Another thread may have grown the pool
+                // while we were waiting on the lock
+                header = pool->pop();
+                if((header == nullptr) && pool->grow()) {
+                    header = pool->pop();
+                }
+            }
+
+            if(header) {
+                pool->m_refs.fetch_add(1,std::memory_order_relaxed);
+                return (header+1);
+            }
+        }
+
+        header = new (::operator new(sizeof(Header)+size)) Header;
+        header->pool = nullptr;
+        return (header+1);
+    }
+
+    void EventPool::Free(void * ptr)
+    {
+        if(ptr == nullptr) {
+            return;
+        }
+
+        Header * header = static_cast<Header*>(ptr)-1;
+        EventPool * pool = header->pool;
+
+        if(pool == nullptr) {
+            ::operator delete(header);
+            return;
+        }
+
+        pool->push(header,header);
+        pool->unref();
+    }
+
+    EventPool::Header * EventPool::get(u32 index) const
+    {
+        char * chunk =
+                m_list_chunks[index/s_chunk_blocks].load(
+                    std::memory_order_acquire);
+
+        return reinterpret_cast<Header*>(
+                    chunk+((index%s_chunk_blocks)*m_block_size));
+    }
+
+    EventPool::Header * EventPool::pop()
+    {
+        u64 head = m_head.load(std::memory_order_acquire);
+
+        while(true) {
+            u32 const index1 = headIndex(head);
+            if(index1 == 0) {
+                return nullptr;
+            }
+
+            // If another thread pops this block first, @next
+            // may be stale; the tag makes the exchange fail
+            Header * header = get(index1-1);
+            u32 const next = header->next.load(std::memory_order_relaxed);
+
+            if(m_head.compare_exchange_weak(
+                       head,
+                       makeHead(head,next),
+                       std::memory_order_acquire,
+                       std::memory_order_acquire)) {
+                return header;
+            }
+        }
+    }
+
+    void EventPool::push(Header * first,Header * last)
+    {
+        u64 head = m_head.load(std::memory_order_relaxed);
+
+        do {
+            last->next.store(headIndex(head),std::memory_order_relaxed);
+        }
+        while(!m_head.compare_exchange_weak(
+                  head,
+                  makeHead(head,first->index+1),
+                  std::memory_order_release,
+                  std::memory_order_relaxed));
+    }
+
+    bool EventPool::grow()
+    {
+        // m_grow_mutex must be locked
+        if(m_chunk_count == m_max_chunks) {
+            return false;
+        }
+
+        u32 const chunk_index = m_chunk_count;
+        char * chunk = static_cast<char*>(
+                    ::operator new(s_chunk_blocks*m_block_size));
+
+        // Chain the new blocks together
+        u32 const first_index = chunk_index*s_chunk_blocks;
+        for(u32 i=0; i < s_chunk_blocks; i++) {
+            Header * header = new (chunk+(i*m_block_size)) Header;
+            header->pool = this;
+            header->index = first_index+i;
+            header->next.store(first_index+i+2,std::memory_order_relaxed);
+        }
+
+        m_list_chunks[chunk_index].store(chunk,std::memory_order_release);
+        m_chunk_count++;
+        if(m_chunk_count == m_max_chunks) {
+            m_exhausted.store(true,std::memory_order_relaxed);
+        }
+
+        push(get(first_index),get(first_index+s_chunk_blocks-1));
+        return true;
+    }
+
+    void EventPool::unref()
+    {
+        if(m_refs.fetch_sub(1,std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_EVENT_POOL_HPP
+#define KS_EVENT_POOL_HPP
+
+#include <atomic>
+#include <mutex>
+
+#include <ks/KsGlobal.hpp>
+
+namespace ks
+{
+    // EventPool
+    // * A pool of fixed size blocks that Events are allocated
+    //   from so that steady state messaging doesn't go through
+    //   the global allocator
+    // * Each block is prefixed with a header that records the
+    //   pool it came from, so an Event returns its memory to
+    //   the right pool when it's deleted (see Event::operator
+    //   delete). Events that don't fit in a block, or that are
+    //   allocated once the pool is full, use the global heap
+    // * Free blocks are kept on a lock-free stack. Blocks are
+    //   referred to by index so that the stack head can pair
+    //   an index with an ABA tag in a single 64-bit word
+    // * The pool is reference counted by its owner and by each
+    //   outstanding block, so Events may outlive their EventLoop
+    class EventPool final
+    {
+    public:
+        EventPool(std::size_t payload_size,
+                  uint capacity);
+
+        EventPool(EventPool const &) = delete;
+        EventPool(EventPool &&) = delete;
+        EventPool & operator = (EventPool const &) = delete;
+        EventPool & operator = (EventPool &&) = delete;
+
+        // * Releases the owner's reference. The pool is
+        //   destroyed once every block has been returned
+        void Release();
+
+        // * Allocates @size bytes from @pool, or from
+        //   the global heap if @pool is null
+        static void* Allocate(std::size_t size,EventPool * pool);
+
+        // * Returns memory from Allocate() to where it came from
+        static void Free(void * ptr);
+
+    private:
+        struct alignas(16) Header
+        {
+            EventPool * pool;
+            u32 index;
+            std::atomic<u32> next; // free list link (index+1)
+        };
+
+        static_assert(sizeof(Header) == 16,
+                      "ks::EventPool: Unexpected header size");
+
+        ~EventPool();
+
+        Header * get(u32 index) const;
+        Header * pop();
+        void push(Header * first,Header * last);
+        bool grow();
+        void unref();
+
+        static uint const s_chunk_blocks = 64;
+
+        std::size_t const m_block_size;
+        uint const m_max_chunks;
+
+        std::atomic<u64> m_head; // [tag:32][index+1:32]
+        std::atomic<u64> m_refs;
+
+        // Set once every chunk has been allocated so that
+        // allocations that miss the free list go straight to
+        // the heap instead of contending on m_grow_mutex
+        std::atomic<bool> m_exhausted;
+
+        std::mutex m_grow_mutex;
+        uint m_chunk_count;
+        unique_ptr<std::atomic<char*>[]> m_list_chunks;
+    };
+}
+
+#endif // KS_EVENT_POOL_HPP
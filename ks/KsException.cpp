@@ -14,7 +14,20 @@
    limitations under the License.
 */
 
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+
 #include <ks/KsException.hpp>
+#include <ks/KsLogRecorder.hpp>
+
+#ifdef KS_EXCEPTION_STACK_TRACE
+    #include <cxxabi.h>
+    #include <dlfcn.h>
+    #include <unwind.h>
+#endif
 
 namespace ks
 {
@@ -27,14 +40,206 @@ namespace ks
         "FATAL: "
     };
 
-    Exception::Exception()
+    struct Exception::Trace
+    {
+        std::vector<void*> list_frames;
+
+        // Built by the first call to what() or GetStackTrace()
+        // and never modified once text_ready is set, so they
+        // can be read without locking after that
+        std::atomic<bool> text_ready;
+        std::string stack_trace;
+        std::string what_with_trace;
+    };
+
+    namespace
+    {
+        // Guards lazily building the text of a stack trace;
+        // it's only taken until the text is ready
+        std::mutex g_build_trace_mutex;
+
+#ifdef KS_EXCEPTION_STACK_TRACE
+        struct UnwindState
+        {
+            void ** list_frames;
+            uint max_frames;
+            uint count;
+            uint skip;
+        };
+
+        _Unwind_Reason_Code onUnwindFrame(_Unwind_Context * context,void * arg)
+        {
+            UnwindState * state = static_cast<UnwindState*>(arg);
+
+            uintptr_t const ip = _Unwind_GetIP(context);
+            if(ip == 0) {
+                return _URC_END_OF_STACK;
+            }
+
+            if(state->skip > 0) {
+                state->skip--;
+                return _URC_NO_REASON;
+            }
+
+            state->list_frames[state->count] = reinterpret_cast<void*>(ip);
+            state->count++;
+
+            return (state->count == state->max_frames) ?
+                        _URC_END_OF_STACK : _URC_NO_REASON;
+        }
+
+        // Only records return addresses; no symbol
+        // lookups or allocations
+        __attribute__((noinline))
+        uint captureFrames(void ** list_frames,uint max_frames)
+        {
+            // Skip this function's own frame
+            UnwindState state{list_frames,max_frames,0,1};
+            _Unwind_Backtrace(&onUnwindFrame,&state);
+            return state.count;
+        }
+
+        std::string symbolizeFrame(uint index,void * frame)
+        {
+            std::string line = "#"+ToString(index)+" ";
+
+            std::ostringstream oss;
+            oss << frame;
+            line.append(oss.str());
+
+            // Look up the address of the call instruction
+            // rather than the return address, which can
+            // belong to the next function
+            void * const call_addr = static_cast<char*>(frame)-1;
+
+            Dl_info info;
+            if(dladdr(call_addr,&info) == 0) {
+                return line;
+            }
+
+            if(info.dli_sname) {
+                int status=-1;
+                char * demangled =
+                        abi::__cxa_demangle(info.dli_sname,
+                                            nullptr,nullptr,&status);
+
+                line.push_back(' ');
+                line.append((status == 0) ? demangled : info.dli_sname);
+                std::free(demangled);
+
+                oss.str("");
+                oss << "+0x" << std::hex
+                    << (static_cast<char*>(frame)-
+                        static_cast<char*>(info.dli_saddr));
+                line.append(oss.str());
+            }
+
+            if(info.dli_fname) {
+                line.append(" (");
+                line.append(info.dli_fname);
+                line.append(")");
+            }
+
+            return line;
+        }
+#else
+        uint captureFrames(void **,uint)
+        {
+            return 0;
+        }
+
+        std::string symbolizeFrame(uint,void *)
+        {
+            return std::string();
+        }
+#endif
+    }
+
+    std::atomic<bool> Exception::s_log_on_create(true);
+
+    Exception::Exception() :
+        m_err_lvl(ErrorLevel::ERROR)
     {}
 
-    Exception::Exception(ErrorLevel err_lvl, std::string msg, bool stack_trace)
+    Exception::Exception(ErrorLevel err_lvl, std::string msg, bool stack_trace) :
+        m_err_lvl(err_lvl),
+        m_msg(m_lkup_err_lvl[static_cast<u8>(err_lvl)]+msg),
+        m_raw_msg(std::move(msg))
+    {
+        if(stack_trace) {
+            // Only the frames that were captured are kept
+            std::array<void*,s_max_frames> list_frames;
+            uint const count = captureFrames(list_frames.data(),s_max_frames);
+            if(count > 0) {
+                m_trace = make_unique<Trace>();
+                m_trace->list_frames.assign(list_frames.begin(),
+                                            list_frames.begin()+count);
+                m_trace->text_ready.store(false,std::memory_order_relaxed);
+            }
+        }
+
+        bool const logged = s_log_on_create.load(std::memory_order_relaxed);
+        if(logged) {
+            LOG.Custom(err_lvl) << m_raw_msg;
+        }
+
+        // A FATAL line already dumps LOG's flight recorder, so the
+        // global recorder is only dumped here if it wasn't that one
+        if(err_lvl == ErrorLevel::FATAL) {
+            if(!logged || (LOG.GetFlightRecorder() !=
+                           Log::SinkFlightRecorder::GetGlobal())) {
+                Log::SinkFlightRecorder::DumpGlobal();
+            }
+        }
+    }
+
+    Exception::Exception(Exception const &other) :
+        std::exception(other),
+        m_err_lvl(other.m_err_lvl),
+        m_msg(other.m_msg),
+        m_raw_msg(other.m_raw_msg)
+    {
+        copyTrace(other);
+    }
+
+    Exception& Exception::operator=(Exception const &other)
     {
-        (void)stack_trace; // TODO
-        LOG.Custom(err_lvl) << msg;
-        m_msg = m_lkup_err_lvl[static_cast<u8>(err_lvl)] + msg;
+        if(this == &other) {
+            return *this;
+        }
+
+        std::exception::operator=(other);
+        m_err_lvl = other.m_err_lvl;
+        m_msg = other.m_msg;
+        m_raw_msg = other.m_raw_msg;
+        copyTrace(other);
+
+        return *this;
+    }
+
+    void Exception::copyTrace(Exception const &other)
+    {
+        if(!other.m_trace) {
+            m_trace.reset();
+            return;
+        }
+
+        Trace const &other_trace = *(other.m_trace);
+        unique_ptr<Trace> trace = make_unique<Trace>();
+        trace->list_frames = other_trace.list_frames;
+
+        // Exceptions are copied when they're thrown, before
+        // what() is called; the copy builds its own text then.
+        // Once @other's text is ready it's never modified, so
+        // copying it doesn't need the lock
+        bool const ready = other_trace.text_ready.load(std::memory_order_acquire);
+        if(ready) {
+            trace->stack_trace = other_trace.stack_trace;
+            trace->what_with_trace = other_trace.what_with_trace;
+        }
+        trace->text_ready.store(ready,std::memory_order_relaxed);
+
+        m_trace = std::move(trace);
     }
 
     Exception::~Exception()
@@ -42,6 +247,89 @@ namespace ks
 
     const char* Exception::what() const noexcept
     {
-        return m_msg.c_str();
+        if(!m_trace) {
+            return m_msg.c_str();
+        }
+
+#ifndef KS_NO_EXCEPTIONS
+        try {
+#endif
+            buildTrace();
+#ifndef KS_NO_EXCEPTIONS
+        }
+        catch(...) {
+            // The trace is left untouched if building
+            // its text throws; fall back to the message
+            return m_msg.c_str();
+        }
+#endif
+
+        return m_trace->what_with_trace.c_str();
+    }
+
+    Exception::ErrorLevel Exception::GetLevel() const
+    {
+        return m_err_lvl;
+    }
+
+    std::string const & Exception::GetMessage() const
+    {
+        return m_raw_msg;
+    }
+
+    std::string const & Exception::GetStackTrace() const
+    {
+        static std::string const no_trace;
+        if(!m_trace) {
+            return no_trace;
+        }
+
+        buildTrace();
+        return m_trace->stack_trace;
+    }
+
+    void Exception::buildTrace() const
+    {
+        Trace &trace = *m_trace;
+        if(trace.text_ready.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(g_build_trace_mutex);
+
+        if(trace.text_ready.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        // Build into locals so that a throw leaves
+        // the trace untouched
+        std::string stack_trace;
+        for(uint i=0; i < trace.list_frames.size(); i++) {
+            stack_trace.append(symbolizeFrame(i,trace.list_frames[i]));
+            stack_trace.push_back('\n');
+        }
+
+        std::string what_with_trace = m_msg;
+        what_with_trace.push_back('\n');
+        what_with_trace.append(stack_trace);
+
+        trace.stack_trace = std::move(stack_trace);
+        trace.what_with_trace = std::move(what_with_trace);
+        trace.text_ready.store(true,std::memory_order_release);
+    }
+
+    void Exception::SetLogOnCreate(bool log_on_create)
+    {
+        s_log_on_create.store(log_on_create,std::memory_order_relaxed);
+    }
+
+    // ============================================================= //
+
+    void AbortOnException(Exception const &ex)
+    {
+        std::fprintf(stderr,"ks: Aborting on exception: %s\n",ex.what());
+        LOG.Flush();
+        Log::SinkFlightRecorder::DumpGlobal();
+        std::abort();
     }
 }
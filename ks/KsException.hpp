@@ -17,7 +17,10 @@
 #ifndef KS_EXCEPTION_HPP
 #define KS_EXCEPTION_HPP
 
+#include <atomic>
 #include <exception>
+#include <memory>
+#include <ks/KsConfig.hpp>
 #include <ks/KsLog.hpp>
 
 namespace ks
@@ -28,15 +31,70 @@ namespace ks
         using ErrorLevel = ks::Log::Logger::Level;
 
         Exception();
+
+        // * If @stack_trace is true, the return addresses of the
+        //   calling stack are captured. This is cheap; the trace
+        //   is only symbolized when what() or GetStackTrace() is
+        //   first called
+        // * Ignored where KS_EXCEPTION_STACK_TRACE isn't set
+        //   (see KsConfig.hpp)
         Exception(ErrorLevel err_lvl,std::string msg,bool stack_trace=false);
+        Exception(Exception const &other);
+        Exception& operator=(Exception const &other);
         virtual ~Exception();
 
+        // * Returns the level and message, followed by the
+        //   stack trace if one was captured
+        // * May be called from several threads at once; the
+        //   stack trace is symbolized by the first call
         virtual const char* what() const noexcept;
 
+        ErrorLevel GetLevel() const;
+        std::string const & GetMessage() const;
+
+        // * Returns the captured stack trace, one frame per
+        //   line, or an empty string if there isn't one
+        std::string const & GetStackTrace() const;
+
+        // * Sets whether Exceptions are logged to ks::LOG when
+        //   they're created (the default). Turning this off keeps
+        //   exceptions that are thrown on hot paths cheap
+        static void SetLogOnCreate(bool log_on_create);
+
     protected:
         static std::vector<std::string> const m_lkup_err_lvl;
+        ErrorLevel m_err_lvl;
+
+        // The level prefix followed by the message
         std::string m_msg;
+
+    private:
+        // The captured frames and their text; only
+        // allocated if a stack trace was captured
+        struct Trace;
+
+        static uint const s_max_frames = 32;
+        static std::atomic<bool> s_log_on_create;
+
+        void copyTrace(Exception const &other);
+        void buildTrace() const;
+
+        // The message without the level prefix
+        std::string m_raw_msg;
+
+        unique_ptr<Trace> m_trace;
     };
+
+    // * Writes @ex to stderr, flushes ks::LOG and aborts. Used
+    //   in place of throwing when ks is built with exceptions
+    //   disabled (see KS_NO_EXCEPTIONS)
+    [[noreturn]] void AbortOnException(Exception const &ex);
 }
 
+#ifdef KS_NO_EXCEPTIONS
+    #define KS_THROW(ex) ks::AbortOnException(ex)
+#else
+    #define KS_THROW(ex) throw ex
+#endif
+
 #endif // KS_EXCEPTION_HPP
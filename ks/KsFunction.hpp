@@ -0,0 +1,337 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_FUNCTION_HPP
+#define KS_FUNCTION_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <ks/KsConfig.hpp>
+#include <ks/KsGlobal.hpp>
+
+namespace ks
+{
+    template<typename Signature,
+             std::size_t InlineSize=KS_FUNCTION_INLINE_SIZE>
+    class Function;
+
+    namespace function_detail
+    {
+        // IsCallable
+        // * true if an F can be called with arguments of types
+        //   Args and its result can be converted to R (or R is
+        //   void, in which case the result is discarded)
+        template<typename F, typename R, typename... Args>
+        struct IsCallable
+        {
+            template<typename G,
+                     typename Ret=decltype(std::declval<G&>()(
+                                               std::declval<Args>()...))>
+            static std::integral_constant<
+                bool,
+                std::is_void<R>::value ||
+                std::is_convertible<Ret,R>::value
+            > test(int);
+
+            template<typename G>
+            static std::false_type test(...);
+
+            static bool const value = decltype(test<F>(0))::value;
+        };
+
+        // Stored
+        // * Member pointers are stored wrapped with std::mem_fn
+        //   so that they're called like std::function calls them
+        template<typename F>
+        struct Stored
+        {
+            using type = F;
+
+            template<typename G>
+            static G&& wrap(G&& fn)
+            {
+                return std::forward<G>(fn);
+            }
+        };
+
+        template<typename M, typename C>
+        struct Stored<M C::*>
+        {
+            using type = decltype(std::mem_fn(std::declval<M C::*>()));
+
+            static type wrap(M C::* fn)
+            {
+                return std::mem_fn(fn);
+            }
+        };
+
+        // IsNull
+        // * true for null function and member pointers and for
+        //   empty std::functions, which are stored as an empty
+        //   Function like std::function does
+        template<typename F>
+        bool IsNull(F const &)
+        {
+            return false;
+        }
+
+        template<typename F>
+        bool IsNull(F * fn)
+        {
+            return (fn == nullptr);
+        }
+
+        template<typename M, typename C>
+        bool IsNull(M C::* fn)
+        {
+            return (fn == nullptr);
+        }
+
+        template<typename Signature>
+        bool IsNull(std::function<Signature> const &fn)
+        {
+            return !fn;
+        }
+
+    } // function_detail
+
+    /// * A move-only replacement for std::function
+    /// * Callables that are no larger than @InlineSize bytes (and
+    ///   can be moved without throwing) are stored inline, so
+    ///   wrapping them does not allocate. Larger callables are
+    ///   stored on the heap
+    /// * Since Function is move-only, it can also wrap callables
+    ///   that can't be copied (ie lambdas that own a unique_ptr)
+    /// * Like std::function, a Function made from a null function
+    ///   or member pointer or an empty std::function is empty
+    template<typename R, typename... Args, std::size_t InlineSize>
+    class Function<R(Args...),InlineSize> final
+    {
+        using Storage =
+            typename std::aligned_storage<
+                InlineSize,
+                alignof(std::max_align_t)
+            >::type;
+
+        // Table of operations for the stored callable type
+        struct Ops
+        {
+            R (*invoke)(Storage &,Args&&...);
+            void (*move)(Storage &,Storage &);
+            void (*destroy)(Storage &);
+        };
+
+        template<typename F>
+        struct StoredInline :
+                std::integral_constant<
+                    bool,
+                    (sizeof(F) <= InlineSize) &&
+                    (alignof(F) <= alignof(Storage)) &&
+                    std::is_nothrow_move_constructible<F>::value
+                > {};
+
+        template<typename F>
+        struct InlineOps
+        {
+            static F & get(Storage &s)
+            {
+                return *reinterpret_cast<F*>(&s);
+            }
+
+            static R invoke(Storage &s,Args&&... args)
+            {
+                return get(s)(std::forward<Args>(args)...);
+            }
+
+            static void move(Storage &dst,Storage &src)
+            {
+                new (&dst) F(std::move(get(src)));
+                get(src).~F();
+            }
+
+            static void destroy(Storage &s)
+            {
+                get(s).~F();
+            }
+
+            static Ops const * table()
+            {
+                static Ops const ops{ &invoke, &move, &destroy };
+                return &ops;
+            }
+        };
+
+        template<typename F>
+        struct HeapOps
+        {
+            static F *& get(Storage &s)
+            {
+                return *reinterpret_cast<F**>(&s);
+            }
+
+            static R invoke(Storage &s,Args&&... args)
+            {
+                return (*get(s))(std::forward<Args>(args)...);
+            }
+
+            static void move(Storage &dst,Storage &src)
+            {
+                new (&dst) F*(get(src));
+                get(src) = nullptr;
+            }
+
+            static void destroy(Storage &s)
+            {
+                delete get(s);
+            }
+
+            static Ops const * table()
+            {
+                static Ops const ops{ &invoke, &move, &destroy };
+                return &ops;
+            }
+        };
+
+        static_assert(InlineSize >= sizeof(void*),
+                      "ks::Function: InlineSize must be large "
+                      "enough to hold a pointer");
+
+    public:
+        Function() :
+            m_ops(nullptr)
+        {
+            // empty
+        }
+
+        Function(std::nullptr_t) :
+            m_ops(nullptr)
+        {
+            // empty
+        }
+
+        template<typename F,
+                 typename FnType=typename std::decay<F>::type,
+                 typename=typename std::enable_if<
+                     !std::is_same<FnType,Function>::value &&
+                     function_detail::IsCallable<
+                         typename function_detail::Stored<FnType>::type,
+                         R,Args...>::value
+                 >::type>
+        Function(F&& fn) :
+            m_ops(nullptr)
+        {
+            if(function_detail::IsNull(fn)) {
+                return;
+            }
+
+            using Stored = function_detail::Stored<FnType>;
+            using StoredType = typename Stored::type;
+
+            init<StoredType>(Stored::wrap(std::forward<F>(fn)),
+                             StoredInline<StoredType>());
+        }
+
+        // * Inline callables are only stored if they can be
+        //   moved without throwing, so moving never throws
+        Function(Function && other) noexcept :
+            m_ops(other.m_ops)
+        {
+            if(m_ops) {
+                m_ops->move(m_storage,other.m_storage);
+                other.m_ops = nullptr;
+            }
+        }
+
+        Function(Function const &) = delete;
+
+        ~Function()
+        {
+            reset();
+        }
+
+        Function & operator = (Function && other) noexcept
+        {
+            if(this != &other) {
+                reset();
+                if(other.m_ops) {
+                    other.m_ops->move(m_storage,other.m_storage);
+                    m_ops = other.m_ops;
+                    other.m_ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        Function & operator = (Function const &) = delete;
+
+        Function & operator = (std::nullptr_t)
+        {
+            reset();
+            return *this;
+        }
+
+        explicit operator bool() const
+        {
+            return (m_ops != nullptr);
+        }
+
+        R operator()(Args... args)
+        {
+            if(!m_ops) {
+#ifdef KS_NO_EXCEPTIONS
+                std::abort();
+#else
+                throw std::bad_function_call();
+#endif
+            }
+            return m_ops->invoke(m_storage,std::forward<Args>(args)...);
+        }
+
+    private:
+        template<typename FnType,typename F>
+        void init(F&& fn,std::true_type)
+        {
+            new (&m_storage) FnType(std::forward<F>(fn));
+            m_ops = InlineOps<FnType>::table();
+        }
+
+        template<typename FnType,typename F>
+        void init(F&& fn,std::false_type)
+        {
+            new (&m_storage) FnType*(new FnType(std::forward<F>(fn)));
+            m_ops = HeapOps<FnType>::table();
+        }
+
+        void reset()
+        {
+            if(m_ops) {
+                m_ops->destroy(m_storage);
+                m_ops = nullptr;
+            }
+        }
+
+        Storage m_storage;
+        Ops const * m_ops;
+    };
+
+} // ks
+
+#endif // KS_FUNCTION_HPP
@@ -14,7 +14,16 @@
    limitations under the License.
 */
 
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
 #include <ks/KsLog.hpp>
+#include <ks/KsLogBinary.hpp>
+#include <ks/KsLogRecorder.hpp>
+#include <ks/KsEventLoop.hpp>
 
 #ifdef KS_ENV_ANDROID
 #include <android/log.h>
@@ -24,6 +33,22 @@ namespace ks
 {
     namespace Log
     {
+        namespace
+        {
+            // Per-thread buffers that Lines are formatted
+            // into, so that steady state logging doesn't
+            // allocate a string per line
+            struct LineBuffers
+            {
+                std::string msg;
+                std::string line;
+                bool msg_in_use{false};
+                bool line_in_use{false};
+            };
+
+            thread_local LineBuffers tls_line_buffers;
+        }
+
         #ifdef KS_ENV_ANDROID
             void SinkToLogCat::log(std::string const &line)
             {
@@ -35,10 +60,62 @@ namespace ks
 
         // ============================================================= //
 
+        namespace
+        {
+            // Appends @value with at least @width digits
+            void appendDigits(std::string &line,u64 value,uint width)
+            {
+                char buff[24];
+                char * end = buff+sizeof(buff);
+                char * begin = end;
+
+                do {
+                    *(--begin) = static_cast<char>('0'+(value%10));
+                    value /= 10;
+                    if(width > 0) {
+                        width--;
+                    }
+                }
+                while((value > 0) || (width > 0));
+
+                line.append(begin,end);
+            }
+
+            // Writes the last @width digits of @value to @dst
+            void putDigits(char * dst,s64 value,uint width)
+            {
+                for(uint i=width; i > 0; i--) {
+                    dst[i-1] = static_cast<char>('0'+(value%10));
+                    value /= 10;
+                }
+            }
+
+            // The text of the last timestamp formatted by
+            // this thread; shared by each FBTimestamp since
+            // they all format the same time
+            struct TimestampCache
+            {
+                s64 ms{-1};
+                s64 secs{-1};
+                std::array<char,24> time_str;
+            };
+
+            thread_local TimestampCache tls_timestamp_cache;
+
+            std::atomic<u64> g_thread_id_counter(1);
+            thread_local u64 tls_thread_id = 0;
+
+            u64 getThreadId()
+            {
+                if(tls_thread_id == 0) {
+                    tls_thread_id = g_thread_id_counter.fetch_add(1);
+                }
+                return tls_thread_id;
+            }
+        }
+
         FBRunTimeMs::FBRunTimeMs() :
-            m_time_str("00:00:00.000"),
-            m_start(std::chrono::system_clock::now()),
-            m_list_num_chars({{'0','1','2','3','4','5','6','7','8','9'}})
+            m_start(std::chrono::steady_clock::now())
         {
             // empty
         }
@@ -50,48 +127,116 @@ namespace ks
 
         std::string FBRunTimeMs::Get()
         {
-            // TODO: should we use steady_clock, not system clock?
-            auto now = std::chrono::system_clock::now();
-            std::chrono::system_clock::duration elapsed = now-m_start;
+            return getFromAppend();
+        }
 
-            std::chrono::hours hours =
-                    std::chrono::duration_cast<std::chrono::hours>(
-                        elapsed);
-            elapsed -= hours;
+        void FBRunTimeMs::Append(std::string &line)
+        {
+            u64 const ms_total =
+                    std::chrono::duration_cast<Milliseconds>(
+                        std::chrono::steady_clock::now()-m_start).count();
+
+            u64 const secs_total = ms_total/1000;
+            u64 const mins_total = secs_total/60;
+
+            appendDigits(line,mins_total/60,2);
+            line.push_back(':');
+            appendDigits(line,mins_total%60,2);
+            line.push_back(':');
+            appendDigits(line,secs_total%60,2);
+            line.push_back('.');
+            appendDigits(line,ms_total%1000,3);
+        }
 
-            std::chrono::minutes mins =
-                    std::chrono::duration_cast<std::chrono::minutes>(
-                        elapsed);
-            elapsed -= mins;
+        FBTimestamp::FBTimestamp()
+        {
+            // empty
+        }
 
-            std::chrono::seconds secs =
-                    std::chrono::duration_cast<std::chrono::seconds>(
-                        elapsed);
-            elapsed -= secs;
+        FBTimestamp::~FBTimestamp()
+        {
+            // empty
+        }
+
+        std::string FBTimestamp::Get()
+        {
+            return getFromAppend();
+        }
+
+        void FBTimestamp::Append(std::string &line)
+        {
+            s64 const ms =
+                    std::chrono::duration_cast<Milliseconds>(
+                        std::chrono::system_clock::now().
+                        time_since_epoch()).count();
+
+            TimestampCache &cache = tls_timestamp_cache;
+            std::array<char,24> &time_str = cache.time_str;
+
+            if(ms != cache.ms) {
+                cache.ms = ms;
+
+                // Floor so that times before the epoch work
+                s64 secs = ms/1000;
+                s64 ms_part = ms%1000;
+                if(ms_part < 0) {
+                    secs -= 1;
+                    ms_part += 1000;
+                }
 
-            std::chrono::milliseconds ms =
-                    std::chrono::duration_cast<std::chrono::milliseconds>(
-                        elapsed);
+                if(secs != cache.secs) {
+                    cache.secs = secs;
+
+                    std::time_t const time = static_cast<std::time_t>(secs);
+                    std::tm tm;
+                    gmtime_r(&time,&tm);
+
+                    // YYYY-MM-DDTHH:MM:SS.mmmZ
+                    putDigits(&time_str[0],tm.tm_year+1900,4);
+                    time_str[4] = '-';
+                    putDigits(&time_str[5],tm.tm_mon+1,2);
+                    time_str[7] = '-';
+                    putDigits(&time_str[8],tm.tm_mday,2);
+                    time_str[10] = 'T';
+                    putDigits(&time_str[11],tm.tm_hour,2);
+                    time_str[13] = ':';
+                    putDigits(&time_str[14],tm.tm_min,2);
+                    time_str[16] = ':';
+                    putDigits(&time_str[17],tm.tm_sec,2);
+                    time_str[19] = '.';
+                    time_str[23] = 'Z';
+                }
 
-            uint_fast8_t const hours_count = hours.count();
-            uint_fast8_t const mins_count = mins.count();
-            uint_fast8_t const secs_count = secs.count();
-            uint_fast16_t const ms_count = ms.count();
+                putDigits(&time_str[20],ms_part,3);
+            }
 
-            m_time_str[0] = m_list_num_chars[hours_count/10];
-            m_time_str[1] = m_list_num_chars[hours_count%10];
+            line.append(time_str.data(),time_str.size());
+        }
 
-            m_time_str[3] = m_list_num_chars[mins_count/10];
-            m_time_str[4] = m_list_num_chars[mins_count%10];
+        std::string FBThreadId::Get()
+        {
+            return getFromAppend();
+        }
 
-            m_time_str[6] = m_list_num_chars[secs_count/10];
-            m_time_str[7] = m_list_num_chars[secs_count%10];
+        void FBThreadId::Append(std::string &line)
+        {
+            appendDigits(line,getThreadId(),0);
+        }
 
-            m_time_str[9] = m_list_num_chars[ms_count/100];
-            m_time_str[10] = m_list_num_chars[(ms_count%100)/10];
-            m_time_str[11] = m_list_num_chars[(ms_count%100)%10];
+        std::string FBLoopId::Get()
+        {
+            return getFromAppend();
+        }
 
-            return m_time_str;
+        void FBLoopId::Append(std::string &line)
+        {
+            EventLoop * event_loop = EventLoop::GetActiveLoop();
+            if(event_loop) {
+                appendDigits(line,event_loop->GetId(),0);
+            }
+            else {
+                line.push_back('-');
+            }
         }
 
         FBCustomStr::FBCustomStr(std::string const &s) : m_s(s)
@@ -109,24 +254,417 @@ namespace ks
             return m_s;
         }
 
+        void FBCustomStr::Append(std::string &line)
+        {
+            line.append(m_s);
+        }
+
+        // ============================================================= //
+
+        // Logger::Async
+        // * bounded multi-producer queue (Vyukov) of lines that
+        //   is drained by a single sink thread
+        // * each cell keeps its string after being drained, and
+        //   producers swap their line into the cell, so in steady
+        //   state the line buffers are recycled between producers
+        //   and the queue rather than allocated
+        struct Logger::Async
+        {
+            struct Cell
+            {
+                std::atomic<u64> seq;
+                Level level;
+                std::string line;
+
+                // Set for binary lines
+                BinarySite const * site;
+            };
+
+            Async(Logger * logger,uint capacity,OverflowPolicy policy) :
+                logger(logger),
+                policy(policy),
+                mask(capacity-1),
+                list_cells(new Cell[capacity]),
+                enqueue_pos(0),
+                dequeue_pos(0),
+                dropped(0),
+                reported(0),
+                sleeping(false),
+                stopping(false),
+                flushed(0)
+            {
+                for(uint i=0; i < capacity; i++) {
+                    list_cells[i].seq.store(i,std::memory_order_relaxed);
+                    list_cells[i].site = nullptr;
+                }
+                thread = std::thread(&Async::run,this);
+            }
+
+            ~Async()
+            {
+                stopping.store(true);
+                wake();
+                thread.join();
+            }
+
+            bool tryPush(std::string &line,
+                         Level level,
+                         BinarySite const * site)
+            {
+                u64 pos = enqueue_pos.load(std::memory_order_relaxed);
+                Cell * cell;
+
+                while(true) {
+                    cell = &(list_cells[pos & mask]);
+                    u64 const seq = cell->seq.load(std::memory_order_acquire);
+                    s64 const diff = static_cast<s64>(seq-pos);
+
+                    if(diff == 0) {
+                        if(enqueue_pos.compare_exchange_weak(
+                                   pos,pos+1,std::memory_order_relaxed)) {
+                            break;
+                        }
+                    }
+                    else if(diff < 0) {
+                        return false; // full
+                    }
+                    else {
+                        pos = enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+
+                // seq_cst, see wake()
+                cell->line.swap(line);
+                cell->level = level;
+                cell->site = site;
+                cell->seq.store(pos+1);
+                return true;
+            }
+
+            Cell * front()
+            {
+                Cell * cell = &(list_cells[dequeue_pos & mask]);
+                u64 const seq = cell->seq.load();
+                return (seq == dequeue_pos+1) ? cell : nullptr;
+            }
+
+            void pop(Cell * cell)
+            {
+                cell->seq.store(dequeue_pos+mask+1,std::memory_order_release);
+                dequeue_pos++;
+            }
+
+            void wake()
+            {
+                // The cell store, this load and the store and load
+                // in run() are all seq_cst, so either the sink thread
+                // sees the new line or we see that it's sleeping
+                if(sleeping.load()) {
+                    std::lock_guard<std::mutex> lock(wake_mutex);
+                    wake_cv.notify_one();
+                }
+            }
+
+            uint drain()
+            {
+                uint count=0;
+
+                std::lock_guard<std::mutex> lock(logger->m_sink_mutex);
+                auto const &list_sinks = logger->m_list_sinks;
+
+                // Only locked once the batch has a binary line
+                std::unique_lock<std::mutex> binary_lock(
+                            logger->m_binary_mutex,std::defer_lock);
+
+                // Cap the batch so that a steady stream of
+                // lines doesn't hold off flushing the sinks
+                while(count <= mask) {
+                    Cell * cell = front();
+                    if(cell == nullptr) {
+                        break;
+                    }
+                    if(cell->site) {
+                        if(!binary_lock.owns_lock()) {
+                            binary_lock.lock();
+                        }
+                        logger->writeBinary(*(cell->site),cell->line);
+                    }
+                    else {
+                        for(auto &sink : list_sinks) {
+                            sink->log(cell->line,cell->level);
+                        }
+                    }
+                    pop(cell);
+                    count++;
+                }
+
+                if(policy == OverflowPolicy::CountDrops) {
+                    u64 const total = dropped.load(std::memory_order_relaxed);
+                    if(total != reported) {
+                        std::string const notice =
+                                "KS: Log: dropped "+
+                                ToString(total-reported)+" lines";
+
+                        for(auto &sink : list_sinks) {
+                            sink->log(notice,Level::WARN);
+                        }
+                        reported = total;
+                        count++;
+                    }
+                }
+
+                if(count > 0) {
+                    for(auto &sink : list_sinks) {
+                        sink->endBatch();
+                    }
+                }
+
+                return count;
+            }
+
+            void run()
+            {
+                while(true) {
+                    if(drain() > 0) {
+                        std::lock_guard<std::mutex> lock(flush_mutex);
+                        flushed = dequeue_pos;
+                        flush_cv.notify_all();
+                        continue;
+                    }
+
+                    if(stopping.load()) {
+                        break;
+                    }
+
+                    std::unique_lock<std::mutex> lock(wake_mutex);
+                    sleeping.store(true);
+
+                    if(!front() && !stopping.load()) {
+                        // The timeout covers a producer that
+                        // hasn't published the cell it claimed
+                        wake_cv.wait_for(lock,Milliseconds(100));
+                    }
+                    sleeping.store(false);
+                }
+            }
+
+            void flush()
+            {
+                u64 const target = enqueue_pos.load();
+                std::unique_lock<std::mutex> lock(flush_mutex);
+                while(flushed < target) {
+                    lock.unlock();
+                    wake();
+                    lock.lock();
+                    flush_cv.wait_for(lock,Milliseconds(100));
+                }
+            }
+
+            Logger * const logger;
+            OverflowPolicy const policy;
+            u64 const mask;
+            unique_ptr<Cell[]> list_cells;
+
+            std::atomic<u64> enqueue_pos;
+            u64 dequeue_pos; // sink thread only
+
+            std::atomic<u64> dropped;
+            u64 reported; // sink thread only
+
+            std::atomic<bool> sleeping;
+            std::atomic<bool> stopping;
+            std::mutex wake_mutex;
+            std::condition_variable wake_cv;
+
+            std::mutex flush_mutex;
+            std::condition_variable flush_cv;
+            u64 flushed;
+
+            std::thread thread;
+        };
+
+        void Logger::pushAsync(Async * async,
+                               std::string &line,
+                               Level level,
+                               BinarySite const * site)
+        {
+            while(!async->tryPush(line,level,site)) {
+                if(async->policy != OverflowPolicy::Block) {
+                    async->dropped.fetch_add(1,std::memory_order_relaxed);
+                    line.clear();
+                    return;
+                }
+                async->wake();
+                std::this_thread::yield();
+            }
+            line.clear();
+            async->wake();
+        }
+
+        // ============================================================= //
+
+        Logger::Line::Line(Logger * logger,
+                           Level level,
+                           bool line_valid,
+                           u64 suppressed) :
+            m_logger(logger),
+            m_level(level),
+            m_line_valid(line_valid),
+            m_suppressed(suppressed),
+            m_msg(&m_own_msg)
+        {
+            if(m_line_valid && !tls_line_buffers.msg_in_use) {
+                tls_line_buffers.msg_in_use = true;
+                tls_line_buffers.msg.clear();
+                m_msg = &(tls_line_buffers.msg);
+            }
+        }
+
+        Logger::Line::Line(Line && other) :
+            m_logger(other.m_logger),
+            m_level(other.m_level),
+            m_line_valid(other.m_line_valid),
+            m_suppressed(other.m_suppressed),
+            m_msg(&m_own_msg),
+            m_own_msg(std::move(other.m_own_msg))
+        {
+            if(other.m_msg != &(other.m_own_msg)) {
+                m_msg = other.m_msg;
+            }
+            other.m_line_valid = false;
+            other.m_msg = &(other.m_own_msg);
+        }
+
+        Logger::Line::~Line()
+        {
+            if(m_line_valid) {
+                if(m_suppressed > 0) {
+                    m_msg->append(" (suppressed ");
+                    appendUInt(m_suppressed,false);
+                    m_msg->append(" similar lines)");
+                }
+                m_logger->commit(m_level,*m_msg);
+            }
+            if(m_msg == &(tls_line_buffers.msg)) {
+                tls_line_buffers.msg_in_use = false;
+            }
+        }
+
+        Logger::Line & Logger::Line::operator << (char msg)
+        {
+            if(m_line_valid) {
+                m_msg->push_back(msg);
+            }
+            return *this;
+        }
+
+        Logger::Line & Logger::Line::operator << (bool msg)
+        {
+            if(m_line_valid) {
+                m_msg->push_back(msg ? '1' : '0');
+            }
+            return *this;
+        }
+
+        Logger::Line & Logger::Line::operator << (int msg)
+        {
+            return (*this << static_cast<long long>(msg));
+        }
+
+        Logger::Line & Logger::Line::operator << (long msg)
+        {
+            return (*this << static_cast<long long>(msg));
+        }
+
+        Logger::Line & Logger::Line::operator << (long long msg)
+        {
+            if(m_line_valid) {
+                // Negate as unsigned so that LLONG_MIN works
+                unsigned long long const value =
+                        static_cast<unsigned long long>(msg);
+
+                appendUInt((msg < 0) ? (0ull-value) : value,(msg < 0));
+            }
+            return *this;
+        }
+
+        Logger::Line & Logger::Line::operator << (unsigned int msg)
+        {
+            return (*this << static_cast<unsigned long long>(msg));
+        }
+
+        Logger::Line & Logger::Line::operator << (unsigned long msg)
+        {
+            return (*this << static_cast<unsigned long long>(msg));
+        }
+
+        Logger::Line & Logger::Line::operator << (unsigned long long msg)
+        {
+            if(m_line_valid) {
+                appendUInt(msg,false);
+            }
+            return *this;
+        }
+
+        Logger::Line & Logger::Line::operator << (float msg)
+        {
+            return (*this << static_cast<double>(msg));
+        }
+
+        Logger::Line & Logger::Line::operator << (double msg)
+        {
+            if(m_line_valid) {
+                // %g matches std::ostream's default
+                // floatfield with a precision of 6
+                char buff[32];
+                int const count = std::snprintf(buff,sizeof(buff),"%g",msg);
+                if(count > 0) {
+                    m_msg->append(buff,count);
+                }
+            }
+            return *this;
+        }
+
+        void Logger::Line::appendUInt(unsigned long long msg,bool negative)
+        {
+            char buff[24];
+            char * end = buff+sizeof(buff);
+            char * begin = end;
+
+            do {
+                *(--begin) = static_cast<char>('0'+(msg%10));
+                msg /= 10;
+            }
+            while(msg > 0);
+
+            if(negative) {
+                *(--begin) = '-';
+            }
+
+            m_msg->append(begin,end);
+        }
+
         // ============================================================= //
 
-        Logger::Logger()
+        Logger::Logger() :
+            m_shared_paused(0),
+            m_filter(0x3F), // default filter is all on
+            m_enabled(0x3F)
         {
             m_mutex = make_unique<MutexSTL>();
 
-            // default filter is all on
-            m_filter.set(static_cast<size_t>(Level::TRACE));
-            m_filter.set(static_cast<size_t>(Level::DEBUG));
-            m_filter.set(static_cast<size_t>(Level::INFO));
-            m_filter.set(static_cast<size_t>(Level::WARN));
-            m_filter.set(static_cast<size_t>(Level::ERROR));
-            m_filter.set(static_cast<size_t>(Level::FATAL));
+            for(auto &stripe : m_list_shared_stripes) {
+                stripe.count.store(0,std::memory_order_relaxed);
+            }
+
         }
 
         Logger::Logger(bool thread_safe,
                        shared_ptr<Sink> const &sink,
-                       std::array<std::vector<FormatBlock*>,6> && list_fbs)
+                       std::array<std::vector<FormatBlock*>,6> && list_fbs) :
+            m_shared_paused(0),
+            m_filter(0x3F), // default filter is all on
+            m_enabled(0x3F)
         {
             if(thread_safe) {
                 m_mutex = make_unique<MutexSTL>();
@@ -135,6 +673,10 @@ namespace ks
                 m_mutex = make_unique<MutexDummy>();
             }
 
+            for(auto &stripe : m_list_shared_stripes) {
+                stripe.count.store(0,std::memory_order_relaxed);
+            }
+
             // save sink
             m_list_sinks.push_back(sink);
 
@@ -146,13 +688,208 @@ namespace ks
                 }
             }
 
-            // default filter is all on
-            m_filter.set(static_cast<size_t>(Level::TRACE));
-            m_filter.set(static_cast<size_t>(Level::DEBUG));
-            m_filter.set(static_cast<size_t>(Level::INFO));
-            m_filter.set(static_cast<size_t>(Level::WARN));
-            m_filter.set(static_cast<size_t>(Level::ERROR));
-            m_filter.set(static_cast<size_t>(Level::FATAL));
+        }
+
+        Logger::~Logger()
+        {
+            StopAsync();
+        }
+
+        void Logger::commit(Level level,std::string const &msg)
+        {
+            // A Sink that logs would reenter with the
+            // thread's line buffer still in use
+            std::string nested_line;
+            std::string * line = &nested_line;
+            if(!tls_line_buffers.line_in_use) {
+                tls_line_buffers.line_in_use = true;
+                line = &(tls_line_buffers.line);
+            }
+
+            shared_ptr<SinkFlightRecorder> dump_recorder;
+            bool formatted = false;
+            bool committed = false;
+
+            // Lines are formatted, recorded and queued (if async)
+            // by this thread without locking m_mutex
+            if(enterShared()) {
+                formatLine(level,msg,*line);
+                formatted = true;
+
+                if(m_recorder) {
+                    m_recorder->log(*line,level);
+                    if(level == Level::FATAL) {
+                        dump_recorder = m_recorder;
+                    }
+                }
+
+                // The line may only be enabled for the recorder
+                if(!sinksEnabled(level)) {
+                    committed = true;
+                }
+                else if(m_async) {
+                    pushAsync(m_async.get(),*line,level);
+                    committed = true;
+                }
+                leaveShared();
+            }
+
+            if(!committed) {
+                m_mutex->lock();
+
+                if(!formatted) {
+                    formatLine(level,msg,*line);
+                    if(m_recorder) {
+                        m_recorder->log(*line,level);
+                        if(level == Level::FATAL) {
+                            dump_recorder = m_recorder;
+                        }
+                    }
+                }
+
+                if(sinksEnabled(level)) {
+                    if(m_async) {
+                        pushAsync(m_async.get(),*line,level);
+                    }
+                    else {
+                        for(auto &sink : m_list_sinks) {
+                            sink->log(*line,level);
+                            sink->endBatch();
+                        }
+                    }
+                }
+
+                m_mutex->unlock();
+            }
+
+            if(dump_recorder) {
+                dump_recorder->Dump();
+            }
+
+            if(line == &(tls_line_buffers.line)) {
+                tls_line_buffers.line_in_use = false;
+            }
+        }
+
+        void Logger::formatLine(Level level,
+                                std::string const &msg,
+                                std::string &line)
+        {
+            line.clear();
+            for(auto &fb : m_list_fb[static_cast<size_t>(level)]) {
+                fb->Append(line);
+            }
+            line.append(msg);
+        }
+
+        std::atomic<uint> & Logger::sharedStripe()
+        {
+            return m_list_shared_stripes[
+                    getThreadId()%s_shared_stripes].count;
+        }
+
+        bool Logger::enterShared()
+        {
+            // seq_cst so that either pauseShared sees this
+            // line's count or the line sees the pause
+            std::atomic<uint> &count = sharedStripe();
+            count.fetch_add(1);
+            if(m_shared_paused.load() == 0) {
+                return true;
+            }
+            count.fetch_sub(1);
+            return false;
+        }
+
+        void Logger::leaveShared()
+        {
+            sharedStripe().fetch_sub(1);
+        }
+
+        void Logger::pauseShared()
+        {
+            // m_mutex must be locked. Paused is a count
+            // in case a Sink reenters the Logger
+            m_shared_paused.fetch_add(1);
+            for(auto &stripe : m_list_shared_stripes) {
+                while(stripe.count.load() != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void Logger::resumeShared()
+        {
+            m_shared_paused.fetch_sub(1);
+        }
+
+        bool Logger::StartAsync(uint capacity,OverflowPolicy policy)
+        {
+            m_mutex->lock();
+
+            if(m_async) {
+                m_mutex->unlock();
+                return false;
+            }
+
+            uint pow2_capacity=2;
+            while(pow2_capacity < capacity) {
+                pow2_capacity *= 2;
+            }
+
+            pauseShared();
+            m_async = make_unique<Async>(this,pow2_capacity,policy);
+            resumeShared();
+
+            m_mutex->unlock();
+            return true;
+        }
+
+        void Logger::StopAsync()
+        {
+            m_mutex->lock();
+
+            // Destroying Async drains the queue and joins
+            // the sink thread
+            pauseShared();
+            m_async.reset();
+            resumeShared();
+
+            m_mutex->unlock();
+        }
+
+        void Logger::Flush()
+        {
+            m_mutex->lock();
+
+            if(m_async) {
+                m_async->flush();
+            }
+
+            m_sink_mutex.lock();
+            for(auto &sink : m_list_sinks) {
+                sink->flush();
+            }
+            m_sink_mutex.unlock();
+
+            m_binary_mutex.lock();
+            for(auto &info : m_list_binary_sinks) {
+                info.sink->flush();
+            }
+            m_binary_mutex.unlock();
+
+            m_mutex->unlock();
+        }
+
+        u64 Logger::GetDroppedCount() const
+        {
+            m_mutex->lock();
+
+            u64 const dropped =
+                    m_async ? m_async->dropped.load() : 0;
+
+            m_mutex->unlock();
+            return dropped;
         }
 
         bool Logger::AddSink(shared_ptr<Sink> const &new_sink)
@@ -169,12 +906,122 @@ namespace ks
                 }
             }
 
+            m_sink_mutex.lock();
             m_list_sinks.push_back(new_sink);
+            m_sink_mutex.unlock();
 
             m_mutex->unlock();
             return true;
         }
 
+        void Logger::commitBinary(BinarySite const &site,std::string &line)
+        {
+            using namespace binary_detail;
+
+            s64 const time_ns =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().
+                        time_since_epoch()).count();
+
+            u32 const thread_id = static_cast<u32>(getThreadId());
+            u32 const args_size =
+                    static_cast<u32>(line.size()-s_line_header_size);
+
+            char * header = &(line[0]);
+            header[0] = static_cast<char>(Record::Line);
+            std::memcpy(header+1,&(site.id),4);
+            std::memcpy(header+5,&time_ns,8);
+            std::memcpy(header+13,&thread_id,4);
+            std::memcpy(header+17,&args_size,4);
+
+            // Async lines are queued without locking, like
+            // text lines (see commit)
+            if(enterShared()) {
+                if(m_async) {
+                    pushAsync(m_async.get(),line,site.level,&site);
+                    leaveShared();
+                    return;
+                }
+                leaveShared();
+            }
+            else {
+                m_mutex->lock();
+                if(m_async) {
+                    pushAsync(m_async.get(),line,site.level,&site);
+                    m_mutex->unlock();
+                    return;
+                }
+                m_mutex->unlock();
+            }
+
+            std::lock_guard<std::mutex> lock(m_binary_mutex);
+            writeBinary(site,line);
+        }
+
+        void Logger::writeBinary(BinarySite const &site,
+                                 std::string const &line)
+        {
+            // m_binary_mutex must be locked
+            for(auto &info : m_list_binary_sinks) {
+                if(info.list_sites_written.size() <= site.id) {
+                    info.list_sites_written.resize(site.id+1,false);
+                }
+
+                if(!info.list_sites_written[site.id]) {
+                    info.sink->write(site.record.data(),site.record.size());
+                    info.list_sites_written[site.id] = true;
+                }
+
+                info.sink->write(line.data(),line.size());
+            }
+        }
+
+        bool Logger::AddBinarySink(shared_ptr<BinarySink> const &new_sink)
+        {
+            using namespace binary_detail;
+
+            m_mutex->lock();
+
+            for(auto const &info : m_list_binary_sinks) {
+                if(info.sink == new_sink) {
+                    m_mutex->unlock();
+                    return false;
+                }
+            }
+
+            std::string header("KSLB");
+            put(header,s_version);
+            put(header,s_byte_order);
+            new_sink->write(header.data(),header.size());
+
+            m_binary_mutex.lock();
+            m_list_binary_sinks.push_back(BinarySinkInfo{new_sink,{}});
+            m_binary_mutex.unlock();
+
+            m_mutex->unlock();
+            return true;
+        }
+
+        bool Logger::RemoveBinarySink(shared_ptr<BinarySink> const &sink)
+        {
+            m_mutex->lock();
+
+            for(auto it = m_list_binary_sinks.begin();
+                it != m_list_binary_sinks.end(); ++it)
+            {
+                if(it->sink == sink) {
+                    m_binary_mutex.lock();
+                    m_list_binary_sinks.erase(it);
+                    m_binary_mutex.unlock();
+                    m_mutex->unlock();
+                    return true;
+                }
+            }
+
+            m_mutex->unlock();
+            return false;
+        }
+
         bool Logger::RemoveSink(shared_ptr<Sink> const &sink)
         {
             m_mutex->lock();
@@ -184,7 +1031,9 @@ namespace ks
                 ++sink_it)
             {
                 if((*sink_it) == sink) {
+                    m_sink_mutex.lock();
                     m_list_sinks.erase(sink_it);
+                    m_sink_mutex.unlock();
                     m_mutex->unlock();
                     return true;
                 }
@@ -196,110 +1045,98 @@ namespace ks
         void Logger::SetLevel(Level level)
         {
             m_mutex->lock();
-            m_filter.set(static_cast<size_t>(level));
+            m_filter.fetch_or(1 << static_cast<u8>(level),
+                              std::memory_order_relaxed);
+            updateEnabled();
             m_mutex->unlock();
         }
 
         void Logger::UnsetLevel(Level level)
         {
             m_mutex->lock();
-            m_filter.reset(static_cast<size_t>(level));
+            m_filter.fetch_and(~(1 << static_cast<u8>(level)),
+                               std::memory_order_relaxed);
+            updateEnabled();
             m_mutex->unlock();
         }
 
+        void Logger::SetFlightRecorder(shared_ptr<SinkFlightRecorder> recorder)
+        {
+            m_mutex->lock();
+            pauseShared();
+            m_recorder = std::move(recorder);
+            updateEnabled();
+            resumeShared();
+            m_mutex->unlock();
+        }
+
+        shared_ptr<SinkFlightRecorder> Logger::GetFlightRecorder() const
+        {
+            m_mutex->lock();
+            shared_ptr<SinkFlightRecorder> recorder = m_recorder;
+            m_mutex->unlock();
+            return recorder;
+        }
+
+        void Logger::updateEnabled()
+        {
+            // m_mutex must be locked
+            u8 const enabled =
+                    m_recorder ? 0x3F : m_filter.load(std::memory_order_relaxed);
+
+            m_enabled.store(enabled,std::memory_order_relaxed);
+        }
+
         void Logger::AddFormatBlock(unique_ptr<FormatBlock> fb,
                                     Level level)
         {
             m_mutex->lock();
+            pauseShared();
             m_list_fb[static_cast<size_t>(level)].push_back(
                         std::move(fb));
+            resumeShared();
             m_mutex->unlock();
         }
 
         // logging methods
         Logger::Line Logger::Custom(Level level)
         {
-            m_mutex->lock();
-
-            size_t const level_int = static_cast<size_t>(level);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level_int]),
-                        m_mutex.get(),
-                        m_filter[level_int]);
+            return Line(this,level,IsEnabled(level));
         }
 
+        Logger::Line Logger::Custom(Level level,u64 suppressed)
+        {
+            return Line(this,level,IsEnabled(level),suppressed);
+        }
 
         Logger::Line Logger::Trace()
         {
-            m_mutex->lock();
-
-            size_t const level = static_cast<size_t>(Level::TRACE);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level]),
-                        m_mutex.get(),
-                        m_filter[level]);
+            return Custom(Level::TRACE);
         }
 
         Logger::Line Logger::Debug()
         {
-            m_mutex->lock();
-
-            size_t const level = static_cast<size_t>(Level::DEBUG);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level]),
-                        m_mutex.get(),
-                        m_filter[level]);
+            return Custom(Level::DEBUG);
         }
 
         Logger::Line Logger::Info()
         {
-            m_mutex->lock();
-
-            size_t const level = static_cast<size_t>(Level::INFO);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level]),
-                        m_mutex.get(),
-                        m_filter[level]);
+            return Custom(Level::INFO);
         }
 
         Logger::Line Logger::Warn()
         {
-            m_mutex->lock();
-
-            size_t const level = static_cast<size_t>(Level::WARN);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level]),
-                        m_mutex.get(),
-                        m_filter[level]);
+            return Custom(Level::WARN);
         }
 
         Logger::Line Logger::Error()
         {
-            m_mutex->lock();
-
-            size_t const level = static_cast<size_t>(Level::ERROR);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level]),
-                        m_mutex.get(),
-                        m_filter[level]);
+            return Custom(Level::ERROR);
         }
 
         Logger::Line Logger::Fatal()
         {
-            m_mutex->lock();
-
-            size_t const level = static_cast<size_t>(Level::FATAL);
-
-            return Line(&m_list_sinks,
-                        &(m_list_fb[level]),
-                        m_mutex.get(),
-                        m_filter[level]);
+            return Custom(Level::FATAL);
         }
 
         // ============================================================= //
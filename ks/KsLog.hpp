@@ -22,7 +22,8 @@
 #include <array>
 #include <ctime>
 #include <mutex>
-#include <bitset>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 
 #include <ks/KsConfig.hpp>
@@ -34,14 +35,41 @@ namespace ks
     {
         // ============================================================= //
 
+        enum class Level : uint8_t
+        {
+            TRACE   = 0,
+            DEBUG   = 1,
+            INFO    = 2,
+            WARN    = 3,
+            ERROR   = 4,
+            FATAL   = 5
+        };
+
+        // ============================================================= //
+
         // Sink
         // * abstract class that represents logging output
-        // * concrete classes must implement the log() method
+        // * concrete classes must implement the log() method.
+        //   The Logger calls the overload that takes the line's
+        //   level, which by default ignores it
+        // * endBatch() is called after each line in synchronous
+        //   mode and after each batch of lines in async mode
+        // * flush() is called by Logger::Flush() and should write
+        //   out anything the sink has buffered
         class Sink
         {
         public:
             virtual ~Sink() = default;
             virtual void log(std::string const &line)=0;
+
+            virtual void log(std::string const &line,Level level)
+            {
+                (void)level;
+                log(line);
+            }
+
+            virtual void endBatch() {}
+            virtual void flush() {}
         };
 
         // SinkToStdOut
@@ -49,10 +77,24 @@ namespace ks
         class SinkToStdOut : public ks::Log::Sink
         {
         public:
+            using Sink::log;
+
             void log(std::string const &line)
             {
                 m_mutex.lock();
-                std::cout << line << std::endl;
+                std::cout << line << '\n';
+                m_mutex.unlock();
+            }
+
+            void endBatch()
+            {
+                flush();
+            }
+
+            void flush()
+            {
+                m_mutex.lock();
+                std::cout.flush();
                 m_mutex.unlock();
             }
 
@@ -66,6 +108,8 @@ namespace ks
         class SinkToLogCat : public ks::Log::Sink
         {
         public:           
+            using Sink::log;
+
             void log(std::string const &line);
 
         private:
@@ -78,16 +122,40 @@ namespace ks
         // FormatBlock
         // * abstract class that represents a specific token
         //   of formatting that is prefixed to logging output
+        // * concrete classes must implement Get(). Append() is
+        //   what the Logger calls; by default it appends Get(),
+        //   and blocks can override it to write into the line
+        //   being built without allocating
+        // * lines are formatted by the threads that log them
+        //   without locking the Logger, so Append() may be
+        //   called by several threads at once
         class FormatBlock
         {
         public:
             virtual ~FormatBlock() = default;
+
             virtual std::string Get() = 0;
+
+            virtual void Append(std::string &line)
+            {
+                line.append(Get());
+            }
+
+        protected:
+            // * implements Get() for blocks that override Append()
+            std::string getFromAppend()
+            {
+                std::string s;
+                Append(s);
+                return s;
+            }
         };
 
         // FBRunTimeMs
         // * format block that provides elapsed time since
         //   its creation in the format (00:00:00.000)
+        // * uses the monotonic clock, so the time is not
+        //   affected by changes to the wall clock
         class FBRunTimeMs : public FormatBlock
         {
         public:
@@ -95,11 +163,47 @@ namespace ks
             ~FBRunTimeMs();
 
             std::string Get();
+            void Append(std::string &line);
 
         private:
-            std::string m_time_str;
-            std::chrono::system_clock::time_point const m_start;
-            std::array<char,10> const m_list_num_chars;
+            std::chrono::steady_clock::time_point const m_start;
+        };
+
+        // FBTimestamp
+        // * format block that provides the wall clock time
+        //   in UTC as ISO 8601 (2016-01-31T23:59:59.999Z)
+        // * the text is cached per thread and only recomputed
+        //   when the millisecond changes
+        class FBTimestamp : public FormatBlock
+        {
+        public:
+            FBTimestamp();
+            ~FBTimestamp();
+
+            std::string Get();
+            void Append(std::string &line);
+        };
+
+        // FBThreadId
+        // * format block that provides a small integer that
+        //   identifies the calling thread. Ids are assigned
+        //   in the order that threads first log with one
+        class FBThreadId : public FormatBlock
+        {
+        public:
+            std::string Get();
+            void Append(std::string &line);
+        };
+
+        // FBLoopId
+        // * format block that provides the id of the EventLoop
+        //   that is processing events on the calling thread,
+        //   or '-' if there isn't one
+        class FBLoopId : public FormatBlock
+        {
+        public:
+            std::string Get();
+            void Append(std::string &line);
         };
 
         // FBCustomStr
@@ -111,6 +215,7 @@ namespace ks
             ~FBCustomStr();
 
             std::string Get();
+            void Append(std::string &line);
 
         private:
             std::string const m_s;
@@ -118,11 +223,111 @@ namespace ks
 
         // ============================================================= //
 
+        // Returned by RateLimiter/Sampler::Allow
+        // when a line should be suppressed
+        u64 const s_suppress_line = ~u64(0);
+
+        // RateLimiter
+        // * per call site token bucket for KS_LOG_RATE_LIMITED
+        // * allows bursts of up to @burst lines, refilled at
+        //   @lines_per_sec. Implemented as a GCRA so the bucket
+        //   is a single atomic timestamp
+        class RateLimiter
+        {
+        public:
+            RateLimiter(uint lines_per_sec,uint burst) :
+                m_interval_ns(1000000000/std::max(lines_per_sec,1u)),
+                m_burst_ns(m_interval_ns*std::max(burst,1u)),
+                m_tat(0),
+                m_suppressed(0)
+            {
+                // empty
+            }
+
+            // * Returns s_suppress_line if the line should
+            //   be suppressed, otherwise the number of lines
+            //   suppressed since the last allowed line
+            u64 Allow()
+            {
+                s64 const now =
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().
+                            time_since_epoch()).count();
+
+                s64 tat = m_tat.load(std::memory_order_relaxed);
+                while(true) {
+                    s64 const next = std::max(tat,now)+m_interval_ns;
+                    if(next-now > m_burst_ns) {
+                        m_suppressed.fetch_add(1,std::memory_order_relaxed);
+                        return s_suppress_line;
+                    }
+                    if(m_tat.compare_exchange_weak(
+                               tat,next,std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+
+                return m_suppressed.exchange(0,std::memory_order_relaxed);
+            }
+
+        private:
+            s64 const m_interval_ns;
+            s64 const m_burst_ns;
+            std::atomic<s64> m_tat; // theoretical arrival time
+            std::atomic<u64> m_suppressed;
+        };
+
+        // Sampler
+        // * per call site state for KS_LOG_EVERY_N, which
+        //   logs the first line and then every @n'th line
+        class Sampler
+        {
+        public:
+            Sampler(uint n) :
+                m_n(std::max(n,1u)),
+                m_count(0)
+            {
+                // empty
+            }
+
+            // * Returns s_suppress_line if the line should
+            //   be suppressed, otherwise the number of lines
+            //   suppressed since the last allowed line
+            u64 Allow()
+            {
+                u64 const count = m_count.fetch_add(1,std::memory_order_relaxed);
+                if(count % m_n != 0) {
+                    return s_suppress_line;
+                }
+                return (count == 0) ? 0 : (m_n-1);
+            }
+
+        private:
+            u64 const m_n;
+            std::atomic<u64> m_count;
+        };
+
+        // ============================================================= //
+
+        struct BinarySite;
+        class BinarySink;
+        class SinkFlightRecorder;
+
         // Logger
         // * simple logging class with optional thread safety
+        // * by default lines are written to each Sink by the
+        //   thread that logs them. In async mode lines are
+        //   instead pushed onto a bounded lock-free queue and
+        //   written to the sinks in batches by a dedicated
+        //   thread (see StartAsync)
         class Logger
         {
+        public:
+            using Level = Log::Level;
+
         private:
+            struct Async;
+
             // Mutex
             // * abstract implementation of a mutex that
             //   only exposes a lock() and unlock() method
@@ -160,42 +365,29 @@ namespace ks
 
             // Line
             // * class that wraps logging a line with RAII
-            // * line is commited to log on destruction
+            // * the message is formatted into a buffer that is
+            //   reused by each Line on the same thread, without
+            //   holding any lock. The line is commited to the
+            //   log (which synchronizes) on destruction
             class Line
             {
             public:
-                Line(std::vector<shared_ptr<Sink>> const * list_sinks,
-                     std::vector<unique_ptr<FormatBlock>> const * list_fb,
-                     Mutex * mutex,
-                     bool line_valid) :
-                    m_list_sinks(list_sinks),
-                    m_list_fb(list_fb),
-                    m_mutex(mutex),
-                    m_line_valid(line_valid)
-                {
-                    if(m_line_valid) {
-                        // create the prefix
-                        for(auto & fb : (*m_list_fb)) {
-                            m_line.append(fb->Get());
-                        }
-                    }
-                }
+                Line(Logger * logger,
+                     Level level,
+                     bool line_valid,
+                     u64 suppressed=0);
+                Line(Line && other);
+                Line(Line const &) = delete;
+                ~Line();
 
-                ~Line()
-                {
-                    if(m_line_valid) {
-                        for(auto &sink : (*m_list_sinks)) {
-                            sink->log(m_line);
-                        }
-                    }
-                    m_mutex->unlock();
-                }
+                Line & operator = (Line const &) = delete;
+                Line & operator = (Line &&) = delete;
 
                 template<typename T>
                 Line & operator << (T const &msg)
                 {
                     if(m_line_valid) {
-                        m_line.append(ToString(msg));
+                        m_msg->append(ToString(msg));
                     }
                     return *this;
                 }
@@ -203,7 +395,7 @@ namespace ks
                 Line & operator << (std::string const &msg)
                 {
                     if(m_line_valid) {
-                        m_line.append(msg);
+                        m_msg->append(msg);
                     }
                     return *this;
                 }
@@ -211,29 +403,51 @@ namespace ks
                 Line & operator << (const char * msg)
                 {
                     if(m_line_valid) {
-                        m_line.append(msg);
+                        m_msg->append(msg);
                     }
                     return *this;
                 }
 
-            private:
-                std::vector<shared_ptr<Sink>> const * m_list_sinks;
-                std::vector<unique_ptr<FormatBlock>> const * m_list_fb;
-                Mutex * m_mutex;
-                bool const m_line_valid;
+                // Common arithmetic types are formatted in place
+                // rather than through ToString, which allocates.
+                // Output matches std::ostream's default formatting
+                Line & operator << (char msg);
+                Line & operator << (bool msg);
+                Line & operator << (int msg);
+                Line & operator << (long msg);
+                Line & operator << (long long msg);
+                Line & operator << (unsigned int msg);
+                Line & operator << (unsigned long msg);
+                Line & operator << (unsigned long long msg);
+                Line & operator << (float msg);
+                Line & operator << (double msg);
 
-                std::string m_line;
+            private:
+                void appendUInt(unsigned long long msg,bool negative);
+
+                Logger * m_logger;
+                Level m_level;
+                bool m_line_valid;
+                u64 m_suppressed;
+
+                // Points to the thread's buffer, or to m_own_msg
+                // if the thread's buffer is already in use (ie by
+                // a line logged from within operator <<)
+                std::string * m_msg;
+                std::string m_own_msg;
             };
 
         public:
-            enum class Level : uint8_t
+            // OverflowPolicy
+            // * what an async Logger does with a line when
+            //   its queue is full
+            enum class OverflowPolicy : uint8_t
             {
-                TRACE   = 0,
-                DEBUG   = 1,
-                INFO    = 2,
-                WARN    = 3,
-                ERROR   = 4,
-                FATAL   = 5
+                Block,      // wait for the sink thread to catch up
+                Drop,       // discard the line
+                CountDrops  // discard the line and write a notice
+                            // with the number of dropped lines once
+                            // the sink thread catches up
             };
 
             // default constructor assumes thread safety is wanted
@@ -257,15 +471,84 @@ namespace ks
                    shared_ptr<Sink> const &sink,
                    std::array<std::vector<FormatBlock*>,6> && list_fbs);
 
+            ~Logger();
+
+            // * Starts async mode. Lines are queued and written
+            //   to the sinks by a dedicated thread
+            // * @capacity is rounded up to a power of two
+            // * Returns false if async mode is already on
+            bool StartAsync(uint capacity=8192,
+                            OverflowPolicy policy=OverflowPolicy::Block);
+
+            // * Writes out any queued lines, then stops the
+            //   sink thread and returns to synchronous mode
+            void StopAsync();
+
+            // * Blocks until every line logged before this
+            //   call has been written, then flushes the sinks
+            // * Must not be called from a Sink
+            void Flush();
+
+            // * Number of lines discarded by async mode
+            //   because the queue was full
+            u64 GetDroppedCount() const;
+
             bool AddSink(shared_ptr<Sink> const &new_sink);
             bool RemoveSink(shared_ptr<Sink> const &sink);
+
+            // * Binary sinks receive lines logged with
+            //   KS_LOG_BINARY (see KsLogBinary.hpp)
+            bool AddBinarySink(shared_ptr<BinarySink> const &new_sink);
+            bool RemoveBinarySink(shared_ptr<BinarySink> const &sink);
             void SetLevel(Level level);
             void UnsetLevel(Level level);
+
+            // * Sets a recorder that gets lines at every level,
+            //   regardless of SetLevel/UnsetLevel, and that is
+            //   dumped when a FATAL line is logged (see
+            //   KsLogRecorder.hpp). Pass nullptr to unset
+            void SetFlightRecorder(shared_ptr<SinkFlightRecorder> recorder);
+            shared_ptr<SinkFlightRecorder> GetFlightRecorder() const;
             void AddFormatBlock(unique_ptr<FormatBlock> fb,
                                 Level level);
 
+            // * Returns true if lines at @level are logged (to
+            //   the sinks, or to the flight recorder)
+            // * This is a single relaxed load so that it can
+            //   guard logging statements on hot paths; see
+            //   the KS_LOG macros below
+            bool IsEnabled(Level level) const
+            {
+                return ((m_enabled.load(std::memory_order_relaxed) >>
+                         static_cast<u8>(level)) & 1);
+            }
+
+            // * Returns true if lines at @level are compiled
+            //   in (ie @level is at least KS_LOG_MIN_LEVEL)
+            #if KS_LOG_MIN_LEVEL > 0
+            static constexpr bool IsCompiledIn(Level level)
+            {
+                return (static_cast<int>(level) >= KS_LOG_MIN_LEVEL);
+            }
+            #else
+            // * Every Level is at least zero; comparing against
+            //   it would warn under -Wtype-limits in every TU
+            static constexpr bool IsCompiledIn(Level)
+            {
+                return true;
+            }
+            #endif
+
             // logging methods
+            // * these skip the lock for lines that are filtered
+            //   out, but the arguments to operator << are still
+            //   evaluated; use the KS_LOG macros to avoid that
             Line Custom(Level level);
+
+            // * Logs a line that notes that @suppressed similar
+            //   lines were dropped; used by KS_LOG_EVERY_N and
+            //   KS_LOG_RATE_LIMITED
+            Line Custom(Level level,u64 suppressed);
             Line Trace();
             Line Debug();
             Line Info();
@@ -273,11 +556,89 @@ namespace ks
             Line Error();
             Line Fatal();
 
+            // * Writes a binary line; use KS_LOG_BINARY
+            //   instead of calling this directly
+            template<typename... Args>
+            void LogBinary(BinarySite const &site,Args const &... args);
+
         private:
+            void commit(Level level,std::string const &msg);
+            void formatLine(Level level,
+                            std::string const &msg,
+                            std::string &line);
+
+            // * Lines that can be committed without the sinks
+            //   (ie async lines, which are pushed onto a lock-free
+            //   queue) don't lock m_mutex. They only enter a shared
+            //   section that keeps the format blocks, recorder and
+            //   async queue from changing
+            // * Changing those locks m_mutex and pauses the shared
+            //   section, waiting for the lines in it to finish.
+            //   Lines that are logged meanwhile lock m_mutex
+            // * Each thread is counted in one of several stripes,
+            //   so that lines logged by different threads don't
+            //   contend on a single counter
+            bool enterShared();
+            void leaveShared();
+            void pauseShared();
+            void resumeShared();
+
+            // * Binary lines don't lock m_mutex. In async mode they're
+            //   queued like text lines, otherwise they're written
+            //   with m_binary_mutex locked
+            void commitBinary(BinarySite const &site,std::string &line);
+            void writeBinary(BinarySite const &site,std::string const &line);
+            static void pushAsync(Async * async,
+                                  std::string &line,
+                                  Level level,
+                                  BinarySite const * site=nullptr);
+
+            struct SharedStripe
+            {
+                std::atomic<uint> count;
+                char padding[64-sizeof(std::atomic<uint>)];
+            };
+
+            static uint const s_shared_stripes = 16;
+            std::atomic<uint> & sharedStripe();
+
             std::unique_ptr<Mutex> m_mutex;
+            std::array<SharedStripe,s_shared_stripes> m_list_shared_stripes;
+            std::atomic<uint> m_shared_paused;
+
+            // The sink thread doesn't lock m_mutex, since a
+            // producer may hold it while waiting for space
+            // in the queue. Changes to m_list_sinks lock both
+            std::mutex m_sink_mutex;
             std::vector<shared_ptr<Sink>> m_list_sinks;
-            std::bitset<6> m_filter;
+            void updateEnabled();
+
+            bool sinksEnabled(Level level) const
+            {
+                return ((m_filter.load(std::memory_order_relaxed) >>
+                         static_cast<u8>(level)) & 1);
+            }
+
+            // Bit per Level. m_filter applies to the sinks,
+            // while m_enabled also has the levels that are
+            // only wanted by the flight recorder
+            std::atomic<u8> m_filter;
+            std::atomic<u8> m_enabled;
+            shared_ptr<SinkFlightRecorder> m_recorder;
             std::array<std::vector<unique_ptr<FormatBlock>>,6> m_list_fb;
+            unique_ptr<Async> m_async;
+
+            struct BinarySinkInfo
+            {
+                shared_ptr<BinarySink> sink;
+                std::vector<bool> list_sites_written; // by site id
+            };
+
+            // Binary sinks are written by producers (or the sink
+            // thread in async mode) with only m_binary_mutex locked.
+            // Changes to m_list_binary_sinks lock both
+            std::mutex m_binary_mutex;
+            std::vector<BinarySinkInfo> m_list_binary_sinks;
         };
 
     } // Log
@@ -289,6 +650,64 @@ namespace ks
 
     // ============================================================= //
 
+    // KS_LOG
+    // * logs a line at @level (TRACE, DEBUG ... FATAL) to
+    //   @logger, ie: KS_LOG(ks::LOG,DEBUG) << "x: " << x;
+    // * lines below KS_LOG_MIN_LEVEL are compiled out. Other
+    //   lines check the level before evaluating any of the
+    //   streamed arguments, and without taking a lock
+    // * the trailing else makes the macro safe to use as the
+    //   body of an unbraced if/else
+    #define KS_LOG(logger,level) \
+        if(!ks::Log::Logger::IsCompiledIn( \
+                   ks::Log::Logger::Level::level) || \
+           !(logger).IsEnabled(ks::Log::Logger::Level::level)) {} \
+        else (logger).Custom(ks::Log::Logger::Level::level)
+
+    #define KS_LOG_TRACE(logger) KS_LOG(logger,TRACE)
+    #define KS_LOG_DEBUG(logger) KS_LOG(logger,DEBUG)
+    #define KS_LOG_INFO(logger) KS_LOG(logger,INFO)
+    #define KS_LOG_WARN(logger) KS_LOG(logger,WARN)
+    #define KS_LOG_ERROR(logger) KS_LOG(logger,ERROR)
+    #define KS_LOG_FATAL(logger) KS_LOG(logger,FATAL)
+
+    // KS_LOG_EVERY_N
+    // * like KS_LOG, but only logs the first and then every
+    //   @n'th line from this call site
+    //
+    // KS_LOG_RATE_LIMITED
+    // * like KS_LOG, but logs at most @burst lines at once
+    //   from this call site, refilled at @lines_per_sec
+    //
+    // * allowed lines note how many lines were suppressed
+    //   since the last one. Suppressed lines cost an atomic
+    //   op or two and don't evaluate the streamed arguments
+    // * the state for each call site is a function local
+    //   static (in a lambda, so that it can be created
+    //   within an expression). The for loop runs at most
+    //   once and scopes the suppressed count to the line
+    #define KS_LOG_SUPPRESSIBLE(logger,level,site_type,...) \
+        for(ks::u64 ks_log_suppressed = \
+                (ks::Log::Logger::IsCompiledIn( \
+                     ks::Log::Logger::Level::level) && \
+                 (logger).IsEnabled(ks::Log::Logger::Level::level)) ? \
+                    [&]() -> site_type & { \
+                        static site_type ks_log_site(__VA_ARGS__); \
+                        return ks_log_site; \
+                    }().Allow() : ks::Log::s_suppress_line; \
+            ks_log_suppressed != ks::Log::s_suppress_line; \
+            ks_log_suppressed = ks::Log::s_suppress_line) \
+            (logger).Custom(ks::Log::Logger::Level::level,ks_log_suppressed)
+
+    #define KS_LOG_EVERY_N(logger,level,n) \
+        KS_LOG_SUPPRESSIBLE(logger,level,ks::Log::Sampler,n)
+
+    #define KS_LOG_RATE_LIMITED(logger,level,lines_per_sec,burst) \
+        KS_LOG_SUPPRESSIBLE(logger,level,ks::Log::RateLimiter, \
+                            lines_per_sec,burst)
+
+    // ============================================================= //
+
 } // ks
 
 #endif // KS_LOG_HPP
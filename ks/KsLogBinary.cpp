@@ -0,0 +1,337 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+
+#include <ks/KsLogBinary.hpp>
+#include <ks/KsException.hpp>
+
+namespace ks
+{
+    namespace Log
+    {
+        namespace
+        {
+            std::atomic<u32> g_site_id_counter(0);
+            thread_local std::string tls_args_buffer;
+
+            std::string encodeSite(BinarySite const &site)
+            {
+                using namespace binary_detail;
+
+                std::string record;
+                record.push_back(static_cast<char>(Record::Site));
+                put(record,site.id);
+                put(record,static_cast<u8>(site.level));
+                put(record,static_cast<u32>(site.line));
+                putString(record,site.file,std::strlen(site.file));
+                putString(record,site.format,std::strlen(site.format));
+                return record;
+            }
+
+            template<typename T>
+            bool get(std::istream &in,T &value)
+            {
+                in.read(reinterpret_cast<char*>(&value),sizeof(T));
+                return (in.gcount() == sizeof(T));
+            }
+
+            // * @len comes from the stream and may be corrupt, so
+            //   the string is read in chunks and only grows as data
+            //   arrives instead of being resized to @len up front
+            bool getString(std::istream &in,std::string &s)
+            {
+                static u32 const chunk_size = 64*1024;
+
+                u32 len;
+                if(!get(in,len)) {
+                    return false;
+                }
+
+                s.clear();
+                while(len > 0) {
+                    u32 const count = std::min(len,chunk_size);
+                    std::size_t const pos = s.size();
+                    s.resize(pos+count);
+                    in.read(&s[pos],count);
+                    if(in.gcount() != count) {
+                        return false;
+                    }
+                    len -= count;
+                }
+                return true;
+            }
+
+            // Appends the text for the arg at @pos in @args
+            // and advances @pos past it
+            bool decodeArg(std::string const &args,
+                           std::size_t &pos,
+                           std::string &msg)
+            {
+                using binary_detail::Tag;
+
+                auto take = [&](void * dst,std::size_t size) {
+                    if(args.size()-pos < size) {
+                        return false;
+                    }
+                    std::memcpy(dst,args.data()+pos,size);
+                    pos += size;
+                    return true;
+                };
+
+                u8 tag;
+                if(!take(&tag,1)) {
+                    return false;
+                }
+
+                switch(static_cast<Tag>(tag)) {
+                case Tag::Int: {
+                    s64 value;
+                    if(!take(&value,8)) { return false; }
+                    msg.append(ToString(value));
+                    return true;
+                }
+                case Tag::UInt: {
+                    u64 value;
+                    if(!take(&value,8)) { return false; }
+                    msg.append(ToString(value));
+                    return true;
+                }
+                case Tag::Float: {
+                    double value;
+                    if(!take(&value,8)) { return false; }
+                    msg.append(ToString(value));
+                    return true;
+                }
+                case Tag::String: {
+                    u32 len;
+                    if(!take(&len,4) || (args.size()-pos < len)) {
+                        return false;
+                    }
+                    msg.append(args,pos,len);
+                    pos += len;
+                    return true;
+                }
+                case Tag::Char: {
+                    char value;
+                    if(!take(&value,1)) { return false; }
+                    msg.push_back(value);
+                    return true;
+                }
+                case Tag::Bool: {
+                    char value;
+                    if(!take(&value,1)) { return false; }
+                    msg.push_back(value ? '1' : '0');
+                    return true;
+                }
+                default:
+                    return false;
+                }
+            }
+
+            void appendTimestamp(s64 time_ns,std::string &line)
+            {
+                s64 secs = time_ns/1000000000;
+                s64 ms = (time_ns%1000000000)/1000000;
+                if(time_ns < 0 && ms != 0) {
+                    secs -= 1;
+                    ms += 1000;
+                }
+
+                std::time_t const time = static_cast<std::time_t>(secs);
+                std::tm tm;
+                gmtime_r(&time,&tm);
+
+                char buff[64];
+                int const count =
+                        std::snprintf(buff,sizeof(buff),
+                                      "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+                                      tm.tm_year+1900,tm.tm_mon+1,tm.tm_mday,
+                                      tm.tm_hour,tm.tm_min,tm.tm_sec,
+                                      static_cast<int>(ms));
+                if(count > 0) {
+                    line.append(buff,count);
+                }
+            }
+        }
+
+        // ============================================================= //
+
+        BinarySite::BinarySite(char const * file,
+                               uint line,
+                               Logger::Level level,
+                               char const * format) :
+            file(file),
+            line(line),
+            level(level),
+            format(format),
+            id(g_site_id_counter.fetch_add(1)),
+            record(encodeSite(*this))
+        {
+            // empty
+        }
+
+        // ============================================================= //
+
+        BinarySinkToFile::BinarySinkToFile(std::string const &path) :
+            m_file(std::fopen(path.c_str(),"wb"))
+        {
+            if(m_file == nullptr) {
+                KS_THROW(Exception(
+                             Exception::ErrorLevel::ERROR,
+                             "BinarySinkToFile: Failed to open "+path));
+            }
+        }
+
+        BinarySinkToFile::~BinarySinkToFile()
+        {
+            std::fclose(m_file);
+        }
+
+        void BinarySinkToFile::write(char const * data,std::size_t size)
+        {
+            std::fwrite(data,1,size,m_file);
+        }
+
+        void BinarySinkToFile::flush()
+        {
+            std::fflush(m_file);
+        }
+
+        // ============================================================= //
+
+        std::string & binary_detail::GetArgsBuffer()
+        {
+            return tls_args_buffer;
+        }
+
+        // ============================================================= //
+
+        bool DecodeBinaryLog(std::istream &in,std::ostream &out)
+        {
+            using namespace binary_detail;
+
+            static char const * const list_level_names[] = {
+                "TRACE","DEBUG","INFO","WARN","ERROR","FATAL"
+            };
+
+            struct Site
+            {
+                u8 level;
+                u32 line;
+                std::string file;
+                std::string format;
+            };
+
+            char magic[4];
+            u32 version;
+            u32 byte_order;
+            in.read(magic,4);
+            if((in.gcount() != 4) || (std::memcmp(magic,"KSLB",4) != 0) ||
+               !get(in,version) || (version != s_version) ||
+               !get(in,byte_order) || (byte_order != s_byte_order)) {
+                return false;
+            }
+
+            std::unordered_map<u32,Site> list_sites;
+            std::string args;
+            std::string line;
+
+            while(true) {
+                int const record = in.get();
+                if(record == std::char_traits<char>::eof()) {
+                    return true;
+                }
+
+                if(record == static_cast<int>(Record::Site)) {
+                    u32 id;
+                    Site site;
+                    if(!get(in,id) || !get(in,site.level) ||
+                       !get(in,site.line) || (site.level > 5) ||
+                       !getString(in,site.file) ||
+                       !getString(in,site.format)) {
+                        return false;
+                    }
+                    list_sites[id] = std::move(site);
+                }
+                else if(record == static_cast<int>(Record::Line)) {
+                    u32 id;
+                    s64 time_ns;
+                    u32 thread_id;
+                    if(!get(in,id) || !get(in,time_ns) ||
+                       !get(in,thread_id) || !getString(in,args)) {
+                        return false;
+                    }
+
+                    auto site_it = list_sites.find(id);
+                    if(site_it == list_sites.end()) {
+                        return false;
+                    }
+                    Site const &site = site_it->second;
+
+                    line.clear();
+                    appendTimestamp(time_ns,line);
+                    line.append(" T");
+                    line.append(ToString(thread_id));
+                    line.push_back(' ');
+                    line.append(list_level_names[site.level]);
+                    line.append(": ");
+
+                    // Replace each {} with the next arg, and
+                    // append any args that are left over
+                    std::size_t pos=0;
+                    std::size_t fmt_pos=0;
+                    while(fmt_pos < site.format.size()) {
+                        std::size_t const next =
+                                site.format.find("{}",fmt_pos);
+
+                        if((next == std::string::npos) ||
+                           (pos == args.size())) {
+                            line.append(site.format,fmt_pos,
+                                        std::string::npos);
+                            break;
+                        }
+
+                        line.append(site.format,fmt_pos,next-fmt_pos);
+                        if(!decodeArg(args,pos,line)) {
+                            return false;
+                        }
+                        fmt_pos = next+2;
+                    }
+
+                    while(pos < args.size()) {
+                        line.push_back(' ');
+                        if(!decodeArg(args,pos,line)) {
+                            return false;
+                        }
+                    }
+
+                    out << line << '\n';
+                }
+                else {
+                    return false;
+                }
+            }
+        }
+
+    } // Log
+
+} // ks
@@ -0,0 +1,263 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef KS_LOG_BINARY_HPP
+#define KS_LOG_BINARY_HPP
+
+#include <cstdio>
+#include <istream>
+#include <ostream>
+
+#include <ks/KsLog.hpp>
+
+namespace ks
+{
+    namespace Log
+    {
+        // ============================================================= //
+
+        // Binary logging
+        // * Instead of formatting text, a binary log line records
+        //   the id of its call site (BinarySite) along with the raw
+        //   bytes of its arguments. Formatting is deferred until the
+        //   stream is decoded (DecodeBinaryLog, or the ks_logdecode
+        //   tool), which keeps it off the logging thread and makes
+        //   the output several times smaller
+        // * Lines are written with the KS_LOG_BINARY macro:
+        //
+        //   KS_LOG_BINARY(ks::LOG,INFO,"read {} bytes from {}",size,path);
+        //
+        //   Each {} in the format is replaced by the next argument
+        //   when decoded. Arguments may be integers, floating point
+        //   numbers, bools, chars and strings
+        //
+        // * Binary lines don't take the Logger's lock. In async
+        //   mode they're queued along with text lines and written
+        //   by the sink thread; otherwise the logging thread writes
+        //   them with a lock that only binary sinks use
+        //
+        // * Stream layout (host byte order):
+        //   header: "KSLB" u32(version) u32(0x01020304)
+        //   site:   u8(1) u32(id) u8(level) u32(line)
+        //           u32(len) file u32(len) format
+        //   line:   u8(2) u32(site id) s64(unix time ns) u32(thread)
+        //           u32(len) args
+        //   arg:    u8(tag) value, where strings are u32(len) chars
+        //
+        //   The site record for a given id is written to each sink
+        //   before the first line that refers to it
+
+        // BinarySite
+        // * describes a single KS_LOG_BINARY statement
+        // * ids are assigned on construction and are unique
+        //   for the lifetime of the process
+        // * the site record is also encoded on construction, so
+        //   that writing it to a sink doesn't allocate
+        struct BinarySite
+        {
+            BinarySite(char const * file,
+                       uint line,
+                       Logger::Level level,
+                       char const * format);
+
+            char const * const file;
+            uint const line;
+            Logger::Level const level;
+            char const * const format;
+            u32 const id;
+            std::string const record;
+        };
+
+        // BinarySink
+        // * abstract class that represents binary logging output
+        // * the Logger writes the stream header to each
+        //   BinarySink when its added, so sinks only
+        //   need to pass along bytes
+        class BinarySink
+        {
+        public:
+            virtual ~BinarySink() = default;
+            virtual void write(char const * data,std::size_t size)=0;
+            virtual void flush() {}
+        };
+
+        // BinarySinkToFile
+        // * writes a binary log to a file. Output is buffered
+        //   until the buffer fills or the Logger is flushed
+        // * throws if the file can't be opened
+        class BinarySinkToFile : public BinarySink
+        {
+        public:
+            BinarySinkToFile(std::string const &path);
+            ~BinarySinkToFile();
+
+            void write(char const * data,std::size_t size);
+            void flush();
+
+        private:
+            std::FILE * m_file;
+        };
+
+        // * Writes the text for the binary log in @in to @out,
+        //   one line per log line
+        // * Returns false if @in isn't a valid binary log or
+        //   ends partway through a record
+        bool DecodeBinaryLog(std::istream &in,std::ostream &out);
+
+        // ============================================================= //
+
+        namespace binary_detail
+        {
+            u32 const s_version = 1;
+            u32 const s_byte_order = 0x01020304;
+
+            // u8(2) u32(site id) s64(time) u32(thread) u32(len)
+            std::size_t const s_line_header_size = 21;
+
+            enum class Record : u8
+            {
+                Site = 1,
+                Line = 2
+            };
+
+            enum class Tag : u8
+            {
+                Int     = 1,
+                UInt    = 2,
+                Float   = 3,
+                String  = 4,
+                Char    = 5,
+                Bool    = 6
+            };
+
+            template<typename T>
+            void put(std::string &buff,T const &value)
+            {
+                buff.append(reinterpret_cast<char const*>(&value),sizeof(T));
+            }
+
+            inline void putString(std::string &buff,
+                                  char const * s,
+                                  std::size_t len)
+            {
+                put(buff,static_cast<u32>(len));
+                buff.append(s,len);
+            }
+
+            template<typename T>
+            typename std::enable_if<
+                std::is_integral<T>::value && std::is_signed<T>::value
+            >::type encode(std::string &buff,T value)
+            {
+                buff.push_back(static_cast<char>(Tag::Int));
+                put(buff,static_cast<s64>(value));
+            }
+
+            template<typename T>
+            typename std::enable_if<
+                std::is_integral<T>::value && !std::is_signed<T>::value
+            >::type encode(std::string &buff,T value)
+            {
+                buff.push_back(static_cast<char>(Tag::UInt));
+                put(buff,static_cast<u64>(value));
+            }
+
+            template<typename T>
+            typename std::enable_if<
+                std::is_floating_point<T>::value
+            >::type encode(std::string &buff,T value)
+            {
+                buff.push_back(static_cast<char>(Tag::Float));
+                put(buff,static_cast<double>(value));
+            }
+
+            inline void encode(std::string &buff,bool value)
+            {
+                buff.push_back(static_cast<char>(Tag::Bool));
+                buff.push_back(value ? 1 : 0);
+            }
+
+            inline void encode(std::string &buff,char value)
+            {
+                buff.push_back(static_cast<char>(Tag::Char));
+                buff.push_back(value);
+            }
+
+            inline void encode(std::string &buff,char const * value)
+            {
+                buff.push_back(static_cast<char>(Tag::String));
+                putString(buff,value,std::char_traits<char>::length(value));
+            }
+
+            inline void encode(std::string &buff,std::string const &value)
+            {
+                buff.push_back(static_cast<char>(Tag::String));
+                putString(buff,value.data(),value.size());
+            }
+
+            // Returns the calling thread's buffer for encoding args
+            std::string & GetArgsBuffer();
+        }
+
+        // ============================================================= //
+
+        template<typename... Args>
+        void Logger::LogBinary(BinarySite const &site,Args const &... args)
+        {
+            // The flight recorder only takes text lines
+            if(!sinksEnabled(site.level)) {
+                return;
+            }
+
+            // Encoding doesn't call back into the Logger, so
+            // the thread's buffer can't already be in use. The
+            // line header is filled in by commitBinary
+            std::string &buff = binary_detail::GetArgsBuffer();
+            buff.assign(binary_detail::s_line_header_size,'\0');
+
+            int expand[] = { 0,(binary_detail::encode(buff,args),0)... };
+            (void)expand;
+
+            commitBinary(site,buff);
+        }
+
+    } // Log
+
+    // ============================================================= //
+
+    // KS_LOG_BINARY
+    // * logs a binary line at @level (TRACE, DEBUG ... FATAL)
+    //   to the binary sinks of @logger. See Log::BinarySite
+    // * like KS_LOG, lines below KS_LOG_MIN_LEVEL are compiled
+    //   out and arguments aren't evaluated for filtered lines
+    #define KS_LOG_BINARY(logger,level,format,...) \
+        do { \
+            if(ks::Log::Logger::IsCompiledIn( \
+                       ks::Log::Logger::Level::level) && \
+               (logger).IsEnabled(ks::Log::Logger::Level::level)) { \
+                static ks::Log::BinarySite const ks_log_binary_site( \
+                            __FILE__,__LINE__, \
+                            ks::Log::Logger::Level::level,format); \
+                (logger).LogBinary(ks_log_binary_site,##__VA_ARGS__); \
+            } \
+        } while(0)
+
+    // ============================================================= //
+
+} // ks
+
+#endif // KS_LOG_BINARY_HPP
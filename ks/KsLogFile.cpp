@@ -0,0 +1,242 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ks/KsLogFile.hpp>
+#include <ks/KsException.hpp>
+
+namespace ks
+{
+    namespace Log
+    {
+        SinkToFile::Config::Config() :
+            buffer_size(256*1024),
+            flush_each_line(false),
+            flush_kib(0),
+            flush_interval(0),
+            flush_on_error(true),
+            rotate_size(0),
+            rotate_interval(0),
+            rotate_count(5)
+        {
+            // empty
+        }
+
+        SinkToFile::SinkToFile(Config const &config) :
+            m_config(config),
+            m_fd(-1),
+            m_file_size(0),
+            m_rotation_count(0),
+            m_dropped_bytes(0),
+            m_failing(false)
+        {
+            m_buffer.reserve(m_config.buffer_size);
+
+            openFile();
+            if(m_fd < 0) {
+                KS_THROW(Exception(
+                             Exception::ErrorLevel::ERROR,
+                             "SinkToFile: Failed to open "+m_config.path));
+            }
+        }
+
+        SinkToFile::~SinkToFile()
+        {
+            writeBuffer();
+            if(m_fd >= 0) {
+                ::close(m_fd);
+            }
+        }
+
+        void SinkToFile::log(std::string const &line)
+        {
+            log(line,Level::INFO);
+        }
+
+        void SinkToFile::log(std::string const &line,Level level)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            std::size_t const line_size = line.size()+1;
+            bool const check_time =
+                    (m_config.rotate_interval.count() > 0) ||
+                    (m_config.flush_interval.count() > 0);
+
+            Clock::time_point const now =
+                    check_time ? Clock::now() : Clock::time_point();
+
+            // Rotate before writing the line that
+            // would take the file over its limit
+            u64 const pending_size = m_file_size+m_buffer.size();
+            if(((m_config.rotate_size > 0) &&
+                (pending_size > 0) &&
+                (pending_size+line_size > m_config.rotate_size)) ||
+               ((m_config.rotate_interval.count() > 0) &&
+                (now-m_open_time >= m_config.rotate_interval))) {
+                rotate();
+            }
+
+            if(m_buffer.size()+line_size > m_config.buffer_size) {
+                writeBuffer();
+            }
+
+            m_buffer.append(line);
+            m_buffer.push_back('\n');
+
+            bool const flush =
+                    m_config.flush_each_line ||
+                    (m_buffer.size() >= m_config.buffer_size) ||
+                    ((m_config.flush_kib > 0) &&
+                     (m_buffer.size() >= m_config.flush_kib*1024)) ||
+                    (m_config.flush_on_error &&
+                     (level >= Level::ERROR)) ||
+                    ((m_config.flush_interval.count() > 0) &&
+                     (now-m_write_time >= m_config.flush_interval));
+
+            if(flush) {
+                writeBuffer();
+            }
+        }
+
+        void SinkToFile::flush()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            writeBuffer();
+        }
+
+        u64 SinkToFile::GetRotationCount()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_rotation_count;
+        }
+
+        u64 SinkToFile::GetDroppedBytes()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_dropped_bytes;
+        }
+
+        int SinkToFile::openFile()
+        {
+            // Without any rotated files to keep, the
+            // old file is truncated instead of renamed
+            int const flags =
+                    O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC |
+                    (((m_rotation_count > 0) &&
+                      (m_config.rotate_count == 0)) ? O_TRUNC : 0);
+
+            m_fd = ::open(m_config.path.c_str(),flags,0644);
+            int const error = (m_fd < 0) ? errno : 0;
+            m_file_size = 0;
+
+            struct stat file_stat;
+            if((m_fd >= 0) && (::fstat(m_fd,&file_stat) == 0)) {
+                m_file_size = static_cast<u64>(file_stat.st_size);
+            }
+
+            m_open_time = Clock::now();
+            m_write_time = m_open_time;
+
+            return error;
+        }
+
+        void SinkToFile::rotate()
+        {
+            writeBuffer();
+            if(m_fd >= 0) {
+                ::close(m_fd);
+            }
+
+            if(m_config.rotate_count > 0) {
+                std::string const &path = m_config.path;
+                for(uint i=m_config.rotate_count-1; i > 0; i--) {
+                    std::rename((path+"."+ToString(i)).c_str(),
+                                (path+"."+ToString(i+1)).c_str());
+                }
+                std::rename(path.c_str(),(path+".1").c_str());
+            }
+
+            m_rotation_count++;
+            openFile();
+        }
+
+        void SinkToFile::writeBuffer()
+        {
+            // m_mutex must be locked
+            char const * data = m_buffer.data();
+            std::size_t remaining = m_buffer.size();
+
+            // The file may have failed to reopen when it
+            // was rotated, so retry until it opens
+            int error = 0;
+            if((remaining > 0) && (m_fd < 0)) {
+                error = openFile();
+            }
+
+            while((remaining > 0) && (m_fd >= 0)) {
+                ssize_t const count = ::write(m_fd,data,remaining);
+                if(count < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    error = errno;
+                    break; // drop what's left
+                }
+                data += count;
+                remaining -= count;
+                m_file_size += count;
+            }
+
+            // Failures are only reported once, and
+            // again when writing recovers
+            if(remaining > 0) {
+                m_dropped_bytes += remaining;
+                if(!m_failing) {
+                    m_failing = true;
+                    std::fprintf(stderr,
+                                 "KS: SinkToFile: Failed to write %s (%s), "
+                                 "dropping lines\n",
+                                 m_config.path.c_str(),
+                                 std::strerror(error));
+                }
+            }
+            else if(m_failing && !m_buffer.empty()) {
+                m_failing = false;
+                std::fprintf(stderr,
+                             "KS: SinkToFile: Writing %s again, "
+                             "%llu bytes dropped so far\n",
+                             m_config.path.c_str(),
+                             static_cast<unsigned long long>(m_dropped_bytes));
+            }
+
+            m_buffer.clear();
+
+            if(m_config.flush_interval.count() > 0) {
+                m_write_time = Clock::now();
+            }
+        }
+
+    } // Log
+
+} // ks
@@ -0,0 +1,130 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef KS_LOG_FILE_HPP
+#define KS_LOG_FILE_HPP
+
+#include <ks/KsLog.hpp>
+
+namespace ks
+{
+    namespace Log
+    {
+        // ============================================================= //
+
+        // SinkToFile
+        // * sink that appends lines to a file through a large
+        //   write buffer, using plain write(2) calls on a file
+        //   opened with O_APPEND
+        // * the buffer is written out when it fills, when the
+        //   Logger is flushed, on destruction, and as set by
+        //   the flush options in Config
+        // * the file can be rotated by size and/or by age. When
+        //   rotated, path.1 is renamed to path.2 and so on, path
+        //   is renamed to path.1 and a new file is started
+        // * throws if the file can't be opened on creation. If it
+        //   can't be reopened after rotating, or writing to it
+        //   fails, the buffer is dropped and the failure is
+        //   reported once on stderr. Reopening is retried each
+        //   time the buffer is written out
+        class SinkToFile : public ks::Log::Sink
+        {
+        public:
+            struct Config
+            {
+                Config();
+
+                std::string path;
+
+                // * Size of the write buffer in bytes
+                std::size_t buffer_size;
+
+                // * Write out the buffer after every line
+                bool flush_each_line;
+
+                // * Write out the buffer once it holds at least
+                //   this many KiB. Zero only writes it out when
+                //   it's full
+                uint flush_kib;
+
+                // * Write out the buffer if this long has passed
+                //   since it was last written. Zero disables.
+                // * This is checked when lines are logged, so
+                //   lines may sit in the buffer for longer if
+                //   logging goes quiet; use Logger::Flush
+                Milliseconds flush_interval;
+
+                // * Write out the buffer after ERROR and
+                //   FATAL lines
+                bool flush_on_error;
+
+                // * Rotate once the file would grow past this
+                //   many bytes. Zero disables
+                u64 rotate_size;
+
+                // * Rotate once the file has been open this
+                //   long. Zero disables
+                Seconds rotate_interval;
+
+                // * The number of rotated files to keep
+                //   (path.1 ... path.N). With zero the file
+                //   is just truncated when rotated
+                uint rotate_count;
+            };
+
+            SinkToFile(Config const &config);
+            ~SinkToFile();
+
+            void log(std::string const &line);
+            void log(std::string const &line,Level level);
+            void flush();
+
+            // * Number of times the file has been rotated
+            u64 GetRotationCount();
+
+            // * Number of bytes dropped because the file
+            //   couldn't be opened or written to
+            u64 GetDroppedBytes();
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            int openFile();
+            void rotate();
+            void writeBuffer();
+
+            Config const m_config;
+
+            std::mutex m_mutex;
+            int m_fd;
+            u64 m_file_size;
+            u64 m_rotation_count;
+            u64 m_dropped_bytes;
+            bool m_failing;
+            Clock::time_point m_open_time;
+            Clock::time_point m_write_time;
+
+            std::string m_buffer;
+        };
+
+        // ============================================================= //
+
+    } // Log
+
+} // ks
+
+#endif // KS_LOG_FILE_HPP
@@ -0,0 +1,230 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ks/KsLogRecorder.hpp>
+
+namespace ks
+{
+    namespace Log
+    {
+        namespace
+        {
+            // The raw pointer is what signal handlers use. Every
+            // recorder that's been set is kept in the list (and
+            // never freed) since a handler may still be using it
+            // after it's been replaced
+            std::mutex g_global_mutex;
+            shared_ptr<SinkFlightRecorder> g_global_recorder;
+            std::atomic<SinkFlightRecorder*> g_global_recorder_ptr(nullptr);
+            std::vector<shared_ptr<SinkFlightRecorder>> g_list_set_recorders;
+
+            void writeAll(int fd,char const * data,std::size_t size)
+            {
+                while(size > 0) {
+                    ssize_t const count = ::write(fd,data,size);
+                    if(count < 0) {
+                        if(errno == EINTR) {
+                            continue;
+                        }
+                        return;
+                    }
+                    data += count;
+                    size -= count;
+                }
+            }
+
+            void onFatalSignal(int sig)
+            {
+                SinkFlightRecorder::DumpGlobal();
+
+                // The handler was installed with SA_RESETHAND,
+                // so this takes the default action
+                std::raise(sig);
+            }
+        }
+
+        // ============================================================= //
+
+        uint const SinkFlightRecorder::s_max_line_size;
+
+        SinkFlightRecorder::Config::Config() :
+            path("ks_flight_recorder.log"),
+            capacity(4096),
+            line_size(256)
+        {
+            // empty
+        }
+
+        SinkFlightRecorder::SinkFlightRecorder(Config const &config) :
+            m_config(config),
+            m_mask([&config]() {
+                u64 capacity=1;
+                while(capacity < config.capacity) {
+                    capacity *= 2;
+                }
+                return capacity-1;
+            }()),
+            m_list_slots(new Slot[m_mask+1]),
+            m_line_size(std::min(config.line_size,s_max_line_size)),
+            m_text(new char[(m_mask+1)*m_line_size]),
+            m_next(0),
+            m_dumping(false)
+        {
+            for(u64 i=0; i <= m_mask; i++) {
+                m_list_slots[i].seq.store(0,std::memory_order_relaxed);
+                m_list_slots[i].size.store(0,std::memory_order_relaxed);
+            }
+        }
+
+        SinkFlightRecorder::~SinkFlightRecorder()
+        {
+            // empty
+        }
+
+        void SinkFlightRecorder::log(std::string const &line)
+        {
+            u64 const index = m_next.fetch_add(1,std::memory_order_relaxed);
+            Slot &slot = m_list_slots[index & m_mask];
+
+            // Claim the slot by marking it as being written (see
+            // Dump). Lines never wait for each other: if a line
+            // from an earlier lap is still being written to the
+            // slot, or a later one has already claimed it, this
+            // line is dropped
+            u64 const claim_seq = 2*index+1;
+            u64 seq = slot.seq.load(std::memory_order_relaxed);
+            while(true) {
+                if((seq & 1) || (seq > claim_seq)) {
+                    return;
+                }
+                if(slot.seq.compare_exchange_weak(seq,claim_seq,
+                                                  std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+
+            u32 const size = static_cast<u32>(
+                        std::min<std::size_t>(line.size(),m_line_size));
+
+            std::memcpy(&(m_text[(index & m_mask)*m_line_size]),
+                        line.data(),size);
+            slot.size.store(size,std::memory_order_relaxed);
+
+            slot.seq.store(2*index+2,std::memory_order_release);
+        }
+
+        bool SinkFlightRecorder::Dump()
+        {
+            if(m_dumping.exchange(true)) {
+                return false;
+            }
+
+            int const fd = ::open(m_config.path.c_str(),
+                                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                  0644);
+            if(fd < 0) {
+                m_dumping.store(false);
+                return false;
+            }
+
+            u64 const next = m_next.load(std::memory_order_acquire);
+            u64 const first = (next > m_mask) ? (next-m_mask-1) : 0;
+
+            char buff[s_max_line_size+1];
+
+            for(u64 index=first; index < next; index++) {
+                Slot const &slot = m_list_slots[index & m_mask];
+                u64 const seq = 2*index+2;
+
+                // Copy the line out and then check that it wasn't
+                // being written or overwritten while we copied it
+                if(slot.seq.load(std::memory_order_acquire) != seq) {
+                    continue;
+                }
+
+                u32 const size = slot.size.load(std::memory_order_relaxed);
+                std::memcpy(buff,&(m_text[(index & m_mask)*m_line_size]),size);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(slot.seq.load(std::memory_order_relaxed) != seq) {
+                    continue;
+                }
+
+                buff[size] = '\n';
+                writeAll(fd,buff,size+1);
+            }
+
+            ::close(fd);
+            m_dumping.store(false);
+            return true;
+        }
+
+        u64 SinkFlightRecorder::GetLineCount() const
+        {
+            return m_next.load(std::memory_order_relaxed);
+        }
+
+        void SinkFlightRecorder::SetGlobal(shared_ptr<SinkFlightRecorder> recorder)
+        {
+            std::lock_guard<std::mutex> lock(g_global_mutex);
+            if(recorder &&
+               std::find(g_list_set_recorders.begin(),
+                         g_list_set_recorders.end(),
+                         recorder) == g_list_set_recorders.end()) {
+                g_list_set_recorders.push_back(recorder);
+            }
+            g_global_recorder_ptr.store(recorder.get());
+            g_global_recorder = std::move(recorder);
+        }
+
+        shared_ptr<SinkFlightRecorder> SinkFlightRecorder::GetGlobal()
+        {
+            std::lock_guard<std::mutex> lock(g_global_mutex);
+            return g_global_recorder;
+        }
+
+        bool SinkFlightRecorder::DumpGlobal()
+        {
+            SinkFlightRecorder * recorder = g_global_recorder_ptr.load();
+            return (recorder && recorder->Dump());
+        }
+
+        void SinkFlightRecorder::InstallSignalHandlers()
+        {
+            struct sigaction action;
+            std::memset(&action,0,sizeof(action));
+            action.sa_handler = &onFatalSignal;
+            action.sa_flags = SA_RESETHAND;
+            sigemptyset(&action.sa_mask);
+
+            for(int sig : { SIGSEGV,SIGBUS,SIGFPE,SIGILL,SIGABRT }) {
+                sigaction(sig,&action,nullptr);
+            }
+        }
+
+    } // Log
+
+} // ks
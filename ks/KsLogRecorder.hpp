@@ -0,0 +1,125 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef KS_LOG_RECORDER_HPP
+#define KS_LOG_RECORDER_HPP
+
+#include <ks/KsLog.hpp>
+
+namespace ks
+{
+    namespace Log
+    {
+        // ============================================================= //
+
+        // SinkFlightRecorder
+        // * sink that keeps the most recent lines in a fixed
+        //   size circular buffer in memory, and writes them to
+        //   a file when Dump() is called
+        // * set with Logger::SetFlightRecorder, a recorder gets
+        //   lines at every level regardless of the Logger's
+        //   filter (which still applies to the other sinks),
+        //   and is dumped when a FATAL line is logged
+        // * a process wide recorder can also be set with
+        //   SetGlobal. It's dumped when a FATAL ks::Exception
+        //   is created, and after InstallSignalHandlers, when
+        //   the process gets a fatal signal
+        // * each line takes an index with a single atomic increment
+        //   and claims its slot with a CAS. Nothing waits: a line
+        //   is dropped if its slot is still being written by a line
+        //   from an earlier lap. Lines longer than line_size are
+        //   truncated
+        // * Dump() only uses async-signal-safe calls, so it can
+        //   be called from a signal handler. Lines that are being
+        //   written or were dropped are skipped
+        class SinkFlightRecorder : public ks::Log::Sink
+        {
+        public:
+            struct Config
+            {
+                Config();
+
+                // * File that Dump() writes to (truncating it)
+                std::string path;
+
+                // * Number of lines kept; rounded up
+                //   to a power of two
+                uint capacity;
+
+                // * Max length of each line in bytes, up to
+                //   s_max_line_size
+                uint line_size;
+            };
+
+            static uint const s_max_line_size = 1024;
+
+            SinkFlightRecorder(Config const &config);
+            ~SinkFlightRecorder();
+
+            using Sink::log;
+            void log(std::string const &line);
+
+            // * Writes the recorded lines, oldest first, to
+            //   the file in Config::path
+            // * Returns false if the file couldn't be written
+            //   or another thread is already dumping
+            bool Dump();
+
+            // * Number of lines logged to the recorder since
+            //   creation, including dropped ones
+            u64 GetLineCount() const;
+
+            // * Sets the process wide recorder. Pass nullptr
+            //   to unset
+            // * A recorder that has been set is kept alive until
+            //   the process exits, even after it's replaced, since
+            //   a signal handler may still be dumping it
+            static void SetGlobal(shared_ptr<SinkFlightRecorder> recorder);
+            static shared_ptr<SinkFlightRecorder> GetGlobal();
+            static bool DumpGlobal();
+
+            // * Dumps the global recorder on SIGSEGV, SIGBUS,
+            //   SIGFPE, SIGILL and SIGABRT, then lets the signal
+            //   take its default action
+            static void InstallSignalHandlers();
+
+        private:
+            struct Slot
+            {
+                // 0: never written, odd: being written,
+                // otherwise 2*(index+1) of the recorded line
+                std::atomic<u64> seq;
+                std::atomic<u32> size;
+            };
+
+            Config const m_config;
+            u64 const m_mask;
+            unique_ptr<Slot[]> m_list_slots;
+            uint const m_line_size;
+            unique_ptr<char[]> m_text;
+
+            std::atomic<u64> m_next;
+            std::atomic<bool> m_dumping;
+        };
+
+        // ============================================================= //
+
+    } // Log
+
+} // ks
+
+#endif // KS_LOG_RECORDER_HPP
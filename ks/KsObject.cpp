@@ -62,4 +62,19 @@ namespace ks
         return m_event_loop;
     }
 
+    EventLoop::Strand * Object::GetStrand() const
+    {
+        // Strands are only used by multi-worker loops (see
+        // EventLoop::postEvent), so most Objects never need one
+        if(!m_event_loop || (m_event_loop->GetWorkerCount() < 2)) {
+            return nullptr;
+        }
+
+        std::call_once(m_strand_once,[this]() {
+            m_strand = m_event_loop->CreateStrand();
+        });
+
+        return m_strand.get();
+    }
+
 } // ks
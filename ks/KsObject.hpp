@@ -134,6 +134,16 @@ namespace ks
         /// * Returns this Object's EventLoop
         shared_ptr<EventLoop> const & GetEventLoop() const;
 
+        /// * Returns this Object's Strand
+        /// * Events for this Object are posted through its Strand
+        ///   so that they are never invoked concurrently, even
+        ///   if the EventLoop is Run by several worker threads
+        /// * The Strand is created the first time it's needed;
+        ///   null if this Object has no EventLoop or if its
+        ///   EventLoop is configured with a single worker, which
+        ///   already serializes events
+        EventLoop::Strand * GetStrand() const;
+
     private:
         Object(Object const &other) = delete;
         Object(Object &&other) = delete;
@@ -143,6 +153,8 @@ namespace ks
         Id const m_id;
 
         shared_ptr<EventLoop> m_event_loop;
+        mutable std::once_flag m_strand_once;
+        mutable shared_ptr<EventLoop::Strand> m_strand;
 
         static std::mutex s_id_mutex;
         static Id s_id_counter;
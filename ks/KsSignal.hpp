@@ -17,13 +17,16 @@
 #ifndef KS_SIGNAL_HPP
 #define KS_SIGNAL_HPP
 
+#include <atomic>
 #include <functional>
 #include <vector>
 #include <mutex>
+#include <thread>
 #include <utility>
 #include <type_traits>
 #include <algorithm>
 
+#include <ks/KsFunction.hpp>
 #include <ks/KsEvent.hpp>
 #include <ks/KsObject.hpp>
 
@@ -46,6 +49,82 @@ namespace ks
 
         Id genId();
 
+        // IndexSequence
+        // * c++11 stand-in for std::index_sequence, used
+        //   to unpack stored slot arguments
+        template<std::size_t... Is>
+        struct IndexSequence {};
+
+        template<std::size_t N, std::size_t... Is>
+        struct MakeIndexSequence :
+                MakeIndexSequence<N-1,N-1,Is...> {};
+
+        template<std::size_t... Is>
+        struct MakeIndexSequence<0,Is...>
+        {
+            using type = IndexSequence<Is...>;
+        };
+
+        // AllTriviallyCopyable
+        template<typename... Ts>
+        struct AllTriviallyCopyable : std::true_type {};
+
+        template<typename T, typename... Ts>
+        struct AllTriviallyCopyable<T,Ts...> :
+                std::integral_constant<
+                    bool,
+                    std::is_trivially_copyable<T>::value &&
+                    AllTriviallyCopyable<Ts...>::value> {};
+
+        // AnyMutableRef
+        template<typename... Ts>
+        struct AnyMutableRef : std::false_type {};
+
+        template<typename T, typename... Ts>
+        struct AnyMutableRef<T,Ts...> :
+                std::integral_constant<
+                    bool,
+                    (std::is_lvalue_reference<T>::value &&
+                     !std::is_const<
+                        typename std::remove_reference<T>::type>::value) ||
+                    AnyMutableRef<Ts...>::value> {};
+
+        // IsCallableWith
+        // * true if an Fn can be called with arguments of
+        //   types Ts (ie an Fn that takes a T& can't be called
+        //   with a T const &)
+        template<typename Fn, typename... Ts>
+        struct IsCallableWith
+        {
+            template<typename F>
+            static auto test(int) ->
+                decltype(std::declval<F&>()(std::declval<Ts>()...),
+                         std::true_type());
+
+            template<typename F>
+            static std::false_type test(...);
+
+            using type = decltype(test<Fn>(0));
+        };
+
+        // IsMemberCallableWith
+        // * same as IsCallableWith for a member function
+        //   pointer MemFn of class T
+        template<typename T, typename MemFn, typename... Ts>
+        struct IsMemberCallableWith
+        {
+            template<typename F>
+            static auto test(int) ->
+                decltype((std::declval<T*>()->*std::declval<F>())(
+                             std::declval<Ts>()...),
+                         std::true_type());
+
+            template<typename F>
+            static std::false_type test(...);
+
+            using type = decltype(test<MemFn>(0));
+        };
+
     } // signal_detail
 
     // ============================================================= //
@@ -109,60 +188,359 @@ namespace ks
     template<typename... Args>
     class Signal final
     {
-        struct ManagedConnection
+        using SlotFunction = Function<void(Args const &...)>;
+
+        // * Queued slots run after Emit returns, so they get
+        //   copies of the arguments even if Args are references
+        using ArgsTuple = std::tuple<typename std::decay<Args>::type...>;
+        using SharedArgs = shared_ptr<ArgsTuple>;
+        using ArgsIndices =
+            typename signal_detail::MakeIndexSequence<
+                sizeof...(Args)>::type;
+
+        // * Queued slots copy small, trivially copyable arguments
+        //   (ie ints and pointers) into their event. Otherwise all
+        //   queued slots for an Emit share a single reference
+        //   counted snapshot of the arguments, which slots can only
+        //   read (they take Args const &)
+        // * Signals with non-const reference arguments always copy
+        //   them into each event, since a slot may modify them
+        using StoreArgsInline =
+            std::integral_constant<
+                bool,
+                ((sizeof(ArgsTuple) <= 4*sizeof(void*)) &&
+                 signal_detail::AllTriviallyCopyable<
+                    typename std::decay<Args>::type...>::value) ||
+                signal_detail::AnyMutableRef<Args...>::value>;
+
+        using QueuedArgs =
+            typename std::conditional<
+                StoreArgsInline::value,
+                ArgsTuple,
+                SharedArgs
+            >::type;
+
+        // Connection
+        // * Connections made without a context object are
+        //   unmanaged and are always invoked directly
+        struct Connection
         {
-            Id id;
-            ConnectionType type;
-            weak_ptr<Object> context;
-            std::function<void(Args&...)> fn;
+            Connection(Id id,
+                       ConnectionType type,
+                       shared_ptr<Object> const &context,
+                       SlotFunction fn) :
+                id(id),
+                type(context ? type : ConnectionType::Direct),
+                managed(context != nullptr),
+                context(context),
+                event_loop_id((context && context->GetEventLoop()) ?
+                              context->GetEventLoop()->GetId() : 0),
+                connected(true),
+                fn(std::move(fn))
+            {}
+
+            Id const id;
+            ConnectionType const type;
+            bool const managed;
+            weak_ptr<Object> const context;
+            Id const event_loop_id; // context's, only used as a key
+            std::atomic<bool> connected;
+            SlotFunction fn;
+        };
+
+        // ConnectionList
+        // * A dense array of connections that Emit iterates, and a
+        //   table that maps the slot in a connection id to the
+        //   connection's position in the array
+        // * Connect appends to the current list in place. Entries
+        //   past @size are never read, so a new connection is
+        //   written first and then published by bumping @size.
+        //   Once the list is full it's copied to a larger one that
+        //   replaces it. Emit reads whichever list was current when
+        //   it started and never takes m_connection_mutex
+        // * Disconnect only marks a connection as disconnected, so
+        //   it's O(1). Disconnected connections are left in place
+        //   until they make up half of the list, which is then
+        //   compacted into a new list
+        // * Queued connections are grouped by EventLoop so that
+        //   Emit can post one event per loop (see QueuedBatch). The
+        //   first connection in a group is the group's head. Groups
+        //   are keyed by EventLoop::GetId(), which isn't reused, and
+        //   a group is dropped once its last connection is
+        //   disconnected; later connections start a new group
+        struct ConnectionList
+        {
+            ConnectionList(u32 capacity,u32 slot_capacity) :
+                refs(1),
+                capacity(capacity),
+                slot_capacity(slot_capacity),
+                size(0),
+                disconnected(0),
+                has_queued(false),
+                connections(new shared_ptr<Connection>[capacity]),
+                group_head(new u32[capacity]),
+                group_last(new std::atomic<u32>[capacity]),
+                slots(new std::atomic<u32>[slot_capacity])
+            {
+                for(u32 i=0; i < slot_capacity; i++) {
+                    slots[i].store(s_no_position,std::memory_order_relaxed);
+                }
+            }
+
+            // * The signal holds one reference while the list is
+            //   current, and each Snapshot and QueuedBatch holds one
+            mutable std::atomic<uint> refs;
+
+            u32 const capacity;
+            u32 const slot_capacity;
+            std::atomic<u32> size;
+            u32 disconnected; // only used by writers
+            std::atomic<bool> has_queued;
+
+            unique_ptr<shared_ptr<Connection>[]> connections;
+
+            // * The position of the group head for each Queued
+            //   connection, and for each head, the position of the
+            //   last connection in its group
+            unique_ptr<u32[]> group_head;
+            unique_ptr<std::atomic<u32>[]> group_last;
+
+            // * The position of each slot's connection
+            unique_ptr<std::atomic<u32>[]> slots;
+        };
+
+        // QueuedGroup
+        // * The head position and number of connected Queued
+        //   connections for an EventLoop in the current list
+        struct QueuedGroup
+        {
+            Id event_loop_id;
+            u32 head;
+            u32 count;
+        };
+
+        static void unrefConnectionList(ConnectionList const * list)
+        {
+            if(list->refs.fetch_sub(1,std::memory_order_acq_rel) == 1) {
+                delete list;
+            }
+        }
+
+        // Snapshot
+        // * Pins the current ConnectionList so that it isn't
+        //   deleted while in use (see pinConnections)
+        class Snapshot
+        {
+        public:
+            Snapshot(Signal * signal) :
+                m_list(signal->pinConnections())
+            {
+                // empty
+            }
+
+            ~Snapshot()
+            {
+                unrefConnectionList(m_list);
+            }
+
+            ConnectionList const & operator * () const
+            {
+                return *m_list;
+            }
+
+        private:
+            ConnectionList const * m_list;
+        };
+
+        // QueuedSlot
+        // * Invokes a managed connection with the arguments it was
+        //   emitted with. Shares the connection instead of copying
+        //   its SlotFunction so that it fits within the inline
+        //   storage of an event's Function and doesn't allocate
+        class QueuedSlot
+        {
+        public:
+            QueuedSlot(shared_ptr<Connection> connection,
+                       QueuedArgs args) :
+                m_connection(std::move(connection)),
+                m_args(std::move(args))
+            {
+                // empty
+            }
+
+            void operator()()
+            {
+                invoke(ArgsIndices());
+            }
+
+            static ArgsTuple & getArgs(ArgsTuple &args)
+            {
+                return args;
+            }
+
+            static ArgsTuple & getArgs(SharedArgs const &args)
+            {
+                return *args;
+            }
+
+        private:
+            template<std::size_t... Is>
+            void invoke(signal_detail::IndexSequence<Is...>)
+            {
+                // Slots that were disconnected after being
+                // queued aren't invoked
+                if(m_connection->connected.load(std::memory_order_relaxed)) {
+                    ArgsTuple &args = getArgs(m_args);
+                    m_connection->fn(std::get<Is>(args)...);
+                }
+            }
+
+            shared_ptr<Connection> m_connection;
+            QueuedArgs m_args;
+        };
+
+        // QueuedBatch
+        // * Invokes the connected slots in the group with head
+        //   @head, between positions @first and @last, in order.
+        //   Keeps the ConnectionList the group belongs to alive
+        //   instead of copying the connections
+        class QueuedBatch
+        {
+        public:
+            QueuedBatch(ConnectionList const * list,
+                        u32 head,
+                        u32 first,
+                        u32 last,
+                        QueuedArgs args) :
+                m_list(list),
+                m_head(head),
+                m_first(first),
+                m_last(last),
+                m_args(std::move(args))
+            {
+                m_list->refs.fetch_add(1,std::memory_order_relaxed);
+            }
+
+            QueuedBatch(QueuedBatch && other) noexcept :
+                m_list(other.m_list),
+                m_head(other.m_head),
+                m_first(other.m_first),
+                m_last(other.m_last),
+                m_args(std::move(other.m_args))
+            {
+                other.m_list = nullptr;
+            }
+
+            QueuedBatch(QueuedBatch const &) = delete;
+
+            ~QueuedBatch()
+            {
+                if(m_list) {
+                    unrefConnectionList(m_list);
+                }
+            }
+
+            void operator()()
+            {
+                invoke(ArgsIndices());
+            }
+
+        private:
+            template<std::size_t... Is>
+            void invoke(signal_detail::IndexSequence<Is...>)
+            {
+                ArgsTuple &args = QueuedSlot::getArgs(m_args);
+                for(u32 i=m_first; i <= m_last; i++) {
+                    if(isInGroup(*m_list,i,m_head)) {
+                        m_list->connections[i]->fn(std::get<Is>(args)...);
+                    }
+                }
+            }
+
+            ConnectionList const * m_list;
+            u32 m_head;
+            u32 m_first;
+            u32 m_last;
+            QueuedArgs m_args;
         };
 
-        struct UnmanagedConnection
+        // BlockingSlot
+        // * Invokes a managed connection with references to the
+        //   emitted arguments; the emitting thread blocks until
+        //   the slot is invoked so the arguments stay valid
+        class BlockingSlot
         {
-            Id id;
-            std::function<void(Args&...)> fn;
+        public:
+            BlockingSlot(shared_ptr<Connection> connection,
+                         Args const &... args) :
+                m_connection(std::move(connection)),
+                m_args(args...)
+            {
+                // empty
+            }
+
+            void operator()()
+            {
+                invoke(ArgsIndices());
+            }
+
+        private:
+            template<std::size_t... Is>
+            void invoke(signal_detail::IndexSequence<Is...>)
+            {
+                m_connection->fn(std::get<Is>(m_args)...);
+            }
+
+            shared_ptr<Connection> m_connection;
+            std::tuple<Args const &...> m_args;
         };
 
     public:       
         Signal(unique_ptr<SignalMutex> connection_mutex=
                make_unique<DefaultSignalMutex>()) :
-            m_connection_mutex(std::move(connection_mutex))
-        {}
+            m_connection_mutex(std::move(connection_mutex)),
+            m_connections(new ConnectionList(s_min_capacity,s_min_capacity)),
+            m_epoch(0),
+            m_slot_count(0),
+            m_connection_count(0)
+        {
+            for(auto &pinning : m_pinning) {
+                pinning.store(0,std::memory_order_relaxed);
+            }
+        }
 
         ~Signal()
-        {}
+        {
+            unrefConnectionList(m_connections.load());
+        }
 
+        // * Slots are passed the emitted arguments by const
+        //   reference. Slots that take non-const references to
+        //   them (ie void(T&) for a Signal<T>) are passed their
+        //   own copy of the arguments instead
         template<typename FunctionType>
         Id Connect(FunctionType fn,
                    shared_ptr<Object> const &context=nullptr,
                    ConnectionType type=ConnectionType::Queued)
         {
-            std::lock_guard<SignalMutex> lock(*m_connection_mutex);
-            auto id = signal_detail::genId();
+            using ByRef =
+                typename signal_detail::IsCallableWith<
+                    FunctionType,Args const &...>::type;
 
             if(context) {
                 weak_ptr<Object> ctx(context);
-                m_list_managed_connections.emplace_back(
-                            ManagedConnection{
-                                id,
-                                type,
-                                ctx,
-                                [fn,ctx](Args&... args) {
-                                    auto is_alive = ctx.lock();
-                                    if(is_alive) {
-                                        fn(args...);
-                                    }
+                return connect(
+                            context,
+                            type,
+                            [fn,ctx](Args const &... args) {
+                                auto is_alive = ctx.lock();
+                                if(is_alive) {
+                                    callSlot(fn,ByRef(),args...);
                                 }
                             });
             }
-            else {
-                m_list_unmanaged_connections.emplace_back(
-                            UnmanagedConnection{
-                                id,fn
-                            });
-            }
 
-            return id;
+            return connect(nullptr,type,makeSlotFunction(std::move(fn),ByRef()));
         }
 
         // NOTE: Fn/SlotArgs is a separate template parameter
@@ -174,35 +552,29 @@ namespace ks
                    shared_ptr<Object> const &context=nullptr,
                    ConnectionType type=ConnectionType::Queued)
         {
-            std::lock_guard<SignalMutex> lock(*m_connection_mutex);
-            auto id = signal_detail::genId();
+            using ByRef =
+                typename signal_detail::IsMemberCallableWith<
+                    T,void(T::*)(FnArgs...),Args const &...>::type;
 
             if(context) {
                 weak_ptr<Object> ctx(context);
-                m_list_managed_connections.emplace_back(
-                            ManagedConnection{
-                                id,
-                                type,
-                                ctx,
-                                [object,memfn,ctx](Args&... args) {
-                                    auto is_alive = ctx.lock();
-                                    if(is_alive) {
-                                        (object->*memfn)(args...);
-                                    }
-                                }
-                            });
-            }
-            else {
-                m_list_unmanaged_connections.emplace_back(
-                            UnmanagedConnection{
-                                id,
-                                [object,memfn](Args&... args) {
-                                    (object->*memfn)(args...);
+                return connect(
+                            context,
+                            type,
+                            [object,memfn,ctx](Args const &... args) {
+                                auto is_alive = ctx.lock();
+                                if(is_alive) {
+                                    callMemberSlot(object,memfn,ByRef(),args...);
                                 }
                             });
             }
 
-            return id;
+            return connect(
+                        nullptr,
+                        type,
+                        [object,memfn](Args const &... args) {
+                            callMemberSlot(object,memfn,ByRef(),args...);
+                        });
         }
 
         template<typename T, typename... SlotArgs>
@@ -214,67 +586,298 @@ namespace ks
                           "KS: Signal::Connect(): "
                           "Type must be derived from ks::Object");
 
+            using ByRef =
+                typename signal_detail::IsMemberCallableWith<
+                    T,void(T::*)(SlotArgs...),Args const &...>::type;
+
             // Wrap the function in a lambda and save it along
             // with the receiver in the list of connections
-            std::lock_guard<SignalMutex> lock(*m_connection_mutex);
             weak_ptr<T> rcvr_weak_ptr(receiver);
 
-            auto id = signal_detail::genId();
-            m_list_managed_connections.emplace_back(
-                        ManagedConnection{
-                            id,
-                            type,
-                            receiver,               // receiver
-                            [rcvr_weak_ptr,slot]    // lambda to call slot
-                            (Args&... args) {
-                                auto rcvr = rcvr_weak_ptr.lock();
-                                if(rcvr) {
-                                    ((rcvr.get())->*slot)(args...);
-                                }
-                        }});
-
-            return id;
+            return connect(
+                        receiver,                   // receiver
+                        type,
+                        [rcvr_weak_ptr,slot]        // lambda to call slot
+                        (Args const &... args) {
+                            auto rcvr = rcvr_weak_ptr.lock();
+                            if(rcvr) {
+                                callMemberSlot(rcvr.get(),slot,ByRef(),args...);
+                            }
+                        });
         }
 
+        // * Slots that were queued before the connection
+        //   was disconnected won't be invoked
         bool Disconnect(Id connection_id)
         {
             std::lock_guard<SignalMutex> lock(*m_connection_mutex);
+            ConnectionList * list = m_connections.load();
 
-            auto managed_cnxn_it = findManagedConnection(connection_id);
-            if(managed_cnxn_it != m_list_managed_connections.end())
-            {
-                m_list_managed_connections.erase(managed_cnxn_it);
-                return true;
+            u32 const slot = slotOf(connection_id);
+            if(slot >= m_slot_count) {
+                return false;
             }
 
-            auto unmanaged_cnxn_it = findUnmanagedConnection(connection_id);
-            if(unmanaged_cnxn_it != m_list_unmanaged_connections.end())
-            {
-                m_list_unmanaged_connections.erase(unmanaged_cnxn_it);
-                return true;
+            // If the connection was already disconnected, its slot
+            // is either unused or belongs to another connection
+            u32 const position = list->slots[slot].load(std::memory_order_relaxed);
+            if((position == s_no_position) ||
+               (list->connections[position]->id != connection_id)) {
+                return false;
             }
 
-            return false;
+            disconnect(*list,position);
+            compactConnections(*list);
+            return true;
         }
 
+        // * Invokes or schedules each connected slot with @args
+        // * Slots are invoked or scheduled in the order they were
+        //   connected, whether or not they have a context object
+        //   (unmanaged slots are no longer invoked first)
+        // * Direct slots are passed references to @args. Queued
+        //   slots share a single copy of @args (see QueuedSlot)
+        // * Emit doesn't lock the signal, so it may be called
+        //   concurrently from several threads. Connections that
+        //   are made during an Emit aren't invoked by it
+        // * Throws EventLoopInactive if a Blocking slot's receiver
+        //   has an inactive event loop (see TryEmit)
+        // * A Blocking emit from a worker of a multi-worker loop
+        //   waits on another worker to run the receiver's Strand,
+        //   so it deadlocks if every worker is waiting
         void Emit(Args const &... args)
         {
-            // Go through each connection and post an event
-            // to invoke the slot with @args
+            throwOnError(TryEmit(args...));
+        }
+
+        // * Same as Emit, except that a Blocking slot whose receiver
+        //   has an inactive event loop is skipped and reported with
+        //   EventLoop::Status::Inactive instead of being thrown. The
+        //   remaining slots are still invoked
+        EventLoop::Status TryEmit(Args const &... args)
+        {
+            Snapshot connections(this);
+
+            SharedArgs shared_args;
+            return emit(*connections,shared_args,args...);
+        }
+
+        // * Same as Emit, except that @args are moved into the
+        //   copy that's shared with queued slots. If there are no
+        //   queued connections, @args are only passed by reference
+        void EmitMove(typename std::decay<Args>::type &&... args)
+        {
+            Snapshot connections(this);
+
+            SharedArgs shared_args;
+            if(!StoreArgsInline::value && (*connections).has_queued.load()) {
+                shared_args = make_shared<ArgsTuple>(std::move(args)...);
+                throwOnError(
+                            emitShared(*connections,shared_args,ArgsIndices()));
+                return;
+            }
+
+            throwOnError(emit(*connections,shared_args,args...));
+        }
+
+        bool ConnectionValid(Id connection_id)
+        {
+            Snapshot connections(this);
+            ConnectionList const &list = *connections;
+
+            u32 const slot = slotOf(connection_id);
+            if(slot >= list.slot_capacity) {
+                return false;
+            }
+
+            u32 const position = list.slots[slot].load(std::memory_order_acquire);
+            if(position >= list.size.load(std::memory_order_acquire)) {
+                return false;
+            }
 
+            auto const &connection = list.connections[position];
+            return ((connection->id == connection_id) &&
+                    connection->connected.load(std::memory_order_relaxed));
+        }
+
+        uint GetConnectionCount()
+        {
+            return m_connection_count.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // * Connection ids are [generation:32][slot+1:32]. The
+        //   generation comes from genId(), so an id isn't reused
+        //   when its slot is
+        static Id makeId(u32 slot)
+        {
+            return ((signal_detail::genId() << 32) | (Id(slot)+1));
+        }
+
+        static u32 slotOf(Id connection_id)
+        {
+            return (static_cast<u32>(connection_id)-1);
+        }
+
+        // * Slots that can't take @args by const reference
+        //   are passed copies of them (see Connect)
+        template<typename Fn>
+        static void callSlot(Fn &fn,
+                             std::true_type,
+                             Args const &... args)
+        {
+            fn(args...);
+        }
+
+        template<typename Fn>
+        static void callSlot(Fn &fn,
+                             std::false_type,
+                             typename std::decay<Args>::type... args)
+        {
+            fn(args...);
+        }
+
+        template<typename T, typename MemFn>
+        static void callMemberSlot(T * object,
+                                   MemFn memfn,
+                                   std::true_type,
+                                   Args const &... args)
+        {
+            (object->*memfn)(args...);
+        }
+
+        template<typename T, typename MemFn>
+        static void callMemberSlot(T * object,
+                                   MemFn memfn,
+                                   std::false_type,
+                                   typename std::decay<Args>::type... args)
+        {
+            (object->*memfn)(args...);
+        }
+
+        template<typename FunctionType>
+        static SlotFunction makeSlotFunction(FunctionType fn,std::true_type)
+        {
+            return SlotFunction(std::move(fn));
+        }
+
+        template<typename FunctionType>
+        static SlotFunction makeSlotFunction(FunctionType fn,std::false_type)
+        {
+            return SlotFunction(
+                        [fn](Args const &... args) mutable {
+                            callSlot(fn,std::false_type(),args...);
+                        });
+        }
+
+        static bool isInGroup(ConnectionList const &list,
+                              u32 position,
+                              u32 head)
+        {
+            // group_head is only set for Queued connections
+            auto const &connection = list.connections[position];
+            return ((connection->type == ConnectionType::Queued) &&
+                    (list.group_head[position] == head) &&
+                    connection->connected.load(std::memory_order_relaxed));
+        }
+
+        Id connect(shared_ptr<Object> const &context,
+                   ConnectionType type,
+                   SlotFunction fn)
+        {
             std::lock_guard<SignalMutex> lock(*m_connection_mutex);
 
-            // Invoke unmananged connections
-            for(auto& connection : m_list_unmanaged_connections)
-            {
-                directInvoke(args...,connection.fn);
+            u32 slot;
+            if(m_list_free_slots.empty()) {
+                slot = m_slot_count++;
             }
+            else {
+                slot = m_list_free_slots.back();
+                m_list_free_slots.pop_back();
+            }
+
+            ConnectionList * list = m_connections.load();
+            if((list->size.load(std::memory_order_relaxed) == list->capacity) ||
+               (slot >= list->slot_capacity)) {
+                list = rebuildConnections(*list);
+            }
+
+            auto id = makeId(slot);
+            u32 const position = list->size.load(std::memory_order_relaxed);
+            list->connections[position] =
+                    make_shared<Connection>(id,type,context,std::move(fn));
+
+            list->slots[slot].store(position,std::memory_order_release);
+            groupConnection(*list,position);
+
+            // Publish the connection to readers
+            list->size.store(position+1,std::memory_order_release);
+            m_connection_count.fetch_add(1,std::memory_order_relaxed);
 
-            // Invoke/Schedule managed connections
+            return id;
+        }
+
+        static void throwOnError(EventLoop::Status status)
+        {
+            if(status == EventLoop::Status::Inactive) {
+                KS_THROW(EventLoopInactive(
+                             "Signal: Attempted to emit a Blocking "
+                             "signal connected to a receiver with "
+                             "an inactive event loop"));
+            }
+        }
+
+        template<std::size_t... Is>
+        EventLoop::Status emitShared(ConnectionList const &connections,
+                                     SharedArgs &shared_args,
+                                     signal_detail::IndexSequence<Is...>)
+        {
+            return emit(connections,shared_args,std::get<Is>(*shared_args)...);
+        }
+
+        // * @shared_args is created the first time a queued
+        //   slot needs it, unless it's already set
+        EventLoop::Status emit(ConnectionList const &connections,
+                               SharedArgs &shared_args,
+                               Args const &... args)
+        {
+            // Go through each connection and post an event
+            // to invoke the slot with @args
+            EventLoop::Status status = EventLoop::Status::Ok;
             uint expired_count=0;
-            for(auto& connection : m_list_managed_connections)
+            u32 const size = connections.size.load(std::memory_order_acquire);
+            for(u32 i=0; i < size; i++)
             {
-                auto context = connection.context.lock();
+                auto const &connection = connections.connections[i];
+                bool const connected =
+                        connection->connected.load(std::memory_order_relaxed);
+
+                if(connection->type == ConnectionType::Queued)
+                {
+                    // The group head posts the slots for its whole
+                    // group, even if it was disconnected itself
+                    if(connections.group_head[i] == i) {
+                        postQueuedGroup(connections,i,size,shared_args,args...);
+                    }
+
+                    if(connected && connection->context.expired()) {
+                        expired_count++;
+                    }
+                    continue;
+                }
+
+                if(!connected)
+                {
+                    continue;
+                }
+
+                if(!connection->managed)
+                {
+                    connection->fn(args...);
+                    continue;
+                }
+
+                auto context = connection->context.lock();
 
                 if(context==nullptr)
                 {
@@ -284,17 +887,9 @@ namespace ks
                     continue;
                 }
 
-                if(connection.type == ConnectionType::Direct)
+                if(connection->type == ConnectionType::Direct)
                 {
-                    directInvoke(args...,connection.fn);
-                }
-                else if(connection.type == ConnectionType::Queued)
-                {
-                    // Post the slot to the receivers thread
-                    unique_ptr<Event> event(new SlotEvent(
-                        std::bind(connection.fn,args...)));
-
-                    context->GetEventLoop()->PostEvent(std::move(event));
+                    connection->fn(args...);
                 }
                 else // ConnectionType::Blocking
                 {
@@ -313,14 +908,12 @@ namespace ks
                                                       evl_running);
 
                     if(!evl_started) {
-                        // TODO: Add a test for this case
-                        throw EventLoopInactive(
-                                    "Signal: Attempted to emit a Blocking "
-                                    "signal connected to a receiver with "
-                                    "an inactive event loop");
+                        status = EventLoop::Status::Inactive;
+                        continue;
                     }
 
-                    if(evl_thread_id == std::this_thread::get_id()) {
+                    if(context->GetEventLoop()->IsRunningInStrand(
+                           context->GetStrand())) {
                         // TODO:
                         // We could potentially process any queued events
                         // here first before invoking the slot:
@@ -336,7 +929,13 @@ namespace ks
                         //   multiple levels of recursion
 
                         // invoke this slot directly
-                        directInvoke(args...,connection.fn);
+
+                        // NOTE: On a multi-worker loop this is only
+                        // done from within the receiver's Strand;
+                        // other workers post through the Strand and
+                        // wait like any other thread so that the
+                        // receiver's slots are still serialized
+                        connection->fn(args...);
                     }
                     else {
                         // post the slot to the receivers thread
@@ -345,14 +944,26 @@ namespace ks
                         std::mutex invoked_mutex;
                         std::condition_variable invoked_cv;
 
-                        unique_ptr<Event> event(new BlockingSlotEvent(
-                            std::bind(connection.fn,args...),
-                            &invoked,
-                            &invoked_mutex,
-                            &invoked_cv));
+                        auto& event_loop = context->GetEventLoop();
+
+                        unique_ptr<Event> event(
+                                    event_loop->template MakeEvent<BlockingSlotEvent>(
+                                        BlockingSlot(connection,args...),
+                                        &invoked,
+                                        &invoked_mutex,
+                                        &invoked_cv));
 
+                        // The event loop may have been stopped
+                        // since it was checked above, in which
+                        // case the slot would never be invoked
                         std::unique_lock<std::mutex> invoked_lock(invoked_mutex);
-                        context->GetEventLoop()->PostEvent(std::move(event));
+                        if(event_loop->TryPostEvent(
+                                   std::move(event),
+                                   context->GetStrand()) !=
+                           EventLoop::Status::Ok) {
+                            status = EventLoop::Status::Inactive;
+                            continue;
+                        }
 
                         while(!invoked) {
                             invoked_cv.wait(invoked_lock);
@@ -363,81 +974,305 @@ namespace ks
 
             // Remove any expired connections
             if(expired_count > 0) {
-                auto remove_begin = std::remove_if(
-                            m_list_managed_connections.begin(),
-                            m_list_managed_connections.end(),
-                            [](ManagedConnection const &connection) {
-                                return (connection.context.expired());
-                            });
-
-                m_list_managed_connections.erase(
-                            remove_begin,
-                            m_list_managed_connections.end());
+                removeExpiredConnections();
             }
+
+            return status;
         }
 
-        bool ConnectionValid(Id connection_id)
+        void postQueuedGroup(ConnectionList const &connections,
+                             u32 head,
+                             u32 size,
+                             SharedArgs &shared_args,
+                             Args const &... args)
         {
-            std::lock_guard<SignalMutex> lock(*m_connection_mutex);
+            // Connections added to the group after this
+            // Emit started aren't included
+            u32 const last = std::min(
+                        connections.group_last[head].load(
+                            std::memory_order_acquire),
+                        size-1);
+
+            // Find the first receiver in the group that's still
+            // alive to get the group's EventLoop from
+            u32 first = head;
+            shared_ptr<Object> context;
+            for(; first <= last; first++) {
+                if(isInGroup(connections,first,head)) {
+                    context = connections.connections[first]->context.lock();
+                    if(context) {
+                        break;
+                    }
+                }
+            }
 
-            auto managed_cnxn_it = findManagedConnection(connection_id);
-            if(managed_cnxn_it == m_list_managed_connections.end())
+            if(!context) {
+                return;
+            }
+
+            auto& event_loop = context->GetEventLoop();
+
+            // Slots for receivers on a multi-worker EventLoop have
+            // to be posted to each receiver's strand separately
+            if((first < last) && (event_loop->GetWorkerCount() < 2))
             {
-                auto unmanaged_cnxn_it = findUnmanagedConnection(connection_id);
-                if(unmanaged_cnxn_it == m_list_unmanaged_connections.end())
-                {
-                    return false;
+                unique_ptr<Event> event(
+                            event_loop->template MakeEvent<SlotEvent>(
+                                QueuedBatch(
+                                    &connections,
+                                    head,
+                                    first,
+                                    last,
+                                    queuedArgs(shared_args,
+                                               StoreArgsInline(),
+                                               args...))));
+
+                event_loop->PostEvent(std::move(event));
+                return;
+            }
+
+            for(u32 i=first; i <= last; i++)
+            {
+                if(!isInGroup(connections,i,head)) {
+                    continue;
                 }
+
+                auto const &connection = connections.connections[i];
+                if(i != first) {
+                    context = connection->context.lock();
+                    if(!context) {
+                        continue;
+                    }
+                }
+
+                // Post the slot to the receivers thread
+                unique_ptr<Event> event(
+                            event_loop->template MakeEvent<SlotEvent>(
+                                QueuedSlot(
+                                    connection,
+                                    queuedArgs(shared_args,
+                                               StoreArgsInline(),
+                                               args...))));
+
+                event_loop->PostEvent(
+                            std::move(event),
+                            context->GetStrand());
             }
+        }
 
-            return true;
+        ArgsTuple queuedArgs(SharedArgs &,
+                             std::true_type,
+                             Args const &... args)
+        {
+            return ArgsTuple(args...);
         }
 
-        uint GetConnectionCount()
+        SharedArgs const & queuedArgs(SharedArgs &shared_args,
+                                      std::false_type,
+                                      Args const &... args)
+        {
+            if(!shared_args) {
+                shared_args = make_shared<ArgsTuple>(args...);
+            }
+            return shared_args;
+        }
+
+        void removeExpiredConnections()
         {
             std::lock_guard<SignalMutex> lock(*m_connection_mutex);
-            return m_list_managed_connections.size()+
-                   m_list_unmanaged_connections.size();
+
+            // The list may have changed since it was read by Emit,
+            // so check the current one
+            ConnectionList * list = m_connections.load();
+            u32 const size = list->size.load(std::memory_order_relaxed);
+            for(u32 i=0; i < size; i++) {
+                auto const &connection = list->connections[i];
+                if(connection->managed &&
+                   connection->connected.load(std::memory_order_relaxed) &&
+                   connection->context.expired()) {
+                    disconnect(*list,i);
+                }
+            }
+
+            compactConnections(*list);
         }
 
-    private:
-        void directInvoke(Args... args,std::function<void(Args&...)> &fn)
+        // * Expects m_connection_mutex to be locked
+        void disconnect(ConnectionList &list,u32 position)
         {
-            fn(args...);
+            auto const &connection = list.connections[position];
+            connection->connected.store(false,std::memory_order_relaxed);
+
+            if(connection->type == ConnectionType::Queued) {
+                auto group_it = findQueuedGroup(connection->event_loop_id);
+                if(group_it != m_list_queued_groups.end()) {
+                    group_it->count--;
+                    if(group_it->count == 0) {
+                        m_list_queued_groups.erase(group_it);
+                    }
+                }
+            }
+
+            u32 const slot = slotOf(connection->id);
+            list.slots[slot].store(s_no_position,std::memory_order_relaxed);
+            m_list_free_slots.push_back(slot);
+
+            list.disconnected++;
+            m_connection_count.fetch_sub(1,std::memory_order_relaxed);
         }
 
-        typename std::vector<ManagedConnection>::iterator
-        findManagedConnection(Id connection_id)
+        // * Expects m_connection_mutex to be locked
+        void compactConnections(ConnectionList &list)
         {
-            auto connection_it = std::find_if(
-                        m_list_managed_connections.begin(),
-                        m_list_managed_connections.end(),
-                        [connection_id]
-                        (ManagedConnection const &connection) {
-                            return (connection.id == connection_id);
-                        });
+            if((list.disconnected >= s_min_capacity) &&
+               (2*list.disconnected >= list.size.load(std::memory_order_relaxed))) {
+                rebuildConnections(list);
+            }
+        }
+
+        // * Expects m_connection_mutex to be locked
+        // * Adds the connection at @position to its queued group
+        void groupConnection(ConnectionList &list,u32 position)
+        {
+            auto const &connection = list.connections[position];
+            if(connection->type != ConnectionType::Queued) {
+                list.group_head[position] = s_no_position;
+                return;
+            }
+
+            auto group_it = findQueuedGroup(connection->event_loop_id);
+            if(group_it == m_list_queued_groups.end()) {
+                m_list_queued_groups.push_back(
+                            QueuedGroup{connection->event_loop_id,position,1});
 
-            return connection_it;
+                list.group_head[position] = position;
+                list.group_last[position].store(position,std::memory_order_relaxed);
+                list.has_queued.store(true,std::memory_order_relaxed);
+            }
+            else {
+                group_it->count++;
+                list.group_head[position] = group_it->head;
+                list.group_last[group_it->head].store(
+                            position,std::memory_order_release);
+            }
         }
 
-        typename std::vector<UnmanagedConnection>::iterator
-        findUnmanagedConnection(Id connection_id)
+        // * Expects m_connection_mutex to be locked
+        typename std::vector<QueuedGroup>::iterator
+        findQueuedGroup(Id event_loop_id)
         {
-            auto connection_it = std::find_if(
-                        m_list_unmanaged_connections.begin(),
-                        m_list_unmanaged_connections.end(),
-                        [connection_id]
-                        (UnmanagedConnection const &connection) {
-                            return (connection.id == connection_id);
+            return std::find_if(
+                        m_list_queued_groups.begin(),
+                        m_list_queued_groups.end(),
+                        [event_loop_id](QueuedGroup const &group) {
+                            return (group.event_loop_id == event_loop_id);
                         });
+        }
+
+        // * Expects m_connection_mutex to be locked
+        // * Copies the connected connections in @list to a new
+        //   list with room to grow, and publishes it
+        ConnectionList * rebuildConnections(ConnectionList const &list)
+        {
+            u32 const size = list.size.load(std::memory_order_relaxed);
+            u32 const count = size-list.disconnected;
+
+            u32 capacity = 2*(count+1);
+            if(capacity < s_min_capacity) {
+                capacity = s_min_capacity;
+            }
+
+            u32 slot_capacity = 2*m_slot_count;
+            if(slot_capacity < s_min_capacity) {
+                slot_capacity = s_min_capacity;
+            }
+
+            ConnectionList * rebuilt =
+                    new ConnectionList(capacity,slot_capacity);
+
+            m_list_queued_groups.clear();
+
+            u32 position=0;
+            for(u32 i=0; i < size; i++) {
+                auto const &connection = list.connections[i];
+                if(!connection->connected.load(std::memory_order_relaxed)) {
+                    continue;
+                }
+
+                rebuilt->connections[position] = connection;
+                rebuilt->slots[slotOf(connection->id)].store(
+                            position,std::memory_order_relaxed);
+
+                groupConnection(*rebuilt,position);
+                position++;
+            }
+
+            rebuilt->size.store(position,std::memory_order_relaxed);
+            publishConnections(rebuilt);
 
-            return connection_it;
+            return rebuilt;
         }
 
+        // * Returns the current ConnectionList with a
+        //   reference added for the caller
+        // * Readers are only counted in m_pinning between loading
+        //   the list and adding the reference, so a writer never
+        //   waits on an Emit that's in progress. A reader counts
+        //   itself in the current epoch and retries if the epoch
+        //   changed before it was counted
+        ConnectionList const * pinConnections()
+        {
+            while(true) {
+                uint const epoch = m_epoch.load();
+                m_pinning[epoch].fetch_add(1);
+
+                if(m_epoch.load() == epoch) {
+                    ConnectionList const * list = m_connections.load();
+                    list->refs.fetch_add(1,std::memory_order_relaxed);
+                    m_pinning[epoch].fetch_sub(1);
+                    return list;
+                }
+
+                m_pinning[epoch].fetch_sub(1);
+            }
+        }
+
+        // * Expects m_connection_mutex to be locked
+        // * Replaces the current ConnectionList with @list and
+        //   drops the signal's reference to the previous list,
+        //   which is deleted once every Snapshot and QueuedBatch
+        //   that pinned it is done
+        void publishConnections(ConnectionList * list)
+        {
+            ConnectionList * prev = m_connections.exchange(list);
+
+            // Readers that are counted in the new epoch can only
+            // load @list, so only wait for the previous epoch's
+            // readers to finish pinning
+            uint const epoch = m_epoch.load(std::memory_order_relaxed);
+            m_epoch.store(epoch^1);
+            while(m_pinning[epoch].load() != 0) {
+                std::this_thread::yield();
+            }
+
+            unrefConnectionList(prev);
+        }
+
+        static u32 const s_min_capacity = 8;
+        static u32 const s_no_position = 0xFFFFFFFF;
+
         // Connections
         unique_ptr<SignalMutex> m_connection_mutex;
-        std::vector<ManagedConnection> m_list_managed_connections;
-        std::vector<UnmanagedConnection> m_list_unmanaged_connections;
+        std::atomic<ConnectionList*> m_connections;
+        std::atomic<uint> m_epoch; // only changed by writers
+        std::atomic<uint> m_pinning[2];
+
+        // Writer state, guarded by m_connection_mutex
+        u32 m_slot_count;
+        std::vector<u32> m_list_free_slots;
+        std::vector<QueuedGroup> m_list_queued_groups;
+
+        std::atomic<uint> m_connection_count;
     };
 
     // ============================================================= //
@@ -23,7 +23,8 @@ namespace ks
         Object(key,event_loop),
         m_interval_ms(0),
         m_repeating(false),
-        m_active(false)
+        m_active(false),
+        m_wheel_entry(s_no_wheel_entry)
     {
 
     }
@@ -74,7 +75,8 @@ namespace ks
     {
         unique_ptr<Event> timer_event =
                 make_unique<StopTimerEvent>(
-                    this->GetId());
+                    this->GetId(),
+                    this);
 
         this->GetEventLoop()->PostEvent(
                     std::move(timer_event));
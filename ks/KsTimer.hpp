@@ -29,6 +29,7 @@ namespace ks
     class Timer : public ks::Object
     {
         friend class TimeoutHandler;
+        friend class TimerWheel;
         friend class EventLoop;
 
     public:
@@ -56,9 +57,15 @@ namespace ks
         Signal<> signal_timeout;
 
     private:
+        static u32 const s_no_wheel_entry = 0xFFFFFFFF;
+
         Milliseconds m_interval_ms;
         bool m_repeating;
         std::atomic<bool> m_active;
+
+        // The index of this timer's entry in its loop's TimerWheel,
+        // guarded by the wheel (see EventLoop::TimerType::Wheel)
+        u32 m_wheel_entry;
     };
 
 } // ks
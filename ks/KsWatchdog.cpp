@@ -0,0 +1,170 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <algorithm>
+
+#include <ks/KsLog.hpp>
+#include <ks/KsWatchdog.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    Watchdog::Config::Config() :
+        budget(100),
+        interval(25)
+    {
+        // empty
+    }
+
+    Watchdog::Watchdog(Config config) :
+        m_config(std::move(config)),
+        m_stopping(false)
+    {
+        m_thread = std::thread(&Watchdog::run,this);
+    }
+
+    Watchdog::~Watchdog()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_cv.notify_all();
+        }
+
+        m_thread.join();
+
+        for(auto& weak_loop : m_list_loops) {
+            if(auto event_loop = weak_loop.lock()) {
+                event_loop->stopWatch();
+            }
+        }
+    }
+
+    void Watchdog::Add(shared_ptr<EventLoop> const &event_loop)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto& weak_loop : m_list_loops) {
+            if(weak_loop.lock() == event_loop) {
+                return;
+            }
+        }
+
+        m_list_loops.push_back(event_loop);
+        event_loop->startWatch();
+    }
+
+    void Watchdog::Remove(shared_ptr<EventLoop> const &event_loop)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::find_if(
+                    m_list_loops.begin(),
+                    m_list_loops.end(),
+                    [&event_loop](weak_ptr<EventLoop> const &weak_loop) {
+                        return (weak_loop.lock() == event_loop);
+                    });
+
+        if(it != m_list_loops.end()) {
+            m_list_loops.erase(it);
+            event_loop->stopWatch();
+        }
+    }
+
+    char const * Watchdog::GetHandlerTypeName(EventLoop::HandlerType type)
+    {
+        switch(type) {
+        case EventLoop::HandlerType::Slot: return "Slot";
+        case EventLoop::HandlerType::BlockingSlot: return "BlockingSlot";
+        case EventLoop::HandlerType::Timeout: return "Timeout";
+        case EventLoop::HandlerType::Task: return "Task";
+        }
+        return "";
+    }
+
+    void Watchdog::run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(!m_stopping) {
+            m_cv.wait_for(lock,m_config.interval);
+            if(m_stopping) {
+                break;
+            }
+
+            lock.unlock();
+            this->check();
+            lock.lock();
+        }
+    }
+
+    void Watchdog::check()
+    {
+        std::vector<shared_ptr<EventLoop>> list_loops;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // Forget loops that have been destroyed
+            m_list_loops.erase(
+                        std::remove_if(
+                            m_list_loops.begin(),
+                            m_list_loops.end(),
+                            [](weak_ptr<EventLoop> const &weak_loop) {
+                                return weak_loop.expired();
+                            }),
+                        m_list_loops.end());
+
+            for(auto& weak_loop : m_list_loops) {
+                if(auto event_loop = weak_loop.lock()) {
+                    list_loops.push_back(std::move(event_loop));
+                }
+            }
+        }
+
+        u64 const budget_ns =
+                std::chrono::duration_cast<
+                    std::chrono::nanoseconds>(m_config.budget).count();
+
+        std::vector<std::pair<EventLoop::HandlerType,u64>> list_stalls;
+        for(auto& event_loop : list_loops) {
+            list_stalls.clear();
+            event_loop->checkHandlers(budget_ns,list_stalls);
+
+            for(auto const &type_elapsed : list_stalls) {
+                Stall const stall{
+                    event_loop->GetId(),
+                    type_elapsed.first,
+                    std::chrono::duration_cast<Microseconds>(
+                        std::chrono::nanoseconds(type_elapsed.second))
+                };
+
+                if(m_config.on_stall) {
+                    m_config.on_stall(stall);
+                    continue;
+                }
+
+                KS_LOG_WARN(LOG) << "Watchdog: EventLoop " << stall.loop_id
+                                 << ": " << GetHandlerTypeName(stall.type)
+                                 << " handler has been running for "
+                                 << stall.elapsed.count()/1000 << "ms"
+                                 << " (budget " << m_config.budget.count()
+                                 << "ms)";
+            }
+        }
+    }
+
+    // ============================================================= //
+
+} // ks
@@ -0,0 +1,101 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef KS_WATCHDOG_HPP
+#define KS_WATCHDOG_HPP
+
+#include <functional>
+
+#include <ks/KsEventLoop.hpp>
+
+namespace ks
+{
+    // ============================================================= //
+
+    // Watchdog
+    // * Reports handlers (slots, timer timeouts and tasks) that
+    //   run on an EventLoop for longer than a budget. A handler
+    //   that blocks stalls every other event on its loop
+    // * Has its own thread that checks each loop every
+    //   Config::interval. A stalled handler is reported once
+    //   while it's still running, to Config::on_stall or as
+    //   a warning to ks::LOG
+    // * A watched loop stores a timestamp when each handler
+    //   starts and ends. Run picks up loops that are added
+    //   while it's running; ProcessEvents only publishes
+    //   handlers if its loop was already being watched
+    class Watchdog final
+    {
+    public:
+        struct Stall
+        {
+            Id loop_id;
+            EventLoop::HandlerType type;
+
+            // * How long the handler had been running
+            //   when the stall was detected
+            Microseconds elapsed;
+        };
+
+        struct Config
+        {
+            Config();
+
+            // * Handlers that run for longer are reported
+            Milliseconds budget;
+
+            // * How often loops are checked; a stall is
+            //   reported up to @interval after the handler
+            //   exceeds the budget
+            Milliseconds interval;
+
+            // * Called on the watchdog thread for each stall
+            //   instead of logging it. Must not Add or Remove
+            //   loops
+            std::function<void(Stall const &)> on_stall;
+        };
+
+        Watchdog(Config config);
+        ~Watchdog();
+
+        // * Watches @event_loop until it's removed or
+        //   destroyed. Adding a loop twice has no effect
+        void Add(shared_ptr<EventLoop> const &event_loop);
+
+        void Remove(shared_ptr<EventLoop> const &event_loop);
+
+        static char const * GetHandlerTypeName(EventLoop::HandlerType type);
+
+    private:
+        void run();
+        void check();
+
+        Config const m_config;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_stopping;
+        std::vector<weak_ptr<EventLoop>> m_list_loops;
+
+        std::thread m_thread;
+    };
+
+    // ============================================================= //
+
+} // ks
+
+#endif // KS_WATCHDOG_HPP
@@ -0,0 +1,447 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+#include <ks/bench/KsBench.hpp>
+
+namespace ks
+{
+    namespace bench
+    {
+        namespace
+        {
+            u64 const max_iterations = 1000000000;
+
+            u64 percentile(std::vector<u64> const &list_sorted,double p)
+            {
+                u64 const count = list_sorted.size();
+                u64 index = static_cast<u64>(std::ceil(p*count));
+                index = std::max<u64>(index,1)-1;
+                return list_sorted[std::min(index,count-1)];
+            }
+
+            std::string escapeJson(std::string const &str)
+            {
+                std::string escaped;
+                for(char c : str) {
+                    if((c == '"') || (c == '\\')) {
+                        escaped.push_back('\\');
+                    }
+                    escaped.push_back(c);
+                }
+                return escaped;
+            }
+
+            // * Returns the value of "--@name=value" or
+            //   nullptr if @arg is a different option
+            char const * getOption(char const * arg,char const * name)
+            {
+                std::size_t const length = std::strlen(name);
+                if((std::strncmp(arg,name,length) == 0) &&
+                   (arg[length] == '=')) {
+                    return arg+length+1;
+                }
+                return nullptr;
+            }
+        }
+
+        // ============================================================= //
+
+        State::State(u64 iterations) :
+            m_iterations(iterations),
+            m_item_count(iterations),
+            m_timing(false),
+            m_elapsed(Clock::duration::zero())
+        {
+            // empty
+        }
+
+        u64 State::GetIterations() const
+        {
+            return m_iterations;
+        }
+
+        void State::PauseTiming()
+        {
+            if(m_timing) {
+                m_elapsed += (Clock::now()-m_start);
+                m_timing = false;
+            }
+        }
+
+        void State::ResumeTiming()
+        {
+            if(!m_timing) {
+                m_timing = true;
+                m_start = Clock::now();
+            }
+        }
+
+        void State::SetItemCount(u64 item_count)
+        {
+            m_item_count = item_count;
+        }
+
+        void State::AddLatency(u64 latency_ns)
+        {
+            m_list_latencies.push_back(latency_ns);
+        }
+
+        void State::AddLatency(Clock::duration latency)
+        {
+            m_list_latencies.push_back(
+                        std::chrono::duration_cast<
+                            std::chrono::nanoseconds>(latency).count());
+        }
+
+        void State::ReserveLatencies(u64 count)
+        {
+            m_list_latencies.reserve(count);
+        }
+
+        u64 State::GetElapsedNs() const
+        {
+            return std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(m_elapsed).count();
+        }
+
+        u64 State::GetItemCount() const
+        {
+            return m_item_count;
+        }
+
+        std::vector<u64> & State::GetLatencies()
+        {
+            return m_list_latencies;
+        }
+
+        // ============================================================= //
+
+        Runner::Config::Config() :
+            format(Format::Text),
+            min_time(200),
+            repetitions(1),
+            rate(100000)
+        {
+            // empty
+        }
+
+        Runner::Runner() :
+            m_list_only(false)
+        {
+            // empty
+        }
+
+        void Runner::Add(std::string name,
+                         Function<void(State&)> fn,
+                         u64 fixed_iterations)
+        {
+            m_list_benchmarks.push_back(
+                        Benchmark{
+                            std::move(name),
+                            std::move(fn),
+                            fixed_iterations});
+        }
+
+        bool Runner::ParseArgs(int argc,char* argv[])
+        {
+            for(int i=1; i < argc; i++) {
+                char const * arg = argv[i];
+                char const * value = nullptr;
+
+                if(std::strcmp(arg,"--list") == 0) {
+                    m_list_only = true;
+                }
+                else if((value = getOption(arg,"--format"))) {
+                    if(std::strcmp(value,"text") == 0) {
+                        m_config.format = Format::Text;
+                    }
+                    else if(std::strcmp(value,"json") == 0) {
+                        m_config.format = Format::Json;
+                    }
+                    else if(std::strcmp(value,"csv") == 0) {
+                        m_config.format = Format::Csv;
+                    }
+                    else {
+                        return false;
+                    }
+                }
+                else if((value = getOption(arg,"--filter"))) {
+                    m_config.filter = value;
+                }
+                else if((value = getOption(arg,"--min-time"))) {
+                    m_config.min_time = Milliseconds(std::atoi(value));
+                }
+                else if((value = getOption(arg,"--repetitions"))) {
+                    m_config.repetitions =
+                            static_cast<uint>(std::max(std::atoi(value),1));
+                }
+                else if((value = getOption(arg,"--rate"))) {
+                    m_config.rate = std::max(std::atof(value),1.0);
+                }
+                else if((value = getOption(arg,"--out"))) {
+                    m_output_path = value;
+                }
+                else {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        Runner::Config & Runner::GetConfig()
+        {
+            return m_config;
+        }
+
+        Runner::Config const & Runner::GetConfig() const
+        {
+            return m_config;
+        }
+
+        std::string const & Runner::GetOutputPath() const
+        {
+            return m_output_path;
+        }
+
+        bool Runner::GetListOnly() const
+        {
+            return m_list_only;
+        }
+
+        std::vector<Result> Runner::Run()
+        {
+            std::vector<Result> list_results;
+            for(auto& benchmark : m_list_benchmarks) {
+                if(benchmark.name.find(m_config.filter) == std::string::npos) {
+                    continue;
+                }
+                list_results.push_back(run(benchmark));
+            }
+
+            return list_results;
+        }
+
+        void Runner::List(std::ostream &out) const
+        {
+            for(auto const &benchmark : m_list_benchmarks) {
+                out << benchmark.name << "\n";
+            }
+        }
+
+        void Runner::Write(std::vector<Result> const &list_results,
+                           std::ostream &out) const
+        {
+            std::streamsize const precision = out.precision(9);
+
+            if(m_config.format == Format::Json) {
+                out << "{\n"
+                    << "  \"context\": {\n"
+                    << "    \"hardware_concurrency\": "
+                    << std::thread::hardware_concurrency() << ",\n"
+#ifdef NDEBUG
+                    << "    \"build\": \"release\",\n"
+#else
+                    << "    \"build\": \"debug\",\n"
+#endif
+                    << "    \"min_time_ms\": "
+                    << m_config.min_time.count() << ",\n"
+                    << "    \"repetitions\": "
+                    << m_config.repetitions << ",\n"
+                    << "    \"rate\": "
+                    << m_config.rate << "\n"
+                    << "  },\n"
+                    << "  \"benchmarks\": [";
+
+                for(std::size_t i=0; i < list_results.size(); i++) {
+                    Result const &result = list_results[i];
+                    out << ((i == 0) ? "\n" : ",\n")
+                        << "    {\n"
+                        << "      \"name\": \""
+                        << escapeJson(result.name) << "\",\n"
+                        << "      \"iterations\": "
+                        << result.iterations << ",\n"
+                        << "      \"items\": "
+                        << result.item_count << ",\n"
+                        << "      \"ns_per_item\": "
+                        << result.ns_per_item << ",\n"
+                        << "      \"items_per_sec\": "
+                        << result.items_per_sec;
+
+                    if(result.latency_count > 0) {
+                        out << ",\n"
+                            << "      \"latency_count\": "
+                            << result.latency_count << ",\n"
+                            << "      \"latency_p50_ns\": "
+                            << result.latency_p50 << ",\n"
+                            << "      \"latency_p99_ns\": "
+                            << result.latency_p99 << ",\n"
+                            << "      \"latency_p999_ns\": "
+                            << result.latency_p999 << ",\n"
+                            << "      \"latency_max_ns\": "
+                            << result.latency_max;
+                    }
+                    out << "\n    }";
+                }
+                out << "\n  ]\n}\n";
+            }
+            else if(m_config.format == Format::Csv) {
+                out << "name,iterations,items,ns_per_item,items_per_sec,"
+                       "latency_count,latency_p50_ns,latency_p99_ns,"
+                       "latency_p999_ns,latency_max_ns\n";
+
+                for(auto const &result : list_results) {
+                    out << result.name << ","
+                        << result.iterations << ","
+                        << result.item_count << ","
+                        << result.ns_per_item << ","
+                        << result.items_per_sec << ","
+                        << result.latency_count << ","
+                        << result.latency_p50 << ","
+                        << result.latency_p99 << ","
+                        << result.latency_p999 << ","
+                        << result.latency_max << "\n";
+                }
+            }
+            else {
+                std::size_t name_width = 4;
+                for(auto const &result : list_results) {
+                    name_width = std::max(name_width,result.name.size());
+                }
+
+                out << std::left << std::setw(name_width+2) << "name"
+                    << std::right
+                    << std::setw(12) << "iterations"
+                    << std::setw(14) << "ns/item"
+                    << std::setw(14) << "items/s"
+                    << std::setw(12) << "p50 ns"
+                    << std::setw(12) << "p99 ns"
+                    << std::setw(12) << "p99.9 ns"
+                    << std::setw(12) << "max ns" << "\n";
+
+                out << std::fixed << std::setprecision(1);
+                for(auto const &result : list_results) {
+                    out << std::left << std::setw(name_width+2) << result.name
+                        << std::right
+                        << std::setw(12) << result.iterations
+                        << std::setw(14) << result.ns_per_item
+                        << std::setw(14) << result.items_per_sec;
+
+                    if(result.latency_count > 0) {
+                        out << std::setw(12) << result.latency_p50
+                            << std::setw(12) << result.latency_p99
+                            << std::setw(12) << result.latency_p999
+                            << std::setw(12) << result.latency_max;
+                    }
+                    out << "\n";
+                }
+                out.unsetf(std::ios::floatfield);
+            }
+
+            out.precision(precision);
+        }
+
+        Result Runner::run(Benchmark &benchmark)
+        {
+            auto run_once = [&benchmark](u64 iterations) {
+                State state(iterations);
+                state.ResumeTiming();
+                benchmark.fn(state);
+                state.PauseTiming();
+                return state;
+            };
+
+            u64 const min_time_ns =
+                    std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(
+                        m_config.min_time).count();
+
+            // Calibrate
+            u64 iterations = benchmark.fixed_iterations;
+            State best(0);
+
+            if(iterations > 0) {
+                best = run_once(iterations);
+            }
+            else {
+                iterations = 1;
+                while(true) {
+                    best = run_once(iterations);
+                    u64 const elapsed_ns = std::max<u64>(best.GetElapsedNs(),1);
+                    if((elapsed_ns >= min_time_ns) ||
+                       (iterations >= max_iterations)) {
+                        break;
+                    }
+
+                    // Aim past min_time so the next run is
+                    // likely to be the last one
+                    double const estimate =
+                            iterations*1.2*min_time_ns/elapsed_ns;
+
+                    iterations = static_cast<u64>(
+                                std::min(std::max(estimate,iterations*2.0),
+                                         iterations*100.0));
+
+                    iterations = std::min(iterations,max_iterations);
+                }
+            }
+
+            // Report the fastest repetition
+            for(uint i=1; i < m_config.repetitions; i++) {
+                State state = run_once(iterations);
+                if(state.GetElapsedNs()*best.GetItemCount() <
+                   best.GetElapsedNs()*state.GetItemCount()) {
+                    best = std::move(state);
+                }
+            }
+
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.item_count = best.GetItemCount();
+
+            double const elapsed_ns = best.GetElapsedNs();
+            u64 const item_count = std::max<u64>(result.item_count,1);
+            result.ns_per_item = elapsed_ns/item_count;
+            result.items_per_sec =
+                    (elapsed_ns > 0) ? (item_count*1E9/elapsed_ns) : 0;
+
+            std::vector<u64> &list_latencies = best.GetLatencies();
+            result.latency_count = list_latencies.size();
+            result.latency_p50 = 0;
+            result.latency_p99 = 0;
+            result.latency_p999 = 0;
+            result.latency_max = 0;
+
+            if(!list_latencies.empty()) {
+                std::sort(list_latencies.begin(),list_latencies.end());
+                result.latency_p50 = percentile(list_latencies,0.5);
+                result.latency_p99 = percentile(list_latencies,0.99);
+                result.latency_p999 = percentile(list_latencies,0.999);
+                result.latency_max = list_latencies.back();
+            }
+
+            return result;
+        }
+
+    } // bench
+} // ks
@@ -0,0 +1,232 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef KS_BENCH_HPP
+#define KS_BENCH_HPP
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ks/KsGlobal.hpp>
+#include <ks/KsFunction.hpp>
+#include <ks/KsEventLoop.hpp>
+
+namespace ks
+{
+    namespace bench
+    {
+        using Clock = std::chrono::steady_clock;
+
+        // ============================================================= //
+
+        // State
+        // * Passed to each benchmark run. A benchmark does
+        //   GetIterations() operations and the runner divides
+        //   the elapsed time by the item count
+        // * Timing is running when the benchmark is called;
+        //   use PauseTiming/ResumeTiming to exclude setup
+        class State final
+        {
+        public:
+            State(u64 iterations);
+
+            u64 GetIterations() const;
+
+            void PauseTiming();
+            void ResumeTiming();
+
+            // * Sets the number of operations the elapsed
+            //   time is divided by. Defaults to GetIterations()
+            void SetItemCount(u64 item_count);
+
+            // * Records a latency sample (in nanoseconds) that is
+            //   reported as percentiles. Not thread-safe
+            void AddLatency(u64 latency_ns);
+            void AddLatency(Clock::duration latency);
+            void ReserveLatencies(u64 count);
+
+            u64 GetElapsedNs() const;
+            u64 GetItemCount() const;
+            std::vector<u64> & GetLatencies();
+
+        private:
+            u64 m_iterations;
+            u64 m_item_count;
+            bool m_timing;
+            Clock::time_point m_start;
+            Clock::duration m_elapsed;
+            std::vector<u64> m_list_latencies;
+        };
+
+        // ============================================================= //
+
+        struct Result
+        {
+            std::string name;
+            u64 iterations;
+            u64 item_count;
+            double ns_per_item;
+            double items_per_sec;
+
+            // Latency percentiles in nanoseconds; only
+            // valid if latency_count is non-zero
+            u64 latency_count;
+            u64 latency_p50;
+            u64 latency_p99;
+            u64 latency_p999;
+            u64 latency_max;
+        };
+
+        // ============================================================= //
+
+        class Runner final
+        {
+        public:
+            enum class Format : u8
+            {
+                Text,
+                Json,
+                Csv
+            };
+
+            struct Config
+            {
+                Config();
+
+                Format format;
+
+                // * Only benchmarks whose names contain
+                //   this are run
+                std::string filter;
+
+                // * Iterations are increased until a run
+                //   takes at least this long
+                Milliseconds min_time;
+
+                // * Each benchmark is run this many times after
+                //   calibrating; the fastest run is reported
+                uint repetitions;
+
+                // * The total rate (items/s) that benchmarks
+                //   measuring latency at a fixed load send at
+                double rate;
+            };
+
+            Runner();
+
+            // * Adds a benchmark. If @fixed_iterations is non-zero
+            //   the benchmark is always run with that many
+            //   iterations instead of being calibrated
+            void Add(std::string name,
+                     Function<void(State&)> fn,
+                     u64 fixed_iterations=0);
+
+            // * Parses the command line into the Config:
+            //   --format=text|json|csv, --filter=<str>,
+            //   --min-time=<ms>, --repetitions=<n>, --rate=<items/s>,
+            //   --out=<file> and --list. Returns false on bad arguments
+            bool ParseArgs(int argc,char* argv[]);
+
+            Config & GetConfig();
+            Config const & GetConfig() const;
+            std::string const & GetOutputPath() const;
+            bool GetListOnly() const;
+
+            std::vector<Result> Run();
+
+            void List(std::ostream &out) const;
+            void Write(std::vector<Result> const &list_results,
+                       std::ostream &out) const;
+
+        private:
+            struct Benchmark
+            {
+                std::string name;
+                Function<void(State&)> fn;
+                u64 fixed_iterations;
+            };
+
+            Result run(Benchmark &benchmark);
+
+            Config m_config;
+            std::string m_output_path;
+            bool m_list_only;
+            std::vector<Benchmark> m_list_benchmarks;
+        };
+
+        // ============================================================= //
+
+        // Benchmark suites
+        // * EventLoop, Signal, Timer, Object and Logger
+        //   primitives (KsBenchCore.cpp)
+        void AddCoreBenchmarks(Runner &runner);
+
+        // * Producer/consumer throughput and latency as the
+        //   thread and EventLoop counts grow (KsBenchScaling.cpp)
+        void AddScalingBenchmarks(Runner &runner);
+
+        // ============================================================= //
+
+        // * Runs an EventLoop in its own thread for
+        //   the lifetime of the fixture
+        class LoopThread final
+        {
+        public:
+            LoopThread(EventLoop::Config const &config) :
+                m_event_loop(make_shared<EventLoop>(config))
+            {
+                m_thread = EventLoop::LaunchInThread(m_event_loop);
+            }
+
+            ~LoopThread()
+            {
+                EventLoop::RemoveFromThread(m_event_loop,m_thread,true);
+            }
+
+            shared_ptr<EventLoop> const & Get() const
+            {
+                return m_event_loop;
+            }
+
+        private:
+            shared_ptr<EventLoop> m_event_loop;
+            std::thread m_thread;
+        };
+
+        // ============================================================= //
+
+        // * Spins (yielding) until @counter reaches @target
+        inline void WaitForCount(std::atomic<u64> const &counter,u64 target)
+        {
+            while(counter.load(std::memory_order_acquire) < target) {
+                std::this_thread::yield();
+            }
+        }
+
+        // * Keeps the compiler from optimizing away @value
+        template<typename T>
+        inline void DoNotOptimize(T const &value)
+        {
+            asm volatile("" : : "r,m"(value) : "memory");
+        }
+
+    } // bench
+} // ks
+
+#endif // KS_BENCH_HPP
@@ -0,0 +1,502 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <cstdio>
+
+#include <ks/KsObject.hpp>
+#include <ks/KsSignal.hpp>
+#include <ks/KsTimer.hpp>
+#include <ks/KsTask.hpp>
+#include <ks/KsLog.hpp>
+#include <ks/KsLogBinary.hpp>
+#include <ks/KsLogFile.hpp>
+#include <ks/KsLogRecorder.hpp>
+
+#include <ks/bench/KsBench.hpp>
+
+namespace ks
+{
+    namespace bench
+    {
+        namespace
+        {
+            // ============================================================= //
+
+            EventLoop::Config makeLoopConfig(EventLoop::QueueType queue_type,
+                                             EventLoop::TimerType timer_type=
+                                                EventLoop::TimerType::Asio)
+            {
+                EventLoop::Config config;
+                config.queue_type = queue_type;
+                config.timer_type = timer_type;
+                return config;
+            }
+
+            std::string queueName(EventLoop::QueueType queue_type)
+            {
+                return (queue_type == EventLoop::QueueType::Asio) ?
+                            "asio" : "lockfree";
+            }
+
+            // ============================================================= //
+
+            class Receiver : public Object
+            {
+            public:
+                using base_type = ks::Object;
+
+                Receiver(Object::Key const &key,
+                         shared_ptr<EventLoop> event_loop,
+                         std::atomic<u64> * counter) :
+                    Object(key,event_loop),
+                    m_counter(counter)
+                {
+                    // empty
+                }
+
+                void Init(Object::Key const &,
+                          shared_ptr<Receiver> const &)
+                {
+                    // empty
+                }
+
+                void SlotCount()
+                {
+                    m_counter->fetch_add(1,std::memory_order_release);
+                }
+
+            private:
+                std::atomic<u64> * m_counter;
+            };
+
+            // ============================================================= //
+
+            class NullSink : public Log::Sink
+            {
+            public:
+                void log(std::string const &line)
+                {
+                    DoNotOptimize(line.size());
+                }
+            };
+
+            // * Creates a Logger with the same format
+            //   blocks as ks::LOG
+            unique_ptr<Log::Logger> makeLogger(shared_ptr<Log::Sink> const &sink)
+            {
+                return make_unique<Log::Logger>(
+                            true,
+                            sink,
+                            std::array<std::vector<Log::FormatBlock*>,6>{{
+                                { new Log::FBRunTimeMs(), new Log::FBCustomStr(": TRACE: ") },
+                                { new Log::FBRunTimeMs(), new Log::FBCustomStr(": DEBUG: ") },
+                                { new Log::FBRunTimeMs(), new Log::FBCustomStr(": INFO:  ") },
+                                { new Log::FBRunTimeMs(), new Log::FBCustomStr(": WARN:  ") },
+                                { new Log::FBRunTimeMs(), new Log::FBCustomStr(": ERROR: ") },
+                                { new Log::FBRunTimeMs(), new Log::FBCustomStr(": FATAL: ") }
+                            }});
+            }
+
+            std::string const bench_log_path = "ks_bench_log.txt";
+            std::string const bench_binary_log_path = "ks_bench_log.bin";
+            std::string const bench_recorder_path = "ks_bench_recorder.txt";
+
+            void logLines(Log::Logger &logger,u64 count)
+            {
+                for(u64 i=0; i < count; i++) {
+                    KS_LOG_INFO(logger) << "bench line " << i << " value " << 0.5;
+                }
+            }
+
+            // ============================================================= //
+
+            void addEventLoopBenchmarks(Runner &runner,
+                                        EventLoop::QueueType queue_type)
+            {
+                std::string const queue = queueName(queue_type);
+
+                // Throughput: post from this thread, wait until
+                // the loop thread has invoked everything
+                runner.Add(
+                            "evloop/PostEvent/"+queue,
+                            [queue_type](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(makeLoopConfig(queue_type));
+                                EventLoop * event_loop = loop.Get().get();
+                                std::atomic<u64> counter(0);
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    event_loop->PostEvent(
+                                                event_loop->MakeEvent<SlotEvent>(
+                                                    [&counter]() {
+                                                        counter.fetch_add(
+                                                            1,std::memory_order_release);
+                                                    }));
+                                }
+                                WaitForCount(counter,state.GetIterations());
+                                state.PauseTiming();
+                            });
+
+                runner.Add(
+                            "evloop/PostCallback/"+queue,
+                            [queue_type](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(makeLoopConfig(queue_type));
+                                EventLoop * event_loop = loop.Get().get();
+                                std::atomic<u64> counter(0);
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    event_loop->PostCallback(
+                                                [&counter]() {
+                                                    counter.fetch_add(
+                                                        1,std::memory_order_release);
+                                                });
+                                }
+                                WaitForCount(counter,state.GetIterations());
+                                state.PauseTiming();
+                            });
+
+                runner.Add(
+                            "evloop/PostTask/"+queue,
+                            [queue_type](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(makeLoopConfig(queue_type));
+                                EventLoop * event_loop = loop.Get().get();
+                                std::atomic<u64> counter(0);
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    event_loop->PostTask(
+                                                make_shared<Task>(
+                                                    [&counter]() {
+                                                        counter.fetch_add(
+                                                            1,std::memory_order_release);
+                                                    }));
+                                }
+                                WaitForCount(counter,state.GetIterations());
+                                state.PauseTiming();
+                            });
+
+                // Latency: post one callback at a time and wait
+                // for it to be invoked before posting the next
+                runner.Add(
+                            "evloop/RoundTrip/"+queue,
+                            [queue_type](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(makeLoopConfig(queue_type));
+                                EventLoop * event_loop = loop.Get().get();
+                                std::atomic<u64> counter(0);
+                                state.ReserveLatencies(state.GetIterations());
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    auto const start = Clock::now();
+                                    event_loop->PostCallback(
+                                                [&counter]() {
+                                                    counter.fetch_add(
+                                                        1,std::memory_order_release);
+                                                });
+                                    WaitForCount(counter,i+1);
+                                    state.AddLatency(Clock::now()-start);
+                                }
+                                state.PauseTiming();
+                            });
+            }
+
+            // ============================================================= //
+
+            void addSignalBenchmarks(Runner &runner,
+                                     ConnectionType type,
+                                     std::string const &type_name,
+                                     uint fan_out)
+            {
+                runner.Add(
+                            "signal/Emit/"+type_name+"/"+ToString(fan_out),
+                            [type,fan_out](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(
+                                            makeLoopConfig(
+                                                EventLoop::QueueType::Asio));
+
+                                std::atomic<u64> counter(0);
+                                std::vector<shared_ptr<Receiver>> list_receivers;
+
+                                Signal<> signal;
+                                for(uint i=0; i < fan_out; i++) {
+                                    list_receivers.push_back(
+                                                MakeObject<Receiver>(
+                                                    loop.Get(),&counter));
+
+                                    signal.Connect(
+                                                list_receivers.back(),
+                                                &Receiver::SlotCount,
+                                                type);
+                                }
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    signal.Emit();
+                                }
+                                WaitForCount(counter,state.GetIterations()*fan_out);
+                                state.PauseTiming();
+                            });
+            }
+
+            // ============================================================= //
+
+            void addTimerBenchmarks(Runner &runner,
+                                    EventLoop::TimerType timer_type)
+            {
+                std::string const timer_name =
+                        (timer_type == EventLoop::TimerType::Asio) ?
+                            "asio" : "wheel";
+
+                uint const timer_count = 10000;
+
+                // Start and Stop a timer (that never expires)
+                // while timer_count others are active
+                runner.Add(
+                            "timer/StartStop/"+timer_name+"/"+ToString(timer_count),
+                            [timer_type,timer_count](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(
+                                            makeLoopConfig(
+                                                EventLoop::QueueType::Asio,
+                                                timer_type));
+
+                                std::vector<shared_ptr<Timer>> list_timers;
+                                for(uint i=0; i < timer_count; i++) {
+                                    list_timers.push_back(
+                                                MakeObject<Timer>(loop.Get()));
+                                    list_timers.back()->Start(Minutes(10),false);
+                                }
+
+                                shared_ptr<Timer> timer = MakeObject<Timer>(loop.Get());
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    timer->Start(Minutes(10),false);
+                                    timer->Stop();
+                                }
+                                state.PauseTiming();
+                            });
+
+                // Start timer_count timers that expire at once and
+                // wait for all of them. Latency is the time between
+                // each timer's deadline and its slot being invoked
+                runner.Add(
+                            "timer/Expiry/"+timer_name+"/"+ToString(timer_count),
+                            [timer_type,timer_count](State &state) {
+                                state.PauseTiming();
+                                LoopThread loop(
+                                            makeLoopConfig(
+                                                EventLoop::QueueType::Asio,
+                                                timer_type));
+
+                                Milliseconds const interval(10);
+                                std::atomic<u64> counter(0);
+                                std::vector<Clock::time_point> list_deadlines(timer_count);
+                                std::vector<Clock::duration> list_lateness(timer_count);
+
+                                shared_ptr<Receiver> receiver =
+                                        MakeObject<Receiver>(loop.Get(),&counter);
+
+                                std::vector<shared_ptr<Timer>> list_timers;
+                                for(uint i=0; i < timer_count; i++) {
+                                    list_timers.push_back(
+                                                MakeObject<Timer>(loop.Get()));
+
+                                    list_timers.back()->signal_timeout.Connect(
+                                                [i,&counter,&list_deadlines,&list_lateness]() {
+                                                    list_lateness[i] =
+                                                            Clock::now()-list_deadlines[i];
+                                                    counter.fetch_add(
+                                                        1,std::memory_order_release);
+                                                },
+                                                receiver);
+                                }
+                                state.ResumeTiming();
+
+                                for(uint i=0; i < timer_count; i++) {
+                                    list_deadlines[i] = Clock::now()+interval;
+                                    list_timers[i]->Start(interval,false);
+                                }
+                                WaitForCount(counter,timer_count);
+                                state.PauseTiming();
+
+                                for(auto const &lateness : list_lateness) {
+                                    state.AddLatency(lateness);
+                                }
+                                state.SetItemCount(timer_count);
+                            },
+                            1);
+            }
+
+            // ============================================================= //
+
+            void addObjectBenchmarks(Runner &runner)
+            {
+                runner.Add(
+                            "object/MakeObject",
+                            [](State &state) {
+                                state.PauseTiming();
+                                auto event_loop = make_shared<EventLoop>();
+                                std::atomic<u64> counter(0);
+
+                                std::vector<shared_ptr<Receiver>> list_receivers;
+                                list_receivers.reserve(state.GetIterations());
+                                state.ResumeTiming();
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    list_receivers.push_back(
+                                                MakeObject<Receiver>(
+                                                    event_loop,&counter));
+                                }
+                                state.PauseTiming();
+                            });
+            }
+
+            // ============================================================= //
+
+            void addLogBenchmarks(Runner &runner)
+            {
+                // A disabled statement should only cost a load
+                runner.Add(
+                            "log/Disabled",
+                            [](State &state) {
+                                auto logger = makeLogger(make_shared<NullSink>());
+                                logger->UnsetLevel(Log::Level::TRACE);
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    KS_LOG_TRACE(*logger) << "bench line " << i;
+                                }
+                            });
+
+                runner.Add(
+                            "log/Sink/null",
+                            [](State &state) {
+                                auto logger = makeLogger(make_shared<NullSink>());
+                                logLines(*logger,state.GetIterations());
+                            });
+
+                runner.Add(
+                            "log/Sink/null/async",
+                            [](State &state) {
+                                auto logger = makeLogger(make_shared<NullSink>());
+                                logger->StartAsync();
+                                logLines(*logger,state.GetIterations());
+                                logger->Flush();
+                            });
+
+                runner.Add(
+                            "log/Sink/file",
+                            [](State &state) {
+                                Log::SinkToFile::Config config;
+                                config.path = bench_log_path;
+                                auto logger = makeLogger(
+                                            make_shared<Log::SinkToFile>(config));
+
+                                logLines(*logger,state.GetIterations());
+                                logger->Flush();
+
+                                state.PauseTiming();
+                                logger.reset();
+                                std::remove(bench_log_path.c_str());
+                            });
+
+                runner.Add(
+                            "log/Sink/file/async",
+                            [](State &state) {
+                                Log::SinkToFile::Config config;
+                                config.path = bench_log_path;
+                                auto logger = makeLogger(
+                                            make_shared<Log::SinkToFile>(config));
+                                logger->StartAsync();
+
+                                logLines(*logger,state.GetIterations());
+                                logger->Flush();
+
+                                state.PauseTiming();
+                                logger.reset();
+                                std::remove(bench_log_path.c_str());
+                            });
+
+                // Lines below the sinks' level that are only
+                // kept by the flight recorder
+                runner.Add(
+                            "log/FlightRecorder",
+                            [](State &state) {
+                                Log::SinkFlightRecorder::Config config;
+                                config.path = bench_recorder_path;
+                                auto logger = makeLogger(make_shared<NullSink>());
+                                logger->UnsetLevel(Log::Level::TRACE);
+                                logger->SetFlightRecorder(
+                                            make_shared<Log::SinkFlightRecorder>(config));
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    KS_LOG_TRACE(*logger) << "bench line " << i
+                                                          << " value " << 0.5;
+                                }
+                            });
+
+                runner.Add(
+                            "log/Binary/file",
+                            [](State &state) {
+                                auto logger = makeLogger(make_shared<NullSink>());
+                                logger->AddBinarySink(
+                                            make_shared<Log::BinarySinkToFile>(
+                                                bench_binary_log_path));
+
+                                for(u64 i=0; i < state.GetIterations(); i++) {
+                                    KS_LOG_BINARY(*logger,INFO,
+                                                  "bench line {} value {}",i,0.5);
+                                }
+                                logger->Flush();
+
+                                state.PauseTiming();
+                                logger.reset();
+                                std::remove(bench_binary_log_path.c_str());
+                            });
+            }
+        }
+
+        // ============================================================= //
+
+        void AddCoreBenchmarks(Runner &runner)
+        {
+            addEventLoopBenchmarks(runner,EventLoop::QueueType::Asio);
+            addEventLoopBenchmarks(runner,EventLoop::QueueType::LockFree);
+
+            for(uint fan_out : { 1u, 8u, 64u }) {
+                addSignalBenchmarks(runner,ConnectionType::Direct,"direct",fan_out);
+                addSignalBenchmarks(runner,ConnectionType::Queued,"queued",fan_out);
+                addSignalBenchmarks(runner,ConnectionType::Blocking,"blocking",fan_out);
+            }
+
+            addTimerBenchmarks(runner,EventLoop::TimerType::Asio);
+            addTimerBenchmarks(runner,EventLoop::TimerType::Wheel);
+
+            addObjectBenchmarks(runner);
+
+            // SinkToStdOut and SinkToLogCat aren't included since
+            // they'd write to the same stream as the results
+            addLogBenchmarks(runner);
+        }
+
+    } // bench
+} // ks
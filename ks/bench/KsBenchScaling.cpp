@@ -0,0 +1,439 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+
+#include <ks/KsObject.hpp>
+#include <ks/KsSignal.hpp>
+
+#include <ks/bench/KsBench.hpp>
+
+// Scaling benchmarks
+// * Each point in the matrix has P producer threads sending
+//   messages with a B byte payload to C consumer EventLoops
+//   (each run by its own thread). Producers spread their
+//   messages across the consumers round-robin
+// * A point is measured in two phases:
+//
+//   1. Throughput: producers send as fast as they can for
+//      min_time. Each producer may have at most s_window
+//      messages in flight so the queues stay bounded. The
+//      reported items/s is the delivered message rate
+//
+//   2. Latency: producers send at a fixed total rate (--rate)
+//      for min_time. Each message is stamped with the time it
+//      was *scheduled* to be sent rather than the time it was
+//      actually sent, and its latency is measured from there.
+//      If a producer falls behind (ie it's blocked in Emit or
+//      descheduled), the messages it sends late are charged
+//      for the delay instead of it being hidden, which is the
+//      coordinated omission correction
+//
+// * Latencies are reported as p50/p99/p99.9/max in ns. If the
+//   rate is above what a point can sustain, its latencies grow
+//   with the length of the run, which is the expected result
+
+namespace ks
+{
+    namespace bench
+    {
+        namespace
+        {
+            u64 const s_window = 1024;
+            u64 const s_no_sample = ~u64(0);
+
+            u64 nowNs()
+            {
+                return std::chrono::duration_cast<
+                            std::chrono::nanoseconds>(
+                            Clock::now().time_since_epoch()).count();
+            }
+
+            // ============================================================= //
+
+            // * Padded so producers don't share cache lines (new
+            //   doesn't respect alignas before c++17)
+            struct ProducerCounter
+            {
+                std::atomic<u64> delivered;
+                char padding[64-sizeof(std::atomic<u64>)];
+            };
+
+            // * Shared by the producers and consumers of a run
+            class Delivery final
+            {
+            public:
+                Delivery(uint producer_count) :
+                    m_producer_count(producer_count),
+                    m_list_counters(new ProducerCounter[producer_count])
+                {
+                    for(uint i=0; i < m_producer_count; i++) {
+                        m_list_counters[i].delivered.store(0);
+                    }
+                }
+
+                // * Called by consumers
+                void Deliver(uint producer,u64 scheduled_ns,u64 sample)
+                {
+                    if(sample != s_no_sample) {
+                        m_list_latencies[sample] = nowNs()-scheduled_ns;
+                    }
+                    m_list_counters[producer].delivered.fetch_add(
+                                1,std::memory_order_release);
+                }
+
+                u64 GetDelivered(uint producer) const
+                {
+                    return m_list_counters[producer].delivered.load(
+                                std::memory_order_acquire);
+                }
+
+                // * Must be called before any samples are sent
+                void ResizeLatencies(u64 count)
+                {
+                    m_list_latencies.assign(count,0);
+                }
+
+                std::vector<u64> const & GetLatencies() const
+                {
+                    return m_list_latencies;
+                }
+
+            private:
+                uint const m_producer_count;
+                unique_ptr<ProducerCounter[]> m_list_counters;
+                std::vector<u64> m_list_latencies;
+            };
+
+            // ============================================================= //
+
+            template<uint Bytes>
+            struct Payload
+            {
+                char data[Bytes];
+            };
+
+            template<uint Bytes>
+            class Consumer : public Object
+            {
+            public:
+                using base_type = ks::Object;
+
+                Consumer(Object::Key const &key,
+                         shared_ptr<EventLoop> event_loop,
+                         Delivery * delivery) :
+                    Object(key,event_loop),
+                    m_delivery(delivery)
+                {
+                    // empty
+                }
+
+                void Init(Object::Key const &,
+                          shared_ptr<Consumer> const &)
+                {
+                    // empty
+                }
+
+                void OnMessage(Payload<Bytes> payload,
+                               uint producer,
+                               u64 scheduled_ns,
+                               u64 sample)
+                {
+                    DoNotOptimize(payload.data[0]);
+                    m_delivery->Deliver(producer,scheduled_ns,sample);
+                }
+
+            private:
+                Delivery * m_delivery;
+            };
+
+            // ============================================================= //
+
+            enum class Mechanism : u8
+            {
+                PostCallback,
+                QueuedEmit,
+                BlockingEmit
+            };
+
+            std::string mechanismName(Mechanism mechanism)
+            {
+                if(mechanism == Mechanism::PostCallback) {
+                    return "PostCallback";
+                }
+                else if(mechanism == Mechanism::QueuedEmit) {
+                    return "Emit/queued";
+                }
+                return "Emit/blocking";
+            }
+
+            // * Sets up the consumers for one run and sends
+            //   messages to them from any thread
+            template<uint Bytes>
+            class Channel final
+            {
+            public:
+                using MessageSignal = Signal<Payload<Bytes>,uint,u64,u64>;
+
+                Channel(Mechanism mechanism,
+                        uint consumer_count,
+                        Delivery * delivery) :
+                    m_mechanism(mechanism),
+                    m_delivery(delivery)
+                {
+                    for(uint i=0; i < consumer_count; i++) {
+                        m_list_loops.emplace_back(
+                                    new LoopThread(EventLoop::Config()));
+
+                        if(m_mechanism == Mechanism::PostCallback) {
+                            continue;
+                        }
+
+                        m_list_consumers.push_back(
+                                    MakeObject<Consumer<Bytes>>(
+                                        m_list_loops.back()->Get(),
+                                        delivery));
+
+                        m_list_signals.emplace_back(new MessageSignal());
+                        m_list_signals.back()->Connect(
+                                    m_list_consumers.back(),
+                                    &Consumer<Bytes>::OnMessage,
+                                    (m_mechanism == Mechanism::QueuedEmit) ?
+                                        ConnectionType::Queued :
+                                        ConnectionType::Blocking);
+                    }
+
+                    for(uint i=0; i < Bytes; i++) {
+                        m_payload.data[i] = static_cast<char>(i);
+                    }
+                }
+
+                void Send(uint producer,u64 seq,u64 scheduled_ns,u64 sample)
+                {
+                    uint const consumer = (producer+seq)%m_list_loops.size();
+
+                    if(m_mechanism == Mechanism::PostCallback) {
+                        Delivery * delivery = m_delivery;
+                        Payload<Bytes> const payload = m_payload;
+
+                        m_list_loops[consumer]->Get()->PostCallback(
+                                    [delivery,payload,producer,scheduled_ns,sample]() {
+                                        DoNotOptimize(payload.data[0]);
+                                        delivery->Deliver(producer,scheduled_ns,sample);
+                                    });
+                        return;
+                    }
+
+                    m_list_signals[consumer]->Emit(
+                                m_payload,producer,scheduled_ns,sample);
+                }
+
+            private:
+                Mechanism const m_mechanism;
+                Delivery * const m_delivery;
+                Payload<Bytes> m_payload;
+
+                // Signals are destroyed before their consumers,
+                // which are destroyed before their loops
+                std::vector<unique_ptr<LoopThread>> m_list_loops;
+                std::vector<shared_ptr<Consumer<Bytes>>> m_list_consumers;
+                std::vector<unique_ptr<MessageSignal>> m_list_signals;
+            };
+
+            // ============================================================= //
+
+            template<uint Bytes>
+            void runPoint(State &state,
+                          Runner::Config const &config,
+                          Mechanism mechanism,
+                          uint producer_count,
+                          uint consumer_count)
+            {
+                state.PauseTiming();
+
+                Delivery delivery(producer_count);
+                Channel<Bytes> channel(mechanism,consumer_count,&delivery);
+                std::vector<u64> list_sent(producer_count,0);
+
+                auto wait_for_delivery = [&]() {
+                    for(uint k=0; k < producer_count; k++) {
+                        while(delivery.GetDelivered(k) < list_sent[k]) {
+                            std::this_thread::yield();
+                        }
+                    }
+                };
+
+                // Phase 1: throughput
+                std::atomic<bool> stop(false);
+                std::vector<std::thread> list_producers;
+
+                state.ResumeTiming();
+                for(uint k=0; k < producer_count; k++) {
+                    list_producers.emplace_back(
+                                [&,k]() {
+                                    u64 seq=0;
+                                    while(!stop.load(std::memory_order_relaxed)) {
+                                        if(seq-delivery.GetDelivered(k) >= s_window) {
+                                            std::this_thread::yield();
+                                            continue;
+                                        }
+                                        channel.Send(k,seq,0,s_no_sample);
+                                        seq++;
+                                    }
+                                    list_sent[k] = seq;
+                                });
+                }
+
+                std::this_thread::sleep_for(config.min_time);
+                stop.store(true,std::memory_order_relaxed);
+                for(auto &producer : list_producers) {
+                    producer.join();
+                }
+                wait_for_delivery();
+                state.PauseTiming();
+
+                u64 item_count=0;
+                for(u64 sent : list_sent) {
+                    item_count += sent;
+                }
+                state.SetItemCount(item_count);
+
+                // Phase 2: latency at a fixed rate
+                double const min_time_s =
+                        std::chrono::duration_cast<
+                            std::chrono::duration<double>>(
+                            config.min_time).count();
+
+                u64 const per_producer =
+                        std::max<u64>(
+                            static_cast<u64>(config.rate*min_time_s/producer_count),
+                            100);
+
+                u64 const interval_ns =
+                        static_cast<u64>(1E9*producer_count/config.rate);
+
+                delivery.ResizeLatencies(per_producer*producer_count);
+                list_producers.clear();
+
+                // Give every producer the same start time
+                u64 const start_ns = nowNs()+1000000;
+
+                for(uint k=0; k < producer_count; k++) {
+                    list_producers.emplace_back(
+                                [&,k]() {
+                                    u64 const first_sample = k*per_producer;
+                                    u64 const seq_offset = list_sent[k];
+
+                                    // Offset each producer within the
+                                    // interval so sends are spread out
+                                    u64 const phase_ns = (interval_ns*k)/producer_count;
+
+                                    for(u64 i=0; i < per_producer; i++) {
+                                        u64 const scheduled_ns =
+                                                start_ns+phase_ns+(i*interval_ns);
+
+                                        while(nowNs() < scheduled_ns) {
+                                            std::this_thread::yield();
+                                        }
+
+                                        channel.Send(k,seq_offset+i,
+                                                     scheduled_ns,first_sample+i);
+                                    }
+                                    list_sent[k] += per_producer;
+                                });
+                }
+
+                for(auto &producer : list_producers) {
+                    producer.join();
+                }
+                wait_for_delivery();
+
+                state.ReserveLatencies(delivery.GetLatencies().size());
+                for(u64 latency : delivery.GetLatencies()) {
+                    state.AddLatency(latency);
+                }
+            }
+
+            template<uint Bytes>
+            void addPoints(Runner &runner,
+                           Mechanism mechanism,
+                           std::vector<uint> const &list_producer_counts,
+                           std::vector<uint> const &list_consumer_counts)
+            {
+                Runner::Config const &config = runner.GetConfig();
+
+                for(uint producer_count : list_producer_counts) {
+                    for(uint consumer_count : list_consumer_counts) {
+                        runner.Add(
+                                    "scale/"+mechanismName(mechanism)+
+                                    "/p"+ToString(producer_count)+
+                                    "/c"+ToString(consumer_count)+
+                                    "/b"+ToString(Bytes),
+                                    [&config,mechanism,producer_count,consumer_count]
+                                    (State &state) {
+                                        runPoint<Bytes>(state,config,mechanism,
+                                                        producer_count,consumer_count);
+                                    },
+                                    1);
+                    }
+                }
+            }
+
+            // * Returns the entries in @list_counts up to @max_count
+            std::vector<uint> limitCounts(std::vector<uint> const &list_counts,
+                                          uint max_count)
+            {
+                std::vector<uint> list_limited;
+                for(uint count : list_counts) {
+                    if(count <= max_count) {
+                        list_limited.push_back(count);
+                    }
+                }
+                return list_limited;
+            }
+        }
+
+        // ============================================================= //
+
+        void AddScalingBenchmarks(Runner &runner)
+        {
+            uint const cores = std::max(std::thread::hardware_concurrency(),1u);
+
+            // Oversubscribe producers up to twice the core count
+            // to see how contention degrades; consumers each take
+            // a thread so they're limited to the core count
+            std::vector<uint> const list_producer_counts =
+                    limitCounts({ 1, 2, 4, 8, 16, 32, 64, 128 },
+                                std::max(cores*2,2u));
+
+            std::vector<uint> const list_consumer_counts =
+                    limitCounts({ 1, 2, 4, 8, 16, 32 },cores);
+
+            // 16 bytes fits within the inline storage of the
+            // ks::Function that wraps a callback; 256 doesn't
+            for(Mechanism mechanism : { Mechanism::PostCallback,
+                                        Mechanism::QueuedEmit,
+                                        Mechanism::BlockingEmit }) {
+                addPoints<16>(runner,mechanism,
+                              list_producer_counts,list_consumer_counts);
+
+                addPoints<256>(runner,mechanism,
+                               list_producer_counts,list_consumer_counts);
+            }
+        }
+
+    } // bench
+} // ks
@@ -0,0 +1,67 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <fstream>
+#include <iostream>
+
+#include <ks/bench/KsBench.hpp>
+
+// ks_bench
+// * usage: ks_bench [--format=text|json|csv] [--filter=<str>]
+//                   [--min-time=<ms>] [--repetitions=<n>]
+//                   [--rate=<items/s>] [--out=<file>] [--list]
+// * writes results to stdout if no output file is given
+// * the producer/consumer scaling matrix can be run on
+//   its own with --filter=scale/
+int main(int argc, char* argv[])
+{
+    ks::bench::Runner runner;
+    if(!runner.ParseArgs(argc,argv)) {
+        std::cerr << "usage: ks_bench [--format=text|json|csv] "
+                     "[--filter=<str>] [--min-time=<ms>] "
+                     "[--repetitions=<n>] [--rate=<items/s>] "
+                     "[--out=<file>] [--list]"
+                  << std::endl;
+        return 1;
+    }
+
+    // The suites read the parsed config
+    ks::bench::AddCoreBenchmarks(runner);
+    ks::bench::AddScalingBenchmarks(runner);
+
+    if(runner.GetListOnly()) {
+        runner.List(std::cout);
+        return 0;
+    }
+
+    auto const list_results = runner.Run();
+
+    if(runner.GetOutputPath().empty()) {
+        runner.Write(list_results,std::cout);
+        return 0;
+    }
+
+    std::ofstream out(runner.GetOutputPath());
+    if(!out) {
+        std::cerr << "ks_bench: failed to open "
+                  << runner.GetOutputPath() << std::endl;
+        return 1;
+    }
+
+    runner.Write(list_results,out);
+    return 0;
+}
@@ -0,0 +1,22 @@
+# ks_bench
+# * microbenchmarks for ks_core primitives; see
+#   ks_bench.cpp for usage
+# * build in release mode for meaningful results
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+CONFIG -= app_bundle
+
+TARGET = ks_bench
+
+include($${PWD}/../../ks_core.pri)
+
+HEADERS += \
+    $${PWD}/KsBench.hpp
+
+SOURCES += \
+    $${PWD}/KsBench.cpp \
+    $${PWD}/KsBenchCore.cpp \
+    $${PWD}/KsBenchScaling.cpp \
+    $${PWD}/ks_bench.cpp
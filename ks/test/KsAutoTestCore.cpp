@@ -17,10 +17,20 @@
 
 #include <catch/catch.hpp>
 
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <ks/KsGlobal.hpp>
 #include <ks/KsObject.hpp>
 #include <ks/KsTimer.hpp>
 #include <ks/KsTask.hpp>
+#include <ks/KsLog.hpp>
+#include <ks/KsLogBinary.hpp>
+#include <ks/KsLogFile.hpp>
+#include <ks/KsLogRecorder.hpp>
+#include <ks/KsWatchdog.hpp>
 
 using namespace ks;
 
@@ -42,6 +52,41 @@ TEST_CASE("EventLoop","[evloop]")
 
     shared_ptr<EventLoop> event_loop = make_shared<EventLoop>();
 
+    SECTION("GetState")
+    {
+        // A started loop always has a thread id and
+        // a stopped one never does
+        std::atomic<bool> done(false);
+        bool consistent = true;
+
+        std::thread reader(
+                    [&]() {
+                        while(!done) {
+                            std::thread::id thread_id;
+                            bool started;
+                            bool running;
+                            event_loop->GetState(thread_id,started,running);
+                            if(started == (thread_id == std::thread::id())) {
+                                consistent = false;
+                            }
+                        }
+                    });
+
+        for(uint i=0; i < 1000; i++) {
+            event_loop->Start();
+            event_loop->Stop();
+        }
+
+        done = true;
+        reader.join();
+        REQUIRE(consistent);
+
+        event_loop->Start();
+        REQUIRE(event_loop->GetStarted());
+        REQUIRE_FALSE(event_loop->GetRunning());
+        REQUIRE(event_loop->GetThreadId() == std::this_thread::get_id());
+    }
+
     SECTION("PostEvents")
     {
         event_loop->PostEvent(make_unique<SlotEvent>(count_then_ret));
@@ -143,6 +188,33 @@ TEST_CASE("EventLoop","[evloop]")
             thread.join();
         }
 
+        SECTION("TryRun, TryProcessEvents, TryPostEvent")
+        {
+            using Status = EventLoop::Status;
+
+            REQUIRE(event_loop->TryRun() == Status::Inactive);
+            REQUIRE(event_loop->TryProcessEvents() == Status::Inactive);
+            REQUIRE(event_loop->TryPostEvent(
+                        make_unique<SlotEvent>(count_then_ret)) ==
+                    Status::Inactive);
+
+            event_loop->Start();
+            REQUIRE(event_loop->TryPostEvent(
+                        make_unique<SlotEvent>(count_then_ret)) ==
+                    Status::Ok);
+
+            std::thread thread(
+                        [event_loop]
+                        () {
+                            REQUIRE(event_loop->TryProcessEvents() ==
+                                    Status::WrongThread);
+                        });
+            thread.join();
+
+            REQUIRE(event_loop->TryProcessEvents() == Status::Ok);
+            REQUIRE(count==4);
+        }
+
         SECTION("Run")
         {
             LOG.Info() << "KsTest: Expect ProcessEvent/Run "
@@ -214,6 +286,407 @@ TEST_CASE("EventLoop","[evloop]")
     }
 }
 
+TEST_CASE("EventLoop lock-free queue","[evloop]")
+{
+    EventLoop::Config config;
+    config.queue_type = EventLoop::QueueType::LockFree;
+    config.batch_size = 8;
+
+    shared_ptr<EventLoop> event_loop = make_shared<EventLoop>(config);
+
+    SECTION("Multiple producers")
+    {
+        std::thread thread = EventLoop::LaunchInThread(event_loop);
+
+        // Events from each producer must be invoked
+        // in the order that producer posted them
+        uint const producer_count = 4;
+        uint const post_count = 5000;
+        std::vector<uint> list_last(producer_count,0);
+        bool ordered = true;
+
+        std::vector<std::thread> list_producers;
+        for(uint p=0; p < producer_count; p++) {
+            list_producers.emplace_back(
+                        [&,p]() {
+                            for(uint i=1; i <= post_count; i++) {
+                                event_loop->PostCallback(
+                                            [&,p,i]() {
+                                                if(list_last[p]+1 != i) {
+                                                    ordered = false;
+                                                }
+                                                list_last[p] = i;
+                                            });
+                            }
+                        });
+        }
+
+        for(auto& producer : list_producers) {
+            producer.join();
+        }
+
+        EventLoop::RemoveFromThread(event_loop,thread,true);
+
+        REQUIRE(ordered);
+        for(auto last : list_last) {
+            REQUIRE(last == post_count);
+        }
+    }
+
+    SECTION("PostStopEvent ordering")
+    {
+        uint count = 0;
+        auto count_then_ret = std::bind(CountThenReturn,&count);
+
+        for(uint i=0; i < 20; i++) {
+            event_loop->PostCallback(count_then_ret);
+        }
+        event_loop->PostStopEvent();
+        event_loop->PostCallback(count_then_ret);
+
+        // Events posted after the stop event are
+        // left in the queue for the next Run
+        std::thread thread(
+                    [event_loop]() {
+                        event_loop->Start();
+                        event_loop->Run();
+                    });
+        thread.join();
+        REQUIRE(count == 20);
+    }
+}
+
+TEST_CASE("EventPool","[evloop]")
+{
+    uint count = 0;
+    auto count_then_ret = std::bind(CountThenReturn,&count);
+
+    shared_ptr<EventLoop> event_loop = make_shared<EventLoop>();
+
+    SECTION("Recycle")
+    {
+        // Event memory should be returned to the pool
+        // and reused by the next event
+        unique_ptr<SlotEvent> event =
+                event_loop->MakeEvent<SlotEvent>(count_then_ret);
+
+        void * const ptr = event.get();
+        event.reset();
+
+        event = event_loop->MakeEvent<SlotEvent>(count_then_ret);
+        REQUIRE(event.get() == ptr);
+
+        event_loop->Start();
+        event_loop->PostEvent(std::move(event));
+        event_loop->ProcessEvents();
+        REQUIRE(count == 1);
+    }
+
+    SECTION("Outlive EventLoop")
+    {
+        unique_ptr<SlotEvent> event =
+                event_loop->MakeEvent<SlotEvent>(count_then_ret);
+
+        event_loop->PostEvent(
+                    event_loop->MakeEvent<SlotEvent>(count_then_ret));
+
+        event_loop.reset();
+        event->Invoke();
+        event.reset();
+        REQUIRE(count == 1);
+    }
+
+    SECTION("No pool")
+    {
+        EventLoop::Config config;
+        config.event_pool_capacity = 0;
+        event_loop = make_shared<EventLoop>(config);
+
+        event_loop->Start();
+        event_loop->PostCallback(count_then_ret);
+        event_loop->PostEvent(
+                    event_loop->MakeEvent<SlotEvent>(count_then_ret));
+        event_loop->ProcessEvents();
+        REQUIRE(count == 2);
+    }
+
+    SECTION("Exhausted pool")
+    {
+        // Events allocated once the pool is full
+        // should come from the heap
+        EventLoop::Config config;
+        config.event_pool_capacity = 64;
+        event_loop = make_shared<EventLoop>(config);
+
+        event_loop->Start();
+        for(uint i=0; i < 200; i++) {
+            event_loop->PostEvent(
+                        event_loop->MakeEvent<SlotEvent>(count_then_ret));
+        }
+        event_loop->ProcessEvents();
+        REQUIRE(count == 200);
+    }
+}
+
+TEST_CASE("EventLoop bounded ProcessEvents","[evloop]")
+{
+    uint count = 0;
+    auto count_then_ret = std::bind(CountThenReturn,&count);
+
+    EventLoop::Config config;
+    config.batch_size = 4;
+    config.collect_stats = true;
+
+    auto check_bounded = [&](shared_ptr<EventLoop> event_loop) {
+        event_loop->Start();
+        for(uint i=0; i < 10; i++) {
+            event_loop->PostCallback(count_then_ret);
+        }
+
+        EventLoop::ProcessResult result = event_loop->ProcessEvents(3);
+        REQUIRE(result.processed == 3);
+        REQUIRE(result.pending == 7);
+        REQUIRE(count == 3);
+
+        result = event_loop->ProcessEvents(0);
+        REQUIRE(result.processed == 0);
+        REQUIRE(result.pending == 7);
+
+        // Past the end of a lock-free batch
+        result = event_loop->ProcessEvents(5);
+        REQUIRE(result.processed == 5);
+        REQUIRE(result.pending == 2);
+
+        result = event_loop->ProcessEvents(100);
+        REQUIRE(result.processed == 2);
+        REQUIRE(result.pending == 0);
+        REQUIRE(count == 10);
+
+        // A zero budget still runs one event
+        auto sleep_then_count = [&]() {
+            std::this_thread::sleep_for(Milliseconds(5));
+            count++;
+        };
+        for(uint i=0; i < 4; i++) {
+            event_loop->PostCallback(sleep_then_count);
+        }
+
+        result = event_loop->ProcessEventsFor(Microseconds(0));
+        REQUIRE(result.processed == 1);
+        REQUIRE(result.pending == 3);
+
+        // Each event sleeps for at least 5ms, so the budget is
+        // always spent after two events; a slow machine can only
+        // run fewer
+        result = event_loop->ProcessEventsFor(Microseconds(7000));
+        REQUIRE(result.processed >= 1);
+        REQUIRE(result.processed < 3);
+        REQUIRE(result.processed+result.pending == 3);
+
+        event_loop->ProcessEvents();
+        REQUIRE(count == 14);
+
+        // The max sentinel runs every ready event
+        for(uint i=0; i < 6; i++) {
+            event_loop->PostCallback(count_then_ret);
+        }
+        result = event_loop->ProcessEvents(std::numeric_limits<u64>::max());
+        REQUIRE(result.processed == 6);
+        REQUIRE(result.pending == 0);
+        REQUIRE(count == 20);
+    };
+
+    SECTION("Asio queue")
+    {
+        check_bounded(make_shared<EventLoop>(config));
+    }
+
+    SECTION("LockFree queue")
+    {
+        config.queue_type = EventLoop::QueueType::LockFree;
+        check_bounded(make_shared<EventLoop>(config));
+    }
+
+    SECTION("Without stats")
+    {
+        // Pending events are counted without stats too
+        config.collect_stats = false;
+
+        SECTION("Asio queue")
+        {
+            check_bounded(make_shared<EventLoop>(config));
+        }
+
+        SECTION("LockFree queue")
+        {
+            config.queue_type = EventLoop::QueueType::LockFree;
+            check_bounded(make_shared<EventLoop>(config));
+        }
+    }
+}
+
+TEST_CASE("EventLoop stats","[evloop]")
+{
+    uint count = 0;
+    auto count_then_ret = std::bind(CountThenReturn,&count);
+    uint const post_count = 100;
+
+    EventLoop::Config config;
+    config.collect_stats = true;
+
+    auto check_stats = [&](shared_ptr<EventLoop> event_loop) {
+        event_loop->Start();
+        for(uint i=0; i < post_count; i++) {
+            event_loop->PostCallback(count_then_ret);
+        }
+
+        EventLoop::Stats stats = event_loop->GetStats();
+        REQUIRE(stats.posted == post_count);
+        REQUIRE(stats.processed == 0);
+        REQUIRE(stats.pending == post_count);
+
+        event_loop->ProcessEvents();
+        REQUIRE(count == post_count);
+
+        stats = event_loop->GetStats();
+        REQUIRE(stats.posted == post_count);
+        REQUIRE(stats.processed == post_count);
+        REQUIRE(stats.pending == 0);
+        REQUIRE(stats.queue_time.count == post_count);
+
+        auto const slot = static_cast<u8>(EventLoop::HandlerType::Slot);
+        REQUIRE(stats.handler_time[slot].count == post_count);
+        REQUIRE(stats.queue_time.GetPercentile(0.5) <=
+                stats.queue_time.GetPercentile(0.99));
+
+        // Tasks posted from the loop's thread are run right
+        // away, so post from another thread
+        std::thread post_thread(
+                    [&](){
+            event_loop->PostTask(make_shared<Task>(count_then_ret));
+        });
+        post_thread.join();
+        event_loop->ProcessEvents();
+        REQUIRE(count == post_count+1);
+
+        stats = event_loop->GetStats();
+        REQUIRE(stats.posted == post_count+1);
+        REQUIRE(stats.processed == post_count+1);
+
+        auto const task = static_cast<u8>(EventLoop::HandlerType::Task);
+        REQUIRE(stats.handler_time[slot].count == post_count);
+        REQUIRE(stats.handler_time[task].count == 1);
+    };
+
+    SECTION("Asio queue")
+    {
+        check_stats(make_shared<EventLoop>(config));
+    }
+
+    SECTION("LockFree queue")
+    {
+        config.queue_type = EventLoop::QueueType::LockFree;
+        check_stats(make_shared<EventLoop>(config));
+    }
+
+    SECTION("Disabled")
+    {
+        shared_ptr<EventLoop> event_loop = make_shared<EventLoop>();
+        event_loop->Start();
+        event_loop->PostCallback(count_then_ret);
+        event_loop->ProcessEvents();
+        REQUIRE(count == 1);
+
+        EventLoop::Stats const stats = event_loop->GetStats();
+        REQUIRE(stats.posted == 0);
+        REQUIRE(stats.processed == 0);
+        REQUIRE(stats.queue_time.count == 0);
+        REQUIRE(stats.queue_time.GetPercentile(0.5) == 0);
+    }
+}
+
+TEST_CASE("Watchdog","[evloop]")
+{
+    std::mutex mutex;
+    std::condition_variable stall_cv;
+    std::vector<Watchdog::Stall> list_stalls;
+
+    Watchdog::Config config;
+    config.budget = Milliseconds(50);
+    config.interval = Milliseconds(5);
+    config.on_stall =
+            [&](Watchdog::Stall const &stall) {
+                std::lock_guard<std::mutex> lock(mutex);
+                list_stalls.push_back(stall);
+                stall_cv.notify_all();
+            };
+
+    Watchdog watchdog(config);
+    shared_ptr<EventLoop> event_loop = make_shared<EventLoop>();
+
+    // * Returns a handler that stalls until the watchdog reports
+    //   it, or until @timeout if the loop isn't being watched
+    auto stall_until_reported = [&](Milliseconds timeout) {
+        return [&,timeout]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            std::size_t const count = list_stalls.size();
+            stall_cv.wait_for(lock,timeout,[&]() {
+                return (list_stalls.size() > count);
+            });
+        };
+    };
+
+    auto const reported = Milliseconds(10000);
+    auto const unwatched = Milliseconds(150);
+
+    SECTION("Run")
+    {
+        // Added after the loop started running
+        std::thread thread = EventLoop::LaunchInThread(event_loop);
+        watchdog.Add(event_loop);
+
+        event_loop->PostCallback([](){});
+        event_loop->PostCallback(stall_until_reported(reported));
+        event_loop->PostCallback([](){});
+        EventLoop::RemoveFromThread(event_loop,thread,true);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        REQUIRE(list_stalls.size() == 1);
+        REQUIRE(list_stalls[0].loop_id == event_loop->GetId());
+        REQUIRE(list_stalls[0].type == EventLoop::HandlerType::Slot);
+        REQUIRE(list_stalls[0].elapsed >= config.budget);
+    }
+
+    SECTION("ProcessEvents")
+    {
+        event_loop->Start();
+        event_loop->PostCallback(stall_until_reported(unwatched));
+
+        // Not watched yet
+        event_loop->ProcessEvents();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(list_stalls.empty());
+        }
+
+        watchdog.Add(event_loop);
+        event_loop->PostCallback(stall_until_reported(reported));
+        event_loop->ProcessEvents();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(list_stalls.size() == 1);
+        }
+
+        watchdog.Remove(event_loop);
+        event_loop->PostCallback(stall_until_reported(unwatched));
+        event_loop->ProcessEvents();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(list_stalls.size() == 1);
+        }
+    }
+}
+
 // ============================================================= //
 // ============================================================= //
 
@@ -256,6 +729,98 @@ TEST_CASE("Tasks","[tasks]")
 }
 
 
+// ============================================================= //
+// ============================================================= //
+
+namespace test_function
+{
+    // Move-only callable
+    struct AddUnique
+    {
+        AddUnique(uint x) : m_x(make_unique<uint>(x)) {}
+
+        uint operator()(uint y) { return (*m_x)+y; }
+
+        unique_ptr<uint> m_x;
+    };
+
+    // Callable that is too large to be stored inline
+    struct AddLarge
+    {
+        AddLarge(uint x) { m_x.fill(x); }
+
+        uint operator()(uint y) { return m_x[0]+y; }
+
+        std::array<uint,64> m_x;
+    };
+
+    struct Adder
+    {
+        uint Add(uint y) const { return x+y; }
+
+        uint x;
+    };
+}
+
+// ============================================================= //
+
+TEST_CASE("Function","[function]")
+{
+    Function<uint(uint)> fn_empty;
+    REQUIRE_FALSE(fn_empty);
+    REQUIRE_THROWS_AS(fn_empty(1),std::bad_function_call);
+
+    Function<uint(uint)> fn_unique = test_function::AddUnique(2);
+    Function<uint(uint)> fn_large = test_function::AddLarge(3);
+    REQUIRE(fn_unique(1) == 3);
+    REQUIRE(fn_large(1) == 4);
+
+    // Moving should transfer the callable
+    Function<uint(uint)> fn_moved(std::move(fn_unique));
+    REQUIRE_FALSE(fn_unique);
+    REQUIRE(fn_moved(2) == 4);
+
+    fn_moved = std::move(fn_large);
+    REQUIRE_FALSE(fn_large);
+    REQUIRE(fn_moved(2) == 5);
+
+    fn_moved = nullptr;
+    REQUIRE_FALSE(fn_moved);
+
+    // Moving never throws
+    REQUIRE(std::is_nothrow_move_constructible<Function<uint(uint)>>::value);
+    REQUIRE(std::is_nothrow_move_assignable<Function<uint(uint)>>::value);
+
+    // Reference arguments should not be copied
+    uint count = 0;
+    Function<void(uint&)> fn_ref = [](uint &x) { x++; };
+    fn_ref(count);
+    fn_ref(count);
+    REQUIRE(count == 2);
+
+    // Only callables with a matching signature are accepted
+    REQUIRE((std::is_constructible<
+                Function<uint(uint)>,uint(*)(std::string)>::value) == false);
+    REQUIRE((std::is_constructible<
+                Function<uint(uint)>,void(*)(uint)>::value) == false);
+    REQUIRE((std::is_constructible<
+                Function<void(uint)>,uint(*)(uint)>::value));
+
+    // Member pointers are called like std::function calls them
+    test_function::Adder adder{4};
+    Function<uint(test_function::Adder const &,uint)> fn_member =
+            &test_function::Adder::Add;
+    REQUIRE(fn_member(adder,1) == 5);
+
+    // Null callables give an empty Function
+    uint (*null_fn)(uint) = nullptr;
+    uint (test_function::Adder::*null_member)(uint) const = nullptr;
+    REQUIRE_FALSE(Function<uint(uint)>(null_fn));
+    REQUIRE_FALSE(Function<uint(uint)>(std::function<uint(uint)>()));
+    REQUIRE_FALSE((Function<uint(test_function::Adder const &,uint)>(
+                       null_member)));
+}
+
 // ============================================================= //
 // ============================================================= //
 
@@ -448,6 +1013,22 @@ namespace test_signals
             g_counter++;
         }
     };
+
+    uint g_copy_count{0};
+
+    struct CopyCounter
+    {
+        CopyCounter() = default;
+
+        CopyCounter(CopyCounter const &)
+        {
+            g_copy_count++;
+        }
+
+        CopyCounter(CopyCounter &&) = default;
+
+        std::string data{"payload"};
+    };
 }
 
 // ============================================================= //
@@ -740,72 +1321,685 @@ TEST_CASE("Signals","[signals]")
             EventLoop::RemoveFromThread(event_loop,thread,true);
         }
     }
-}
-
-
-// ============================================================= //
-// ============================================================= //
-
-class WakeupReceiver : public Object
-{
-public:
 
-    using base_type = ks::Object;
-    WakeupReceiver(Object::Key const &key,
-                   shared_ptr<EventLoop> event_loop) :
-        Object(key,event_loop),
-        m_wakeup_count(0),
-        m_wakeup_limit(0),
-        m_waiting(false)
+    SECTION("Blocking connection / Inactive EventLoop")
     {
-       // empty
+        shared_ptr<TrivialReceiver> receiver =
+                MakeObject<TrivialReceiver>(event_loop);
+
+        Signal<> signal_count;
+        uint counter = 0;
+        signal_count.Connect(
+                    receiver,
+                    &TrivialReceiver::SlotCount,
+                    ConnectionType::Blocking);
+        signal_count.Connect(
+                    [&counter](){
+                        counter++;
+                    });
+
+        // The blocking slot is skipped but the
+        // others are still invoked
+        REQUIRE(signal_count.TryEmit() == EventLoop::Status::Inactive);
+        REQUIRE(receiver->invoke_count == 0);
+        REQUIRE(counter == 1);
+
+        LOG.Info() << "KsTest: Expect Blocking signal "
+                      "with inactive EventLoop error";
+
+        REQUIRE_THROWS_AS(signal_count.Emit(),EventLoopInactive);
+        REQUIRE(counter == 2);
     }
 
-    void Init(Object::Key const &,
-              shared_ptr<WakeupReceiver> const &)
+    SECTION("Connection churn")
     {
+        Signal<> signal_count;
+        uint counter = 0;
+
+        std::vector<Id> list_ids;
+        for(uint i=0; i < 1000; i++) {
+            list_ids.push_back(
+                        signal_count.Connect(
+                            [&counter](){
+                                counter++;
+                            }));
+        }
 
-    }
+        // Disconnect every other connection
+        bool disconnect_ok = true;
+        for(uint i=0; i < list_ids.size(); i+=2) {
+            disconnect_ok = disconnect_ok &&
+                    signal_count.Disconnect(list_ids[i]);
+        }
+        REQUIRE(disconnect_ok);
+        REQUIRE(signal_count.GetConnectionCount() == 500);
+
+        // Disconnected slots are reused, but their
+        // ids should stay invalid
+        std::vector<Id> list_new_ids;
+        for(uint i=0; i < 250; i++) {
+            list_new_ids.push_back(
+                        signal_count.Connect(
+                            [&counter](){
+                                counter += 1000;
+                            }));
+        }
 
-    ~WakeupReceiver()
-    {
+        bool ids_ok = true;
+        for(uint i=0; i < list_ids.size(); i++) {
+            bool const valid = signal_count.ConnectionValid(list_ids[i]);
+            if(valid != (i%2 == 1)) {
+                ids_ok = false;
+            }
+        }
+        for(auto id : list_new_ids) {
+            if(!signal_count.ConnectionValid(id)) {
+                ids_ok = false;
+            }
+        }
+        REQUIRE(ids_ok);
+        REQUIRE_FALSE(signal_count.Disconnect(list_ids[0]));
 
+        signal_count.Emit();
+        REQUIRE(counter == 500+(250*1000));
     }
 
-    void Prepare(uint wakeup_limit)
+    SECTION("Connection churn / Overlapping emits")
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_waiting = true;
-        m_wakeup_count = 0;
-        m_wakeup_limit = wakeup_limit;
-    }
+        Signal<> signal_churn;
+        std::atomic<bool> emitting(true);
+        std::atomic<uint> emit_count(0);
+
+        // Keep Emits overlapping for the whole test
+        signal_churn.Connect(
+                    [&emit_count](){
+                        emit_count++;
+                        std::this_thread::sleep_for(Microseconds(200));
+                    });
+
+        std::vector<std::thread> list_threads;
+        for(uint i=0; i < 4; i++) {
+            list_threads.emplace_back(
+                        [&signal_churn,&emitting](){
+                while(emitting) {
+                    signal_churn.Emit();
+                }
+            });
+        }
+        while(emit_count < 8) {
+            std::this_thread::yield();
+        }
 
-    void Block()
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
+        // Replaced connection lists must be freed even though
+        // an Emit is always running, so the token's only other
+        // owner should be released after it's disconnected
+        auto token = make_shared<uint>(0);
+        Id const token_id =
+                signal_churn.Connect(
+                    [token](){
+                        std::this_thread::yield();
+                    });
+
+        auto churn = [&signal_churn](){
+            for(uint i=0; i < 100; i++) {
+                std::vector<Id> list_ids;
+                for(uint j=0; j < 16; j++) {
+                    list_ids.push_back(signal_churn.Connect([](){}));
+                }
+                for(auto id : list_ids) {
+                    signal_churn.Disconnect(id);
+                }
+            }
+        };
 
-        while(m_waiting) {
-            m_cv.wait(lock);
+        churn();
+        REQUIRE(token.use_count() > 1);
+        REQUIRE(signal_churn.Disconnect(token_id));
+        churn();
+
+        auto const timeout =
+                std::chrono::steady_clock::now()+
+                std::chrono::seconds(5);
+
+        while((token.use_count() != 1) &&
+              (std::chrono::steady_clock::now() < timeout)) {
+            std::this_thread::yield();
         }
-    }
+        REQUIRE(token.use_count() == 1);
 
-    void OnSleepFor(Milliseconds sleep_ms)
-    {
-        std::this_thread::sleep_for(sleep_ms);
+        emitting = false;
+        for(auto &thread : list_threads) {
+            thread.join();
+        }
     }
 
-    void OnWakeup()
+    SECTION("Payload copies")
     {
-        m_wakeup_count++;
+        using test_signals::CopyCounter;
+        uint& copy_count = test_signals::g_copy_count;
 
-        if(m_wakeup_count < m_wakeup_limit) {
-            return;
-        }
+        shared_ptr<TrivialReceiver> receiver =
+                MakeObject<TrivialReceiver>(event_loop);
 
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_waiting = false;
-        m_cv.notify_all();
-    }
+        Signal<CopyCounter> signal_payload;
+        uint invoke_count = 0;
+        auto slot = [&invoke_count](CopyCounter const &payload) {
+            if(payload.data == "payload") {
+                invoke_count++;
+            }
+        };
+
+        // Direct slots are passed a reference to the payload
+        signal_payload.Connect(slot);
+        signal_payload.Connect(slot,receiver,ConnectionType::Direct);
+
+        CopyCounter payload;
+        copy_count = 0;
+        signal_payload.Emit(payload);
+        REQUIRE(copy_count == 0);
+        REQUIRE(invoke_count == 2);
+
+        // Queued slots share a single copy of the payload
+        signal_payload.Connect(slot,receiver);
+        signal_payload.Connect(slot,receiver);
+        signal_payload.Connect(slot,receiver);
+
+        event_loop->Start();
+
+        invoke_count = 0;
+        copy_count = 0;
+        signal_payload.Emit(payload);
+        event_loop->ProcessEvents();
+        REQUIRE(copy_count == 1);
+        REQUIRE(invoke_count == 5);
+
+        // EmitMove doesn't copy at all
+        invoke_count = 0;
+        copy_count = 0;
+        signal_payload.EmitMove(CopyCounter());
+        event_loop->ProcessEvents();
+        REQUIRE(copy_count == 0);
+        REQUIRE(invoke_count == 5);
+
+        event_loop->Stop();
+    }
+
+    SECTION("Queued reference arguments")
+    {
+        // Queued slots must get copies of reference arguments,
+        // which are gone by the time the slots are invoked
+        shared_ptr<TrivialReceiver> receiver =
+                MakeObject<TrivialReceiver>(event_loop);
+
+        Signal<int&> signal_int_ref;
+        Signal<std::string const &> signal_str_ref;
+
+        int int_value = 0;
+        std::vector<std::string> list_str_values;
+
+        signal_int_ref.Connect(
+                    [&int_value](int &value) {
+                        int_value = value;
+                        value = 0;
+                    },
+                    receiver);
+
+        signal_str_ref.Connect(
+                    [&list_str_values](std::string const &value) {
+                        list_str_values.push_back(value);
+                    },
+                    receiver);
+
+        event_loop->Start();
+
+        unique_ptr<int> int_arg = make_unique<int>(42);
+        signal_int_ref.Emit(*int_arg);
+        int_arg.reset();
+
+        unique_ptr<std::string> str_arg =
+                make_unique<std::string>(
+                    "a string that doesn't fit in the small buffer");
+        signal_str_ref.Emit(*str_arg);
+        str_arg.reset();
+
+        signal_str_ref.EmitMove(std::string("moved"));
+
+        event_loop->ProcessEvents();
+        REQUIRE(int_value == 42);
+        REQUIRE(list_str_values.size() == 2);
+        REQUIRE(list_str_values[0] ==
+                "a string that doesn't fit in the small buffer");
+        REQUIRE(list_str_values[1] == "moved");
+
+        event_loop->Stop();
+    }
+
+    SECTION("Non-const reference slots")
+    {
+        // Slots that take a T& for a Signal<T> get their own
+        // copy of the argument, so they don't see each other's
+        // changes or change the caller's argument
+        shared_ptr<TrivialReceiver> receiver =
+                MakeObject<TrivialReceiver>(event_loop);
+
+        Signal<std::string> signal_str;
+        std::vector<std::string> list_str_values;
+
+        auto append = [&list_str_values](std::string &value) {
+            value.append("!");
+            list_str_values.push_back(value);
+        };
+
+        signal_str.Connect(append);
+        signal_str.Connect(append,receiver,ConnectionType::Direct);
+        signal_str.Connect(append,receiver);
+
+        event_loop->Start();
+
+        std::string const value = "str";
+        signal_str.Emit(value);
+        event_loop->ProcessEvents();
+
+        REQUIRE(list_str_values ==
+                (std::vector<std::string>{"str!","str!","str!"}));
+
+        event_loop->Stop();
+    }
+
+    SECTION("Queued group after disconnecting")
+    {
+        shared_ptr<TrivialReceiver> receiver_a =
+                MakeObject<TrivialReceiver>(event_loop);
+        shared_ptr<TrivialReceiver> receiver_b =
+                MakeObject<TrivialReceiver>(event_loop);
+
+        // Disconnecting the only connection for a loop drops its
+        // group, so the next connection starts a new one
+        Signal<> signal_count;
+        Id const cid_a = signal_count.Connect(
+                    receiver_a,&TrivialReceiver::SlotCount);
+        REQUIRE(signal_count.Disconnect(cid_a));
+
+        signal_count.Connect(receiver_b,&TrivialReceiver::SlotCount);
+        signal_count.Connect(receiver_b,&TrivialReceiver::SlotCount);
+
+        event_loop->Start();
+        signal_count.Emit();
+        event_loop->ProcessEvents();
+
+        REQUIRE(receiver_a->invoke_count == 0);
+        REQUIRE(receiver_b->invoke_count == 2);
+
+        event_loop->Stop();
+    }
+
+    SECTION("Queued fan-out")
+    {
+        shared_ptr<EventLoop> event_loop_b = make_shared<EventLoop>();
+
+        std::vector<shared_ptr<TrivialReceiver>> list_receivers;
+        for(uint i=0; i < 4; i++) {
+            list_receivers.push_back(
+                        MakeObject<TrivialReceiver>(event_loop));
+        }
+        shared_ptr<TrivialReceiver> receiver_b =
+                MakeObject<TrivialReceiver>(event_loop_b);
+
+        // Slots for receivers on the same EventLoop are posted
+        // together, but should still run in connection order
+        Signal<std::string> signal_str;
+        std::string order;
+        std::string order_b;
+        for(uint i=0; i < list_receivers.size(); i++) {
+            signal_str.Connect(
+                        [&order,i](std::string const &str) {
+                            order += str+std::to_string(i);
+                        },
+                        list_receivers[i]);
+
+            if(i == 1) {
+                signal_str.Connect(
+                            [&order_b](std::string const &str) {
+                                order_b += str;
+                            },
+                            receiver_b);
+            }
+        }
+
+        // Slots for destroyed receivers shouldn't be invoked
+        list_receivers[0].reset();
+
+        event_loop->Start();
+        event_loop_b->Start();
+
+        signal_str.Emit("a");
+        signal_str.Emit("b");
+        event_loop->ProcessEvents();
+        event_loop_b->ProcessEvents();
+
+        REQUIRE(order == "a1a2a3b1b2b3");
+        REQUIRE(order_b == "ab");
+
+        event_loop->Stop();
+        event_loop_b->Stop();
+    }
+
+    SECTION("Concurrent Emit")
+    {
+        Signal<uint> signal_wait;
+        std::atomic<uint> inside_count(0);
+        std::atomic<uint> invoke_count(0);
+
+        // Each slot waits until every emitting thread is
+        // inside it, which can only happen if Emit doesn't
+        // serialize concurrent callers
+        uint const thread_count = 4;
+        signal_wait.Connect(
+                    [&](uint) {
+                        inside_count++;
+                        while(inside_count < thread_count) {
+                            std::this_thread::yield();
+                        }
+                        invoke_count++;
+                    });
+
+        // Modify the connection list while emitting
+        std::atomic<bool> churn(true);
+        std::atomic<bool> churn_ok(true);
+        std::thread churn_thread(
+                    [&](){
+                        while(churn) {
+                            auto id = signal_wait.Connect([](uint){});
+                            if(!signal_wait.ConnectionValid(id) ||
+                               !signal_wait.Disconnect(id)) {
+                                churn_ok = false;
+                            }
+                        }
+                    });
+
+        std::vector<std::thread> list_threads;
+        for(uint i=0; i < thread_count; i++) {
+            list_threads.emplace_back(
+                        [&signal_wait,i](){
+                            signal_wait.Emit(i);
+                        });
+        }
+        for(auto& thread : list_threads) {
+            thread.join();
+        }
+
+        churn = false;
+        churn_thread.join();
+
+        REQUIRE(churn_ok);
+        REQUIRE(invoke_count == thread_count);
+        REQUIRE(signal_wait.GetConnectionCount() == 1);
+    }
+}
+
+
+// ============================================================= //
+// ============================================================= //
+
+class SequenceReceiver : public Object
+{
+public:
+    using base_type = ks::Object;
+
+    SequenceReceiver(Object::Key const &key,
+                     shared_ptr<EventLoop> event_loop) :
+        Object(key,event_loop),
+        ok(true),
+        count(0),
+        exclusive_count(0),
+        m_busy(false)
+    {
+        // empty
+    }
+
+    void Init(Object::Key const &,
+              shared_ptr<SequenceReceiver> const &)
+    {
+        // empty
+    }
+
+    ~SequenceReceiver()
+    {
+
+    }
+
+    void SlotSequence(uint seq)
+    {
+        // Slots for the same receiver must never run
+        // concurrently and must run in the order emitted
+        if(m_busy.exchange(true)) {
+            ok = false;
+        }
+        if(seq != count) {
+            ok = false;
+        }
+        std::this_thread::yield();
+        m_busy = false;
+        count++;
+    }
+
+    void SlotExclusive()
+    {
+        // Slots that are emitted from several threads
+        // still must never run concurrently
+        if(m_busy.exchange(true)) {
+            ok = false;
+        }
+        std::this_thread::yield();
+        m_busy = false;
+        exclusive_count++;
+    }
+
+    std::atomic<bool> ok;
+    std::atomic<uint> count;
+    std::atomic<uint> exclusive_count;
+
+private:
+    std::atomic<bool> m_busy;
+};
+
+// ============================================================= //
+
+class BlockingForwarder : public Object
+{
+public:
+    using base_type = ks::Object;
+
+    BlockingForwarder(Object::Key const &key,
+                      shared_ptr<EventLoop> event_loop) :
+        Object(key,event_loop)
+    {
+        // empty
+    }
+
+    void Init(Object::Key const &,
+              shared_ptr<BlockingForwarder> const &)
+    {
+        // empty
+    }
+
+    ~BlockingForwarder()
+    {
+
+    }
+
+    void SlotForward()
+    {
+        signal_forward.Emit();
+    }
+
+    Signal<> signal_forward;
+};
+
+// ============================================================= //
+
+TEST_CASE("EventLoop workers","[evloop]")
+{
+    EventLoop::Config config;
+
+    SECTION("Asio queue")
+    {
+        config.queue_type = EventLoop::QueueType::Asio;
+    }
+
+    SECTION("LockFree queue")
+    {
+        config.queue_type = EventLoop::QueueType::LockFree;
+        config.batch_size = 16;
+    }
+
+    config.worker_count = 4;
+
+    shared_ptr<EventLoop> event_loop = make_shared<EventLoop>(config);
+
+    // Objects use Strands as soon as they're created, even
+    // before their loop is started and Run
+    REQUIRE(MakeObject<SequenceReceiver>(event_loop)->GetStrand());
+
+    std::thread thread = EventLoop::LaunchInThread(event_loop);
+    REQUIRE(event_loop->GetWorkerCount() == 4);
+
+    uint const receiver_count = 8;
+    uint const emit_count = 200;
+
+    Signal<uint> signal_seq;
+    std::vector<shared_ptr<SequenceReceiver>> list_receivers;
+    for(uint i=0; i < receiver_count; i++) {
+        list_receivers.push_back(
+                    MakeObject<SequenceReceiver>(event_loop));
+
+        signal_seq.Connect(
+                    list_receivers.back(),
+                    &SequenceReceiver::SlotSequence);
+    }
+
+    for(uint i=0; i < emit_count; i++) {
+        signal_seq.Emit(i);
+    }
+
+    // Wait for every receiver to process all of its slots
+    for(auto& receiver : list_receivers) {
+        while(receiver->count != emit_count) {
+            std::this_thread::sleep_for(Milliseconds(1));
+        }
+    }
+
+    for(auto& receiver : list_receivers) {
+        REQUIRE(receiver->ok);
+    }
+
+    // Blocking and Queued emits to one receiver
+    {
+        // Forwarders run on workers and emit Blocking signals
+        // to a receiver that also gets Queued signals. There are
+        // fewer forwarders than workers so that a worker is always
+        // free to run the receiver while the forwarders wait
+        uint const forwarder_count = 2;
+
+        auto receiver = MakeObject<SequenceReceiver>(event_loop);
+
+        Signal<> signal_forward;
+        Signal<> signal_queued;
+        signal_queued.Connect(receiver,&SequenceReceiver::SlotExclusive);
+
+        std::vector<shared_ptr<BlockingForwarder>> list_forwarders;
+        for(uint i=0; i < forwarder_count; i++) {
+            list_forwarders.push_back(
+                        MakeObject<BlockingForwarder>(event_loop));
+
+            signal_forward.Connect(
+                        list_forwarders.back(),
+                        &BlockingForwarder::SlotForward);
+
+            list_forwarders.back()->signal_forward.Connect(
+                        receiver,
+                        &SequenceReceiver::SlotExclusive,
+                        ConnectionType::Blocking);
+        }
+
+        for(uint i=0; i < emit_count; i++) {
+            signal_forward.Emit();
+            signal_queued.Emit();
+        }
+
+        while(receiver->exclusive_count != emit_count*(forwarder_count+1)) {
+            std::this_thread::sleep_for(Milliseconds(1));
+        }
+
+        REQUIRE(receiver->ok);
+    }
+
+    EventLoop::RemoveFromThread(event_loop,thread);
+}
+
+// ============================================================= //
+// ============================================================= //
+
+class WakeupReceiver : public Object
+{
+public:
+
+    using base_type = ks::Object;
+    WakeupReceiver(Object::Key const &key,
+                   shared_ptr<EventLoop> event_loop) :
+        Object(key,event_loop),
+        m_wakeup_count(0),
+        m_wakeup_limit(0),
+        m_waiting(false)
+    {
+       // empty
+    }
+
+    void Init(Object::Key const &,
+              shared_ptr<WakeupReceiver> const &)
+    {
+
+    }
+
+    ~WakeupReceiver()
+    {
+
+    }
+
+    void Prepare(uint wakeup_limit)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiting = true;
+        m_wakeup_count = 0;
+        m_wakeup_limit = wakeup_limit;
+    }
+
+    void Block()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while(m_waiting) {
+            m_cv.wait(lock);
+        }
+    }
+
+    void OnSleepFor(Milliseconds sleep_ms)
+    {
+        std::this_thread::sleep_for(sleep_ms);
+    }
+
+    void OnWakeup()
+    {
+        m_wakeup_count++;
+
+        if(m_wakeup_count < m_wakeup_limit) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_waiting = false;
+        m_cv.notify_all();
+    }
 
 private:
     uint m_wakeup_count;
@@ -998,5 +2192,886 @@ TEST_CASE("ks::Timer","[timers]") {
     }
 }
 
+TEST_CASE("ks::Timer wheel","[timers]") {
+
+    EventLoop::Config config;
+    config.timer_type = EventLoop::TimerType::Wheel;
+
+    shared_ptr<EventLoop> event_loop =
+            make_shared<EventLoop>(config);
+
+    std::thread thread = EventLoop::LaunchInThread(event_loop);
+
+    shared_ptr<WakeupReceiver> receiver =
+            MakeObject<WakeupReceiver>(event_loop);
+
+    SECTION("many timers: ") {
+        // Intervals past 256ms have to be
+        // cascaded from the second level
+        uint const timer_count = 300;
+        std::atomic<uint> timeout_count(0);
+        std::atomic<bool> early(false);
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<shared_ptr<Timer>> list_timers;
+        for(uint i=0; i < timer_count; i++) {
+            Milliseconds const interval_ms(i+1);
+
+            shared_ptr<Timer> timer = MakeObject<Timer>(event_loop);
+            timer->signal_timeout.Connect(
+                        [&,start,interval_ms]() {
+                            auto const elapsed =
+                                    std::chrono::steady_clock::now()-start;
+                            if(elapsed < interval_ms) {
+                                early = true;
+                            }
+                            timeout_count++;
+                        },
+                        receiver);
+
+            timer->Start(interval_ms,false);
+            list_timers.push_back(timer);
+        }
+
+        // Stop every other timer from 100ms on
+        uint stopped_count=0;
+        for(uint i=99; i < timer_count; i+=2) {
+            list_timers[i]->Stop();
+            stopped_count++;
+        }
+
+        std::this_thread::sleep_for(Milliseconds(timer_count+50));
+        EventLoop::RemoveFromThread(event_loop,thread,true);
+
+        REQUIRE_FALSE(early);
+        REQUIRE(timeout_count == (timer_count-stopped_count));
+
+        bool inactive = true;
+        for(auto& timer : list_timers) {
+            inactive = inactive && !timer->GetActive();
+        }
+        REQUIRE(inactive);
+    }
+
+    SECTION("repeating: ") {
+        shared_ptr<Timer> timer = MakeObject<Timer>(event_loop);
+        timer->signal_timeout.Connect(
+                    receiver,
+                    &WakeupReceiver::OnWakeup);
+
+        auto start = std::chrono::steady_clock::now();
+
+        receiver->Prepare(3); // wait for 3 timeout signals
+        timer->Start(Milliseconds(33),true);
+        receiver->Block();
+
+        Milliseconds interval_ms =
+                std::chrono::duration_cast<
+                    Milliseconds
+                >(std::chrono::steady_clock::now()-start);
+
+        REQUIRE(timer->GetActive());
+        REQUIRE(interval_ms.count() >= 99);
+
+        timer->Stop();
+        REQUIRE_FALSE(timer->GetActive());
+
+        EventLoop::RemoveFromThread(event_loop,thread,true);
+    }
+
+    SECTION("destroyed timers: ") {
+        // Destroying a running timer frees its entry
+        // for the next timer that's started
+        shared_ptr<Timer> timer = MakeObject<Timer>(event_loop);
+        timer->Start(Milliseconds(10),false);
+        timer = MakeObject<Timer>(event_loop);
+        timer->Start(Milliseconds(10),true);
+        timer.reset();
+
+        timer = MakeObject<Timer>(event_loop);
+        timer->signal_timeout.Connect(
+                    receiver,
+                    &WakeupReceiver::OnWakeup);
+
+        receiver->Prepare(1);
+        timer->Start(Milliseconds(10),false);
+        receiver->Block();
+
+        REQUIRE_FALSE(timer->GetActive());
+
+        EventLoop::RemoveFromThread(event_loop,thread,true);
+    }
+}
+
+TEST_CASE("ks::Timer wheel workers","[timers]") {
+
+    EventLoop::Config config;
+    config.timer_type = EventLoop::TimerType::Wheel;
+    config.worker_count = 4;
+
+    shared_ptr<EventLoop> event_loop =
+            make_shared<EventLoop>(config);
+
+    std::thread thread = EventLoop::LaunchInThread(event_loop);
+
+    // Repeating timers keep the wheel waking up on every
+    // tick while other timers are restarted from this thread
+    uint const timer_count = 16;
+    std::vector<std::atomic<uint>> list_counts(timer_count);
+    std::vector<shared_ptr<SequenceReceiver>> list_receivers;
+    std::vector<shared_ptr<Timer>> list_timers;
+
+    for(uint i=0; i < timer_count; i++) {
+        list_counts[i] = 0;
+        list_receivers.push_back(
+                    MakeObject<SequenceReceiver>(event_loop));
+
+        shared_ptr<Timer> timer = MakeObject<Timer>(event_loop);
+        std::atomic<uint> * count = &(list_counts[i]);
+        timer->signal_timeout.Connect(
+                    [count]() { (*count)++; },
+                    list_receivers.back());
+
+        list_timers.push_back(timer);
+    }
+
+    // Even timers repeat and odd ones are churned
+    for(uint i=0; i < timer_count; i+=2) {
+        list_timers[i]->Start(Milliseconds(1+(i%4)),true);
+    }
+
+    for(uint j=0; j < 100; j++) {
+        for(uint i=1; i < timer_count; i+=2) {
+            list_timers[i]->Start(Milliseconds(1+(j%3)),(j%2)==0);
+        }
+        std::this_thread::sleep_for(Milliseconds(1));
+        for(uint i=1; i < timer_count; i+=4) {
+            list_timers[i]->Stop();
+        }
+    }
+
+    for(auto& timer : list_timers) {
+        timer->Stop();
+    }
+
+    EventLoop::RemoveFromThread(event_loop,thread,true);
+
+    bool fired = true;
+    bool inactive = true;
+    for(uint i=0; i < timer_count; i++) {
+        if((i%2) == 0) {
+            fired = fired && (list_counts[i] > 0);
+        }
+        inactive = inactive && !list_timers[i]->GetActive();
+    }
+    REQUIRE(fired);
+    REQUIRE(inactive);
+}
+
+// ============================================================= //
+
+namespace test_log
+{
+    std::string ReadFile(std::string const &path)
+    {
+        std::ifstream file(path);
+        std::stringstream ss;
+        ss << file.rdbuf();
+        return ss.str();
+    }
+
+    class BinarySinkToString : public Log::BinarySink
+    {
+    public:
+        void write(char const * data,std::size_t size)
+        {
+            m_data.append(data,size);
+        }
+
+        std::string m_data;
+    };
+
+    // Collects lines, optionally blocking in log()
+    // until Release() is called
+    class SinkToList : public Log::Sink
+    {
+    public:
+        void log(std::string const &line)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(m_hold) {
+                m_cv.wait(lock);
+            }
+            m_list_lines.push_back(line);
+        }
+
+        void endBatch()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_batch_count++;
+        }
+
+        void Hold()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_hold = true;
+        }
+
+        void Release()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_hold = false;
+            m_cv.notify_all();
+        }
+
+        std::vector<std::string> GetLines()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_list_lines;
+        }
+
+        uint GetBatchCount()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_batch_count;
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_hold{false};
+        uint m_batch_count{0};
+        std::vector<std::string> m_list_lines;
+    };
+}
+
+TEST_CASE("Logger","[log]")
+{
+    using Level = Log::Logger::Level;
+
+    auto sink = make_shared<test_log::SinkToList>();
+    Log::Logger logger(true,sink,{{ {},{},{},{},{},{} }});
+    shared_ptr<EventLoop> event_loop = make_shared<EventLoop>();
+
+    SECTION("Sync")
+    {
+        logger.Info() << "a" << 1;
+        logger.UnsetLevel(Level::DEBUG);
+        logger.Debug() << "b";
+
+        auto const list_lines = sink->GetLines();
+        REQUIRE(list_lines.size() == 1);
+        REQUIRE(list_lines[0] == "a1");
+        REQUIRE(sink->GetBatchCount() == 1);
+    }
+
+    SECTION("Formatting")
+    {
+        logger.Info() << 'c' << true << -42 << (-9223372036854775807ll-1)
+                      << 42ul << 0u << 1.5f << 0.1 << 1e20 << -3.25;
+
+        std::string const expect =
+                ToString('c')+ToString(true)+ToString(-42)+
+                ToString(-9223372036854775807ll-1)+ToString(42ul)+
+                ToString(0u)+ToString(1.5f)+ToString(0.1)+
+                ToString(1e20)+ToString(-3.25);
+
+        REQUIRE(sink->GetLines() == std::vector<std::string>{expect});
+    }
+
+    SECTION("Nested lines")
+    {
+        // A line logged while formatting another one
+        // shouldn't clobber the outer line's buffer
+        {
+            auto line = logger.Info();
+            line << "outer";
+            logger.Info() << "inner";
+            line << "-end";
+        }
+        REQUIRE(sink->GetLines() ==
+                (std::vector<std::string>{"inner","outer-end"}));
+    }
+
+    SECTION("Format blocks")
+    {
+        logger.AddFormatBlock(make_unique<Log::FBTimestamp>(),Level::INFO);
+        logger.AddFormatBlock(make_unique<Log::FBCustomStr>(" "),Level::INFO);
+        logger.AddFormatBlock(make_unique<Log::FBRunTimeMs>(),Level::INFO);
+        logger.AddFormatBlock(make_unique<Log::FBCustomStr>(" "),Level::INFO);
+        logger.AddFormatBlock(make_unique<Log::FBLoopId>(),Level::INFO);
+        logger.AddFormatBlock(make_unique<Log::FBCustomStr>(": "),Level::INFO);
+
+        logger.Info() << "x";
+
+        event_loop->Start();
+        event_loop->PostCallback([&logger](){ logger.Info() << "y"; });
+        event_loop->ProcessEvents();
+        event_loop->Stop();
+
+        auto const list_lines = sink->GetLines();
+        REQUIRE(list_lines.size() == 2);
+
+        // 2016-01-31T23:59:59.999Z 00:00:00.000 -: x
+        auto const &line = list_lines[0];
+        bool format_ok = (line.size() == 42);
+        for(uint i : {4u,7u}) {
+            format_ok = format_ok && (line[i] == '-');
+        }
+        for(uint i : {13u,16u,27u,30u}) {
+            format_ok = format_ok && (line[i] == ':');
+        }
+        format_ok = format_ok &&
+                (line[10] == 'T') && (line[23] == 'Z') &&
+                (line.substr(25,8) == "00:00:00") &&
+                (line.substr(38) == "-: x");
+        REQUIRE(format_ok);
+
+        REQUIRE(list_lines[1].substr(38) ==
+                ToString(event_loop->GetId())+": y");
+    }
+
+    SECTION("Binary")
+    {
+        auto binary_sink = make_shared<test_log::BinarySinkToString>();
+        REQUIRE(logger.AddBinarySink(binary_sink));
+
+        uint eval_count=0;
+        logger.UnsetLevel(Level::TRACE);
+        KS_LOG_BINARY(logger,TRACE,"skipped {}",++eval_count);
+
+        for(int i=0; i < 2; i++) {
+            KS_LOG_BINARY(logger,INFO,"int {} uint {} float {} str {} {}",
+                          -i,42u,0.5,"abc",std::string("def"));
+        }
+        KS_LOG_BINARY(logger,WARN,"no args; {} extra",'c',true,u8(7));
+
+        REQUIRE(eval_count == 0);
+        REQUIRE(sink->GetLines().empty());
+
+        std::istringstream in(binary_sink->m_data);
+        std::ostringstream out;
+        REQUIRE(Log::DecodeBinaryLog(in,out));
+
+        // Strip the timestamp and thread id
+        std::vector<std::string> list_lines;
+        std::istringstream out_lines(out.str());
+        std::string line;
+        while(std::getline(out_lines,line)) {
+            std::size_t const level_pos = line.find(' ',26);
+            list_lines.push_back(line.substr(level_pos+1));
+        }
+
+        REQUIRE(list_lines == (std::vector<std::string>{
+                    "INFO: int 0 uint 42 float 0.5 str abc def",
+                    "INFO: int -1 uint 42 float 0.5 str abc def",
+                    "WARN: no args; c extra 1 7"
+                }));
+
+        // Truncated streams are rejected
+        std::istringstream truncated(
+                    binary_sink->m_data.substr(
+                        0,binary_sink->m_data.size()-1));
+        REQUIRE_FALSE(Log::DecodeBinaryLog(truncated,out));
+
+        // So are corrupt string lengths, without trying
+        // to allocate them first
+        std::string corrupt = binary_sink->m_data.substr(0,12);
+        corrupt.push_back(
+                    static_cast<char>(Log::binary_detail::Record::Site));
+        corrupt.append(4,'\0'); // id
+        corrupt.append(1,'\2'); // level
+        corrupt.append(4,'\0'); // line
+        corrupt.append(4,'\xff'); // file length
+        corrupt.append("file");
+
+        std::istringstream corrupt_in(corrupt);
+        REQUIRE_FALSE(Log::DecodeBinaryLog(corrupt_in,out));
+    }
+
+    SECTION("Binary async")
+    {
+        auto binary_sink = make_shared<test_log::BinarySinkToString>();
+        REQUIRE(logger.AddBinarySink(binary_sink));
+        REQUIRE(logger.StartAsync(64));
+
+        // Binary lines are queued and written by the sink
+        // thread along with text lines
+        uint const thread_count=4;
+        uint const line_count=500;
+        std::vector<std::thread> list_threads;
+        for(uint i=0; i < thread_count; i++) {
+            list_threads.emplace_back(
+                        [&logger,i](){
+                for(uint j=0; j < line_count; j++) {
+                    KS_LOG_BINARY(logger,INFO,"{} {}",i,j);
+                }
+            });
+        }
+        for(auto &thread : list_threads) {
+            thread.join();
+        }
+        logger.Info() << "text";
+        logger.Flush();
+
+        REQUIRE(sink->GetLines() == std::vector<std::string>{"text"});
+
+        std::istringstream in(binary_sink->m_data);
+        std::ostringstream out;
+        REQUIRE(Log::DecodeBinaryLog(in,out));
+
+        uint decoded_count=0;
+        std::istringstream out_lines(out.str());
+        std::string line;
+        while(std::getline(out_lines,line)) {
+            decoded_count++;
+        }
+        REQUIRE(decoded_count == thread_count*line_count);
+
+        logger.StopAsync();
+    }
+
+    SECTION("File sink")
+    {
+        std::string const path = "ks_test_log.txt";
+        std::remove(path.c_str());
+        for(uint i=1; i <= 3; i++) {
+            std::remove((path+"."+ToString(i)).c_str());
+        }
+
+        SECTION("Flush policy")
+        {
+            Log::SinkToFile::Config config;
+            config.path = path;
+            auto file_sink = make_shared<Log::SinkToFile>(config);
+            logger.AddSink(file_sink);
+
+            logger.Info() << "info";
+            REQUIRE(test_log::ReadFile(path).empty());
+
+            logger.Error() << "error";
+            REQUIRE(test_log::ReadFile(path) == "info\nerror\n");
+
+            logger.Info() << "flush";
+            logger.Flush();
+            REQUIRE(test_log::ReadFile(path) == "info\nerror\nflush\n");
+        }
+
+        SECTION("Rotation")
+        {
+            Log::SinkToFile::Config config;
+            config.path = path;
+            config.flush_each_line = true;
+            config.rotate_size = 100;
+            config.rotate_count = 2;
+
+            {
+                auto file_sink = make_shared<Log::SinkToFile>(config);
+                logger.AddSink(file_sink);
+
+                // 20 bytes per line with the newline
+                for(uint i=0; i < 16; i++) {
+                    logger.Info() << std::string(19,'a'+i);
+                }
+
+                REQUIRE(file_sink->GetRotationCount() == 3);
+                logger.RemoveSink(file_sink);
+            }
+
+            REQUIRE(test_log::ReadFile(path) == std::string(19,'p')+"\n");
+            REQUIRE(test_log::ReadFile(path+".1").size() == 100);
+            REQUIRE(test_log::ReadFile(path+".1").substr(0,1) == "k");
+            REQUIRE(test_log::ReadFile(path+".2").substr(0,1) == "f");
+            REQUIRE_FALSE(std::ifstream(path+".3").good());
+        }
+
+        SECTION("Reopen after a failed rotation")
+        {
+            std::string const dir = "ks_test_log_dir";
+            ::mkdir(dir.c_str(),0755);
+
+            Log::SinkToFile::Config config;
+            config.path = dir+"/"+path;
+            config.flush_each_line = true;
+            config.rotate_size = 10;
+            config.rotate_count = 0;
+
+            auto file_sink = make_shared<Log::SinkToFile>(config);
+            logger.AddSink(file_sink);
+            logger.Info() << "aaaa";
+
+            // The file can't be reopened once it's rotated, so
+            // the line is dropped (and reported on stderr)
+            std::remove(config.path.c_str());
+            ::rmdir(dir.c_str());
+            logger.Info() << "bbbbbbbbb";
+            REQUIRE(file_sink->GetDroppedBytes() == 10);
+
+            // Opening is retried when the next line is written
+            ::mkdir(dir.c_str(),0755);
+            logger.Info() << "c";
+            REQUIRE(test_log::ReadFile(config.path) == "c\n");
+            REQUIRE(file_sink->GetDroppedBytes() == 10);
+
+            logger.RemoveSink(file_sink);
+            file_sink.reset();
+            std::remove(config.path.c_str());
+            ::rmdir(dir.c_str());
+        }
+
+        std::remove(path.c_str());
+        for(uint i=1; i <= 3; i++) {
+            std::remove((path+"."+ToString(i)).c_str());
+        }
+    }
+
+    SECTION("Flight recorder")
+    {
+        Log::SinkFlightRecorder::Config config;
+        config.path = "ks_test_recorder.txt";
+        config.capacity = 4;
+        config.line_size = 8;
+        std::remove(config.path.c_str());
+
+        auto recorder = make_shared<Log::SinkFlightRecorder>(config);
+        logger.UnsetLevel(Level::TRACE);
+        logger.SetFlightRecorder(recorder);
+
+        SECTION("Dump on FATAL line")
+        {
+            for(uint i=0; i < 6; i++) {
+                KS_LOG_TRACE(logger) << "t" << i;
+            }
+            logger.Info() << "truncated line";
+            REQUIRE(sink->GetLines() ==
+                    std::vector<std::string>{"truncated line"});
+            REQUIRE(test_log::ReadFile(config.path).empty());
+
+            logger.Fatal() << "f";
+            REQUIRE(recorder->GetLineCount() == 8);
+            REQUIRE(test_log::ReadFile(config.path) ==
+                    "t4\nt5\ntruncate\nf\n");
+        }
+
+        SECTION("Dump on FATAL ks::Exception")
+        {
+            Log::SinkFlightRecorder::SetGlobal(recorder);
+
+            logger.Trace() << "before";
+            Exception ex(Exception::ErrorLevel::FATAL,"KsTest: Expect FATAL");
+            REQUIRE(test_log::ReadFile(config.path) == "before\n");
+
+            Log::SinkFlightRecorder::SetGlobal(nullptr);
+        }
+
+        SECTION("Concurrent lines")
+        {
+            uint const thread_count=4;
+            uint const line_count=2000;
+
+            // Recorder only lines from several threads that
+            // keep wrapping around the same slots
+            std::vector<std::thread> list_threads;
+            for(uint i=0; i < thread_count; i++) {
+                list_threads.emplace_back(
+                            [&logger,i](){
+                    std::string const text(7,static_cast<char>('a'+i));
+                    for(uint j=0; j < line_count; j++) {
+                        logger.Trace() << text;
+                    }
+                });
+            }
+            for(auto &thread : list_threads) {
+                thread.join();
+            }
+
+            REQUIRE(recorder->GetLineCount() == thread_count*line_count);
+            REQUIRE(sink->GetLines().empty());
+
+            // Every recorded line should be whole. Lines whose
+            // slot was still being written are dropped instead
+            REQUIRE(recorder->Dump());
+            std::string const dump = test_log::ReadFile(config.path);
+            REQUIRE(dump.size() <= 4*8);
+            REQUIRE(dump.size()%8 == 0);
+
+            bool whole=true;
+            for(uint k=0; k < dump.size()/8; k++) {
+                std::string const line = dump.substr(k*8,7);
+                whole = whole &&
+                        (line == std::string(7,line[0])) &&
+                        (dump[k*8+7] == '\n');
+            }
+            REQUIRE(whole);
+        }
+
+        std::remove(config.path.c_str());
+    }
+
+    SECTION("Macros")
+    {
+        uint eval_count=0;
+        auto eval = [&eval_count]() {
+            eval_count++;
+            return eval_count;
+        };
+
+        logger.UnsetLevel(Level::TRACE);
+        REQUIRE_FALSE(logger.IsEnabled(Level::TRACE));
+        REQUIRE(logger.IsEnabled(Level::DEBUG));
+
+        KS_LOG_TRACE(logger) << eval();
+        KS_LOG_DEBUG(logger) << eval();
+
+        // Must bind like a single statement
+        if(eval_count == 0)
+            KS_LOG_INFO(logger) << "unexpected";
+        else
+            KS_LOG(logger,WARN) << "expected";
+
+        REQUIRE(eval_count == 1);
+        REQUIRE(sink->GetLines() ==
+                (std::vector<std::string>{"1","expected"}));
+    }
+
+    SECTION("Sampling and rate limiting")
+    {
+        uint eval_count=0;
+        auto eval = [&eval_count](uint i) {
+            eval_count++;
+            return i;
+        };
+
+        for(uint i=0; i < 10; i++) {
+            KS_LOG_EVERY_N(logger,INFO,4) << "s" << eval(i);
+        }
+        REQUIRE(eval_count == 3);
+
+        for(uint i=0; i < 11; i++) {
+            if(i == 10) {
+                // Let a token refill
+                std::this_thread::sleep_for(Milliseconds(60));
+            }
+            KS_LOG_RATE_LIMITED(logger,WARN,20,3) << "r" << i;
+        }
+
+        REQUIRE(sink->GetLines() == (std::vector<std::string>{
+                    "s0",
+                    "s4 (suppressed 3 similar lines)",
+                    "s8 (suppressed 3 similar lines)",
+                    "r0","r1","r2",
+                    "r10 (suppressed 7 similar lines)"
+                }));
+    }
+
+    SECTION("Async")
+    {
+        REQUIRE(logger.StartAsync(64));
+        REQUIRE_FALSE(logger.StartAsync(64));
+
+        uint const thread_count=4;
+        uint const line_count=2000;
+
+        std::vector<std::thread> list_threads;
+        for(uint i=0; i < thread_count; i++) {
+            list_threads.emplace_back(
+                        [&logger,i](){
+                for(uint j=0; j < line_count; j++) {
+                    logger.Info() << i << ":" << j;
+                }
+            });
+        }
+        for(auto &thread : list_threads) {
+            thread.join();
+        }
+
+        logger.Flush();
+
+        // Lines from each thread should arrive in order
+        auto const list_lines = sink->GetLines();
+        REQUIRE(list_lines.size() == thread_count*line_count);
+
+        std::vector<uint> list_next(thread_count,0);
+        bool ordered=true;
+        for(auto const &line : list_lines) {
+            std::size_t const sep = line.find(':');
+            uint const i = std::stoul(line.substr(0,sep));
+            uint const j = std::stoul(line.substr(sep+1));
+            ordered = ordered && (list_next[i] == j);
+            list_next[i] = j+1;
+        }
+        REQUIRE(ordered);
+        REQUIRE(logger.GetDroppedCount() == 0);
+
+        // The sink thread ends a batch after many lines
+        REQUIRE(sink->GetBatchCount() < list_lines.size());
+
+        logger.StopAsync();
+        logger.Info() << "sync";
+        REQUIRE(sink->GetLines().back() == "sync");
+    }
+
+    SECTION("Async overflow")
+    {
+        uint const line_count=32;
+        sink->Hold();
+        logger.StartAsync(4,Log::Logger::OverflowPolicy::CountDrops);
+
+        for(uint i=0; i < line_count; i++) {
+            logger.Info() << i;
+        }
+
+        u64 const dropped = logger.GetDroppedCount();
+        REQUIRE(dropped >= line_count-5);
+
+        sink->Release();
+        logger.Flush();
+
+        auto const list_lines = sink->GetLines();
+        REQUIRE(list_lines.size() == line_count-dropped+1);
+        REQUIRE(list_lines.back() ==
+                "KS: Log: dropped "+ToString(dropped)+" lines");
+    }
+
+    SECTION("Async stalled sink")
+    {
+        uint const thread_count=4;
+        uint const line_count=64;
+
+        sink->Hold();
+        logger.StartAsync(1024);
+        logger.Info() << "stall";
+
+        // Flush holds the Logger's mutex until the
+        // stalled sink drains
+        std::thread flush_thread(
+                    [&logger](){
+            logger.Flush();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        // Producers shouldn't wait on the sink or on Flush
+        std::atomic<uint> done_count(0);
+        std::vector<std::thread> list_threads;
+        for(uint i=0; i < thread_count; i++) {
+            list_threads.emplace_back(
+                        [&logger,&done_count,i](){
+                for(uint j=0; j < line_count; j++) {
+                    logger.Info() << i << ":" << j;
+                }
+                done_count++;
+            });
+        }
+
+        auto const timeout =
+                std::chrono::steady_clock::now()+
+                std::chrono::seconds(5);
+
+        while(done_count.load() != thread_count &&
+              std::chrono::steady_clock::now() < timeout) {
+            std::this_thread::yield();
+        }
+        REQUIRE(done_count.load() == thread_count);
+
+        sink->Release();
+        for(auto &thread : list_threads) {
+            thread.join();
+        }
+        flush_thread.join();
+        logger.Flush();
+
+        REQUIRE(sink->GetLines().size() == thread_count*line_count+1);
+        REQUIRE(logger.GetDroppedCount() == 0);
+    }
+}
+
+// ============================================================= //
+
+TEST_CASE("Exception","[exception]")
+{
+    using ErrorLevel = Exception::ErrorLevel;
+
+    SECTION("Without stack trace")
+    {
+        Exception ex(ErrorLevel::WARN,"KsTest: Expect WARN");
+        REQUIRE(ex.GetLevel() == ErrorLevel::WARN);
+        REQUIRE(ex.GetMessage() == "KsTest: Expect WARN");
+        REQUIRE(ex.GetStackTrace().empty());
+        REQUIRE(std::string(ex.what()) == "WARN:  KsTest: Expect WARN");
+    }
+
+#ifdef KS_EXCEPTION_STACK_TRACE
+    SECTION("With stack trace")
+    {
+        Exception ex(ErrorLevel::WARN,"KsTest: Expect WARN",true);
+        REQUIRE_FALSE(ex.GetStackTrace().empty());
+        REQUIRE(ex.GetStackTrace().find("#0 ") == 0);
+
+        std::string const what = ex.what();
+        REQUIRE(what.find("WARN:  KsTest: Expect WARN\n#0 ") == 0);
+
+        Exception ex_assigned;
+        ex_assigned = ex;
+        REQUIRE(std::string(ex_assigned.what()) == what);
+
+        ex_assigned = Exception();
+        REQUIRE(ex_assigned.GetStackTrace().empty());
+        REQUIRE(std::string(ex_assigned.what()).empty());
+    }
+
+    SECTION("Concurrent what()")
+    {
+        Exception ex(ErrorLevel::WARN,"KsTest: Expect WARN",true);
+
+        // The first what() from any thread symbolizes
+        // the trace; every thread should get the same text
+        uint const thread_count=4;
+        std::vector<std::string> list_what(thread_count);
+        std::vector<std::thread> list_threads;
+        for(uint i=0; i < thread_count; i++) {
+            list_threads.emplace_back(
+                        [&ex,&list_what,i](){
+                list_what[i] = ex.what();
+            });
+        }
+        for(auto &thread : list_threads) {
+            thread.join();
+        }
+
+        std::string const what = ex.what();
+        REQUIRE(what.find("WARN:  KsTest: Expect WARN\n#0 ") == 0);
+        for(auto const &thread_what : list_what) {
+            REQUIRE(thread_what == what);
+        }
+
+        Exception ex_copy(ex);
+        REQUIRE(std::string(ex_copy.what()) == what);
+    }
+#endif
+
+    SECTION("Default")
+    {
+        Exception ex;
+        REQUIRE(std::string(ex.what()).empty());
+    }
+
+    SECTION("Log on create")
+    {
+        auto sink = make_shared<test_log::SinkToList>();
+        LOG.AddSink(sink);
+
+        Exception::SetLogOnCreate(false);
+        Exception ex0(ErrorLevel::WARN,"KsTest: Not logged");
+        REQUIRE(sink->GetLines().empty());
+
+        Exception::SetLogOnCreate(true);
+        Exception ex1(ErrorLevel::WARN,"KsTest: Expect WARN");
+        REQUIRE(sink->GetLines().size() == 1);
+
+        LOG.RemoveSink(sink);
+    }
+}
+
 // ============================================================= //
 // ============================================================= //
@@ -0,0 +1,62 @@
+/*
+   Copyright (C) 2015 Preet Desai (preet.desai@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <fstream>
+#include <iostream>
+
+#include <ks/KsLogBinary.hpp>
+
+// ks_logdecode
+// * usage: ks_logdecode <binary log> [output file]
+// * writes the decoded text to stdout if no output
+//   file is given
+int main(int argc, char* argv[])
+{
+    if((argc < 2) || (argc > 3)) {
+        std::cerr << "usage: ks_logdecode <binary log> [output file]"
+                  << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(argv[1],std::ios::binary);
+    if(!in) {
+        std::cerr << "ks_logdecode: failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ofstream out_file;
+    if(argc == 3) {
+        out_file.open(argv[2]);
+        if(!out_file) {
+            std::cerr << "ks_logdecode: failed to open "
+                      << argv[2] << std::endl;
+            return 1;
+        }
+    }
+
+    std::ostream &out = (argc == 3) ? out_file : std::cout;
+
+    if(!ks::Log::DecodeBinaryLog(in,out)) {
+        out.flush();
+        std::cerr << "ks_logdecode: " << argv[1]
+                  << " is not a valid binary log or is truncated"
+                  << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,14 @@
+# ks_logdecode
+# * converts a binary log written with KS_LOG_BINARY to text
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+CONFIG -= app_bundle
+
+TARGET = ks_logdecode
+
+include($${PWD}/../../../ks_core.pri)
+
+SOURCES += \
+    $${PWD}/ks_logdecode.cpp
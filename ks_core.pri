@@ -8,31 +8,49 @@ HEADERS += \
     $${PATH_KS_CORE}/KsConfig.hpp \
     $${PATH_KS_CORE}/KsGlobal.hpp \
     $${PATH_KS_CORE}/KsLog.hpp \
+    $${PATH_KS_CORE}/KsLogBinary.hpp \
+    $${PATH_KS_CORE}/KsLogFile.hpp \
+    $${PATH_KS_CORE}/KsLogRecorder.hpp \
     $${PATH_KS_CORE}/KsException.hpp \
     $${PATH_KS_CORE}/KsMiscUtils.hpp \
+    $${PATH_KS_CORE}/KsFunction.hpp \
+    $${PATH_KS_CORE}/KsEventPool.hpp \
     $${PATH_KS_CORE}/KsEvent.hpp \
     $${PATH_KS_CORE}/KsTask.hpp \
     $${PATH_KS_CORE}/KsEventLoop.hpp \
     $${PATH_KS_CORE}/KsObject.hpp \
     $${PATH_KS_CORE}/KsSignal.hpp \
-    $${PATH_KS_CORE}/KsTimer.hpp
+    $${PATH_KS_CORE}/KsTimer.hpp \
+    $${PATH_KS_CORE}/KsWatchdog.hpp
 
 SOURCES += \
     $${PATH_KS_CORE}/KsLog.cpp \
+    $${PATH_KS_CORE}/KsLogBinary.cpp \
+    $${PATH_KS_CORE}/KsLogFile.cpp \
+    $${PATH_KS_CORE}/KsLogRecorder.cpp \
     $${PATH_KS_CORE}/KsException.cpp \
+    $${PATH_KS_CORE}/KsEventPool.cpp \
     $${PATH_KS_CORE}/KsTask.cpp \
     $${PATH_KS_CORE}/KsEventLoop.cpp \
     $${PATH_KS_CORE}/KsObject.cpp \
     $${PATH_KS_CORE}/KsSignal.cpp \
-    $${PATH_KS_CORE}/KsTimer.cpp
+    $${PATH_KS_CORE}/KsTimer.cpp \
+    $${PATH_KS_CORE}/KsWatchdog.cpp
 
 # thirdparty
 include($${PATH_KS_CORE}/thirdparty/asio/asio.pri)
 
 # need to link pthreads to use std::thread
 !android {
-    LIBS += -lpthread
+    LIBS += -lpthread -ldl
 }
 
 QMAKE_CXXFLAGS += -std=c++11
 
+
+# CONFIG += ks_no_exceptions builds ks with exceptions
+# disabled (see KS_NO_EXCEPTIONS in KsConfig.hpp)
+ks_no_exceptions {
+    CONFIG += exceptions_off
+    DEFINES += KS_NO_EXCEPTIONS
+}